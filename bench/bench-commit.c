@@ -0,0 +1,88 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+// Measures how long an async update takes to hand a frame to the writer of a
+// simulated keyboard that needs a few milliseconds per write, and checks the
+// keyboard never shows a frame that was only partly drawn.
+#include "bench.h"
+#include "wooting-platform.h"
+#include "wooting-rgb-sdk.h"
+#include "wooting-usb-sim.h"
+#include <stdio.h>
+
+#define ITERATIONS 20000
+#define WRITE_LATENCY_US 2000
+#define SAMPLE_EVERY 100
+
+// Number of keys that differ from the first one
+static uint32_t torn_keys(const WOOTING_USB_SIM_STATE *state) {
+  uint32_t torn = 0;
+  for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+    for (uint8_t column = 0; column < WOOTING_RGB_COLS; column++) {
+      torn += state->matrix[row][column] != state->matrix[0][0];
+    }
+  }
+  return torn;
+}
+
+int main(void) {
+  wooting_usb_set_transport(wooting_usb_sim_transport());
+  wooting_usb_sim_add_device(0x31E3, 0x1200, false, LAYOUT_ANSI);
+  wooting_usb_sim_set_latency(0, WRITE_LATENCY_US, 0);
+  if (!wooting_rgb_kbd_connected()) {
+    printf("Failed to connect to the simulated device\n");
+    return 1;
+  }
+  wooting_rgb_array_async_update(true);
+
+  uint8_t colours[WOOTING_RGB_ROWS * WOOTING_RGB_COLS * 3];
+  uint64_t total_us = 0, worst_us = 0;
+  uint32_t torn = 0;
+  for (int i = 0; i < ITERATIONS; i++) {
+    for (size_t k = 0; k < sizeof(colours); k++) {
+      colours[k] = (uint8_t)(i * 8);
+    }
+    wooting_rgb_array_set_full(colours);
+
+    uint64_t start = wooting_platform_time_us();
+    if (!wooting_rgb_array_update_keyboard()) {
+      printf("Update failed\n");
+      return 1;
+    }
+    uint64_t elapsed_us = wooting_platform_time_us() - start;
+    total_us += elapsed_us;
+    if (elapsed_us > worst_us) {
+      worst_us = elapsed_us;
+    }
+
+    if (i % SAMPLE_EVERY == 0) {
+      WOOTING_USB_SIM_STATE state;
+      wooting_usb_sim_get_state(0, &state);
+      torn += torn_keys(&state);
+    }
+  }
+
+  WOOTING_RGB_WRITE_STATS stats;
+  wooting_rgb_device_write_stats(0, &stats);
+  wooting_rgb_close();
+
+  if (torn) {
+    printf("The simulated device showed %u keys of torn frames\n", torn);
+    return 1;
+  }
+  printf("%12s %12s %12s %10s\n", "commit_ns", "worst_us", "write_us",
+         "replaced");
+  printf("%12.1f %12.1f %12u %10u\n", (double)total_us * 1000.0 / ITERATIONS,
+         (double)worst_us, WRITE_LATENCY_US, stats.frames_replaced);
+  // The worst case depends on the scheduler too much to compare between runs
+  bench_result("commit/commit_ns", (double)total_us * 1000.0 / ITERATIONS,
+               "ns", BENCH_LOWER);
+
+  wooting_usb_sim_remove_all();
+  wooting_usb_set_transport(NULL);
+  return 0;
+}
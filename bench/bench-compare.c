@@ -0,0 +1,193 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+// Compares two runs of the benchmarks, as written to WOOTING_BENCH_JSON (see
+// bench.h), and fails when a result got worse than the threshold allows:
+//
+//   ./bench-compare baseline.json bench-results.json [threshold_percent]
+//
+// Either file can hold several runs, e.g. from make bench BENCH_RUNS=5. Results
+// only one of them has are listed but don't fail the comparison.
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_THRESHOLD_PERCENT 10.0
+#define MAX_NAME 128
+#define MAX_LINE 512
+
+typedef struct BENCH_RESULT {
+  char name[MAX_NAME];
+  double value;
+  bool higher_is_better;
+} BENCH_RESULT;
+
+typedef struct BENCH_RUN {
+  BENCH_RESULT *results;
+  size_t count;
+  size_t capacity;
+} BENCH_RUN;
+
+// Value of a string field of a line bench.h wrote
+static bool string_field(const char *line, const char *key, char *value,
+                         size_t size) {
+  char pattern[32];
+  snprintf(pattern, sizeof(pattern), "\"%s\": \"", key);
+  const char *start = strstr(line, pattern);
+  if (!start) {
+    return false;
+  }
+  start += strlen(pattern);
+  const char *end = strchr(start, '"');
+  if (!end || (size_t)(end - start) >= size) {
+    return false;
+  }
+  memcpy(value, start, end - start);
+  value[end - start] = 0;
+  return true;
+}
+
+static bool number_field(const char *line, const char *key, double *value) {
+  char pattern[32];
+  snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+  const char *start = strstr(line, pattern);
+  if (!start) {
+    return false;
+  }
+  char *end;
+  *value = strtod(start + strlen(pattern), &end);
+  return end != start + strlen(pattern);
+}
+
+static BENCH_RESULT *find_result(const BENCH_RUN *run, const char *name) {
+  for (size_t i = 0; i < run->count; i++) {
+    if (strcmp(run->results[i].name, name) == 0) {
+      return &run->results[i];
+    }
+  }
+  return NULL;
+}
+
+static bool read_run(const char *path, BENCH_RUN *run) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    printf("Couldn't open %s\n", path);
+    return false;
+  }
+
+  char line[MAX_LINE];
+  unsigned line_number = 0;
+  while (fgets(line, sizeof(line), file)) {
+    line_number++;
+    if (line[strspn(line, " \t\r\n")] == 0) {
+      continue;
+    }
+
+    BENCH_RESULT result;
+    char better[16];
+    if (!string_field(line, "name", result.name, sizeof(result.name)) ||
+        !number_field(line, "value", &result.value) ||
+        !string_field(line, "better", better, sizeof(better))) {
+      printf("%s:%u isn't a benchmark result\n", path, line_number);
+      fclose(file);
+      return false;
+    }
+    result.higher_is_better = strcmp(better, "higher") == 0;
+
+    // Results of repeated runs count with their best one, which is the one
+    // least disturbed by whatever else the machine was doing
+    BENCH_RESULT *existing = find_result(run, result.name);
+    if (existing) {
+      if (result.higher_is_better ? result.value > existing->value
+                                  : result.value < existing->value) {
+        existing->value = result.value;
+      }
+      continue;
+    }
+    if (run->count == run->capacity) {
+      size_t capacity = run->capacity ? run->capacity * 2 : 64;
+      BENCH_RESULT *results = (BENCH_RESULT *)realloc(
+          run->results, capacity * sizeof(*results));
+      if (!results) {
+        printf("Out of memory\n");
+        fclose(file);
+        return false;
+      }
+      run->results = results;
+      run->capacity = capacity;
+    }
+    run->results[run->count++] = result;
+  }
+
+  fclose(file);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3 || argc > 4) {
+    printf("Usage: %s <baseline> <results> [threshold_percent]\n", argv[0]);
+    return 1;
+  }
+
+  double threshold = DEFAULT_THRESHOLD_PERCENT;
+  if (argc == 4) {
+    char *end;
+    threshold = strtod(argv[3], &end);
+    if (end == argv[3] || *end || threshold < 0) {
+      printf("The threshold has to be a percentage, not %s\n", argv[3]);
+      return 1;
+    }
+  }
+
+  BENCH_RUN baseline = {0}, current = {0};
+  if (!read_run(argv[1], &baseline) || !read_run(argv[2], &current)) {
+    return 1;
+  }
+
+  unsigned regressions = 0;
+  printf("%-44s %12s %12s %9s\n", "result", "baseline", "current", "change");
+  for (size_t i = 0; i < current.count; i++) {
+    const BENCH_RESULT *result = &current.results[i];
+    const BENCH_RESULT *base = find_result(&baseline, result->name);
+    if (!base) {
+      printf("%-44s %12s %12.1f %9s\n", result->name, "-", result->value,
+             "new");
+      continue;
+    }
+
+    double change;
+    if (base->value != 0) {
+      change = (result->value - base->value) / base->value * 100.0;
+    } else {
+      // Anything is infinitely more than nothing
+      change = result->value > 0 ? HUGE_VAL : result->value < 0 ? -HUGE_VAL : 0;
+    }
+    // Positive when the result got worse
+    double worse = result->higher_is_better ? -change : change;
+
+    bool regressed = worse > threshold;
+    regressions += regressed;
+    printf("%-44s %12.1f %12.1f %+8.1f%%%s\n", result->name, base->value,
+           result->value, change, regressed ? "  REGRESSED" : "");
+  }
+  for (size_t i = 0; i < baseline.count; i++) {
+    if (!find_result(&current, baseline.results[i].name)) {
+      printf("%-44s %12.1f %12s %9s\n", baseline.results[i].name,
+             baseline.results[i].value, "-", "missing");
+    }
+  }
+
+  free(baseline.results);
+  free(current.results);
+  if (regressions) {
+    printf("%u results got more than %.1f%% worse\n", regressions, threshold);
+    return 1;
+  }
+  return 0;
+}
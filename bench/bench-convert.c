@@ -0,0 +1,114 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+// Measures converting a full frame of app pixels to the colour array format
+// with the kernel picked for each format and instruction set this CPU can
+// run, and checks they all agree with the scalar one.
+#include "bench.h"
+#include "wooting-platform.h"
+#include "wooting-rgb-convert.h"
+#include <stdio.h>
+#include <string.h>
+
+#define ITERATIONS 100000
+
+static const char *format_names[] = {"rgb",  "bgr",       "rgba",
+                                     "bgra", "rgb_float", "rgba_float"};
+
+static const struct {
+  const char *name;
+  uint32_t features;
+} kernels[] = {{"scalar", 0},
+               {"sse2", WOOTING_CPU_SSE2},
+               {"avx2", WOOTING_CPU_SSE2 | WOOTING_CPU_AVX2},
+               {"neon", WOOTING_CPU_NEON}};
+
+#define KERNEL_COUNT (sizeof(kernels) / sizeof(kernels[0]))
+#define FORMAT_COUNT (sizeof(format_names) / sizeof(format_names[0]))
+
+static void fill_pixels(uint8_t *pixels, WOOTING_RGB_PIXEL_FORMAT format) {
+  size_t size = WOOTING_RGB_ROWS * WOOTING_RGB_COLS *
+                (size_t)wooting_rgb_pixel_size(format);
+
+  if (format == WOOTING_RGB_PIXEL_RGB_FLOAT ||
+      format == WOOTING_RGB_PIXEL_RGBA_FLOAT) {
+    for (size_t i = 0; i < size / sizeof(float); i++) {
+      float value = (float)(i % 37) / 36.0f;
+      memcpy(pixels + i * sizeof(float), &value, sizeof(value));
+    }
+  } else {
+    for (size_t i = 0; i < size; i++) {
+      pixels[i] = (uint8_t)(i * 29 + 3);
+    }
+  }
+}
+
+static void convert_frame(wooting_rgb_convert_kernel kernel,
+                          const uint8_t *pixels,
+                          WOOTING_RGB_PIXEL_FORMAT format,
+                          WOOTING_RGB_MATRIX matrix) {
+  size_t stride = WOOTING_RGB_COLS * (size_t)wooting_rgb_pixel_size(format);
+  for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+    kernel(pixels + row * stride, format, matrix[row], WOOTING_RGB_COLS);
+  }
+}
+
+int main(void) {
+  static uint8_t pixels[WOOTING_RGB_ROWS * WOOTING_RGB_COLS * 16];
+  uint32_t features = wooting_platform_cpu_features();
+
+  printf("%12s", "format");
+  for (size_t k = 0; k < KERNEL_COUNT; k++) {
+    if ((kernels[k].features & features) == kernels[k].features) {
+      printf(" %12s", kernels[k].name);
+    }
+  }
+  printf("\n");
+
+  for (size_t f = 0; f < FORMAT_COUNT; f++) {
+    WOOTING_RGB_PIXEL_FORMAT format = (WOOTING_RGB_PIXEL_FORMAT)f;
+    WOOTING_RGB_MATRIX expected;
+    fill_pixels(pixels, format);
+    convert_frame(wooting_rgb_convert_get_kernel(0, format), pixels, format,
+                  expected);
+
+    printf("%12s", format_names[f]);
+    for (size_t k = 0; k < KERNEL_COUNT; k++) {
+      if ((kernels[k].features & features) != kernels[k].features) {
+        continue;
+      }
+
+      wooting_rgb_convert_kernel kernel =
+          wooting_rgb_convert_get_kernel(kernels[k].features, format);
+      WOOTING_RGB_MATRIX matrix;
+      fill_pixels(pixels, format);
+      convert_frame(kernel, pixels, format, matrix);
+      if (memcmp(matrix, expected, sizeof(matrix)) != 0) {
+        printf("\nThe %s kernel doesn't match the scalar one\n",
+               kernels[k].name);
+        return 1;
+      }
+
+      uint64_t start = wooting_platform_time_us();
+      for (int i = 0; i < ITERATIONS; i++) {
+        pixels[0] = (uint8_t)i;
+        convert_frame(kernel, pixels, format, matrix);
+      }
+      double frame_ns =
+          (double)(wooting_platform_time_us() - start) * 1000.0 / ITERATIONS;
+      printf(" %9.1f ns", frame_ns);
+
+      char name[64];
+      snprintf(name, sizeof(name), "convert/%s/%s_ns", format_names[f],
+               kernels[k].name);
+      bench_result(name, frame_ns, "ns", BENCH_LOWER);
+    }
+    printf("\n");
+  }
+
+  return 0;
+}
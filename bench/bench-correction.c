@@ -0,0 +1,75 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+// Measures building a colour correction table, which happens once per change,
+// and running a full colour array through it, which happens for every frame
+// sent. The table is first checked to leave colours alone when it should.
+#include "bench.h"
+#include "wooting-platform.h"
+#include "wooting-rgb-correction.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BUILD_ITERATIONS 100
+#define APPLY_ITERATIONS 100000
+
+int main(void) {
+  uint32_t *table = malloc(sizeof(WOOTING_RGB_CORRECTION_TABLE));
+  if (!table) {
+    printf("Out of memory\n");
+    return 1;
+  }
+
+  WOOTING_RGB_CORRECTION correction = {.gamma = 0,
+                                       .brightness = 255,
+                                       .white_red = 255,
+                                       .white_green = 255,
+                                       .white_blue = 255};
+  WOOTING_RGB_MATRIX colours, corrected;
+  for (uint32_t i = 0; i < WOOTING_RGB_ROWS * WOOTING_RGB_COLS; i++) {
+    (&colours[0][0])[i] = (uint16_t)(i * 2654435761u >> 16);
+  }
+
+  wooting_rgb_correction_build(table, &correction, NULL);
+  wooting_rgb_correction_apply(table, colours, corrected);
+  for (uint32_t i = 0; i < WOOTING_RGB_ROWS * WOOTING_RGB_COLS; i++) {
+    if ((&colours[0][0])[i] != (&corrected[0][0])[i]) {
+      printf("The identity correction changed a colour\n");
+      return 1;
+    }
+  }
+
+  correction.gamma = 2.2f;
+  correction.brightness = 128;
+  correction.white_blue = 200;
+
+  uint64_t start = wooting_platform_time_us();
+  for (int i = 0; i < BUILD_ITERATIONS; i++) {
+    wooting_rgb_correction_build(table, &correction, NULL);
+  }
+  double build_us =
+      (double)(wooting_platform_time_us() - start) / BUILD_ITERATIONS;
+
+  volatile uint16_t sink = 0;
+  start = wooting_platform_time_us();
+  for (int i = 0; i < APPLY_ITERATIONS; i++) {
+    colours[0][0] = (uint16_t)i;
+    wooting_rgb_correction_apply(table, colours, corrected);
+    sink ^= corrected[i % WOOTING_RGB_ROWS][i % WOOTING_RGB_COLS];
+  }
+  double apply_ns =
+      (double)(wooting_platform_time_us() - start) * 1000.0 / APPLY_ITERATIONS;
+
+  printf("%12s %12s\n", "build_us", "apply_ns");
+  printf("%12.1f %12.1f\n", build_us, apply_ns);
+  bench_result("correction/build_us", build_us, "us", BENCH_LOWER);
+  bench_result("correction/apply_ns", apply_ns, "ns", BENCH_LOWER);
+
+  (void)sink;
+  free(table);
+  return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+// Measures rendering a full colour array of every built-in effect, and how
+// long the engine takes to get a started effect onto a simulated keyboard.
+#include "bench.h"
+#include "wooting-platform.h"
+#include "wooting-rgb-effects.h"
+#include "wooting-usb-sim.h"
+#include <stdio.h>
+
+#define ITERATIONS 100000
+#define START_TIMEOUT_US 1000000
+
+static const char *effect_names[] = {"wave", "breathing", "spectrum",
+                                     "ripple"};
+
+#define EFFECT_COUNT (sizeof(effect_names) / sizeof(effect_names[0]))
+
+int main(void) {
+  WOOTING_RGB_EFFECT_PARAMS params = {.red = 255,
+                                      .blue = 128,
+                                      .background_green = 32,
+                                      .period_ms = 1500,
+                                      .wavelength = 7,
+                                      .origin_row = 3,
+                                      .origin_column = 10};
+  volatile uint16_t sink = 0;
+
+  printf("%10s %12s\n", "effect", "render_ns");
+  for (size_t e = 0; e < EFFECT_COUNT; e++) {
+    WOOTING_RGB_EFFECT_STATE state;
+    WOOTING_RGB_MATRIX colours;
+    wooting_rgb_effect_prepare(&state, (WOOTING_RGB_EFFECT)e, &params);
+
+    uint64_t start = wooting_platform_time_us();
+    for (int i = 0; i < ITERATIONS; i++) {
+      wooting_rgb_effect_render(&state, (uint32_t)i * 7, colours);
+      sink ^= colours[i % WOOTING_RGB_ROWS][i % WOOTING_RGB_COLS];
+    }
+    double render_ns =
+        (double)(wooting_platform_time_us() - start) * 1000.0 / ITERATIONS;
+    printf("%10s %12.1f\n", effect_names[e], render_ns);
+
+    char name[64];
+    snprintf(name, sizeof(name), "effects/%s/render_ns", effect_names[e]);
+    bench_result(name, render_ns, "ns", BENCH_LOWER);
+  }
+
+  wooting_usb_set_transport(wooting_usb_sim_transport());
+  wooting_usb_sim_add_device(0x31E3, 0x1200, false, LAYOUT_ANSI);
+  wooting_usb_sim_set_latency(0, 0, 0);
+
+  uint64_t start = wooting_platform_time_us();
+  if (!wooting_rgb_effect_start(WOOTING_RGB_EFFECT_SPECTRUM, &params)) {
+    printf("Failed to start an effect on the simulated device\n");
+    return 1;
+  }
+
+  // The spectrum starts on red, which the first frame has to show
+  WOOTING_USB_SIM_STATE state;
+  while (wooting_usb_sim_get_state(0, &state) && state.matrix[0][0] != 0xF800 &&
+         wooting_platform_time_us() - start < START_TIMEOUT_US) {
+    wooting_platform_sleep_us(100);
+  }
+  uint64_t first_frame_us = wooting_platform_time_us() - start;
+  wooting_rgb_close();
+
+  if (state.matrix[0][0] != 0xF800) {
+    printf("The effect never reached the simulated device\n");
+    return 1;
+  }
+  printf("%10s %12.1f us\n", "start", (double)first_frame_us);
+  bench_result("effects/start_us", (double)first_frame_us, "us", BENCH_LOWER);
+
+  (void)sink;
+  wooting_usb_sim_remove_all();
+  wooting_usb_set_transport(NULL);
+  return 0;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+// Measures cold connect time against a simulated bus with a growing number of
+// non-Wooting devices. The per-PID column replays the filtered enumerate calls
+// the SDK used to make (one per PID and alternative PID) to show what the
+// single pass saves.
+#include "bench.h"
+#include "wooting-platform.h"
+#include "wooting-rgb-sdk.h"
+#include "wooting-usb-sim.h"
+#include <stdio.h>
+
+#define ITERATIONS 20
+#define SCAN_LATENCY_US 5
+
+static const uint16_t v1_pids[] = {0xFF01, 0xFF02};
+static const uint16_t v2_pids[] = {0x1100, 0x1200, 0x1210, 0x1220,
+                                   0x1230, 0x1300, 0x1310, 0x1320,
+                                   0x1500, 0x1510, 0x1400};
+
+static uint64_t per_pid_scan(void) {
+  const WOOTING_USB_TRANSPORT *sim = wooting_usb_sim_transport();
+  uint64_t start = wooting_platform_time_us();
+
+  for (size_t i = 0; i < sizeof(v1_pids) / sizeof(v1_pids[0]); i++) {
+    sim->free_enumeration(sim->enumerate(0x03EB, v1_pids[i]));
+  }
+  for (size_t i = 0; i < sizeof(v2_pids) / sizeof(v2_pids[0]); i++) {
+    for (uint16_t alt = 0; alt < 3; alt++) {
+      sim->free_enumeration(sim->enumerate(0x31E3, v2_pids[i] | alt));
+    }
+  }
+
+  return wooting_platform_time_us() - start;
+}
+
+int main(void) {
+  static const uint16_t bus_sizes[] = {0, 32, 128, 512};
+
+  wooting_usb_set_transport(wooting_usb_sim_transport());
+
+  printf("%8s %12s %12s %12s\n", "foreign", "scans", "connect_us",
+         "per_pid_us");
+  for (size_t b = 0; b < sizeof(bus_sizes) / sizeof(bus_sizes[0]); b++) {
+    wooting_usb_sim_remove_all();
+    wooting_usb_sim_add_device(0x31E3, 0x1220, false, LAYOUT_ANSI);
+    wooting_usb_sim_add_device(0x31E3, 0x1301, true, LAYOUT_ISO);
+    wooting_usb_sim_set_bus(bus_sizes[b], SCAN_LATENCY_US);
+
+    uint64_t connect_us = 0, per_pid_us = 0;
+    uint32_t scans = wooting_usb_sim_enumerate_count();
+    for (int i = 0; i < ITERATIONS; i++) {
+      uint64_t start = wooting_platform_time_us();
+      if (!wooting_rgb_kbd_connected() || wooting_usb_device_count() != 2) {
+        printf("Failed to connect to the simulated devices\n");
+        return 1;
+      }
+      connect_us += wooting_platform_time_us() - start;
+      wooting_usb_disconnect(false);
+    }
+    scans = wooting_usb_sim_enumerate_count() - scans;
+
+    for (int i = 0; i < ITERATIONS; i++) {
+      per_pid_us += per_pid_scan();
+    }
+
+    printf("%8u %12u %12llu %12llu\n", bus_sizes[b], scans / ITERATIONS,
+           (unsigned long long)(connect_us / ITERATIONS),
+           (unsigned long long)(per_pid_us / ITERATIONS));
+
+    char name[64];
+    snprintf(name, sizeof(name), "enumerate/foreign_%u/scans", bus_sizes[b]);
+    bench_result(name, scans / ITERATIONS, "count", BENCH_LOWER);
+    snprintf(name, sizeof(name), "enumerate/foreign_%u/connect_us",
+             bus_sizes[b]);
+    bench_result(name, (double)connect_us / ITERATIONS, "us", BENCH_LOWER);
+    snprintf(name, sizeof(name), "enumerate/foreign_%u/per_pid_us",
+             bus_sizes[b]);
+    bench_result(name, (double)per_pid_us / ITERATIONS, "us", BENCH_LOWER);
+  }
+
+  wooting_usb_sim_remove_all();
+  wooting_usb_set_transport(NULL);
+  return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+// Measures a whole app against a simulated keyboard, with updates done in the
+// calling thread and with async update: how many frames per second reach the
+// keyboard when the app updates as fast as it can, and how long it takes from
+// an update until the keyboard shows it.
+//
+// The write latencies of the keyboard can be given on the command line, e.g.
+// ./bench-frames 500 8000. The default ones go from a board on a fast port to
+// one that takes a couple of milliseconds per report.
+#include "bench.h"
+#include "wooting-platform.h"
+#include "wooting-rgb-sdk.h"
+#include "wooting-usb-sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_LATENCIES 16
+#define FPS_DURATION_US 500000
+#define LATENCY_SAMPLES 100
+// An update that didn't reach the keyboard by then is lost
+#define LATENCY_TIMEOUT_US 1000000
+
+static uint32_t device_frames(void) {
+  WOOTING_USB_SIM_STATE state;
+  wooting_usb_sim_get_state(0, &state);
+  return state.frames;
+}
+
+static void set_colours(int frame) {
+  uint8_t colours[WOOTING_RGB_ROWS * WOOTING_RGB_COLS * 3];
+  for (size_t k = 0; k < sizeof(colours); k++) {
+    colours[k] = (uint8_t)(frame * 3 + k);
+  }
+  wooting_rgb_array_set_full(colours);
+}
+
+static int compare_us(const void *a, const void *b) {
+  uint64_t left = *(const uint64_t *)a, right = *(const uint64_t *)b;
+  return (left > right) - (left < right);
+}
+
+// Frames per second the keyboard received while updating without a break
+static bool measure_fps(double *fps) {
+  uint32_t frames = device_frames();
+  uint64_t start = wooting_platform_time_us(), elapsed_us;
+  int i = 0;
+  do {
+    set_colours(i++);
+    if (!wooting_rgb_array_update_keyboard()) {
+      return false;
+    }
+    elapsed_us = wooting_platform_time_us() - start;
+  } while (elapsed_us < FPS_DURATION_US);
+
+  *fps = (double)(device_frames() - frames) * 1000000.0 / elapsed_us;
+  return true;
+}
+
+// Time from an update until the keyboard received its frame, the keyboard is
+// idle before every update
+static bool measure_latency(uint32_t write_latency_us, double *mean_us,
+                            double *p95_us) {
+  static uint64_t samples[LATENCY_SAMPLES];
+  uint64_t total_us = 0;
+  // An async writer can still have a frame being written and one waiting
+  wooting_platform_sleep_us(2 * (uint64_t)write_latency_us + 10000);
+  for (int i = 0; i < LATENCY_SAMPLES; i++) {
+    set_colours(i);
+    uint32_t frames = device_frames();
+    uint64_t start = wooting_platform_time_us();
+    if (!wooting_rgb_array_update_keyboard()) {
+      return false;
+    }
+    while (device_frames() == frames) {
+      if (wooting_platform_time_us() - start > LATENCY_TIMEOUT_US) {
+        return false;
+      }
+    }
+    samples[i] = wooting_platform_time_us() - start;
+    total_us += samples[i];
+  }
+
+  qsort(samples, LATENCY_SAMPLES, sizeof(samples[0]), compare_us);
+  *mean_us = (double)total_us / LATENCY_SAMPLES;
+  *p95_us = (double)samples[LATENCY_SAMPLES * 95 / 100];
+  return true;
+}
+
+int main(int argc, char **argv) {
+  static const char *modes[] = {"sync", "async"};
+  uint32_t latencies[MAX_LATENCIES] = {0, 1000, 4000};
+  int latency_count = 3;
+  if (argc > 1) {
+    latency_count = 0;
+    for (int i = 1; i < argc && latency_count < MAX_LATENCIES; i++) {
+      latencies[latency_count++] = (uint32_t)strtoul(argv[i], NULL, 10);
+    }
+  }
+
+  wooting_usb_set_transport(wooting_usb_sim_transport());
+
+  printf("%9s %6s %10s %12s %12s\n", "write_us", "mode", "fps", "latency_us",
+         "p95_us");
+  for (int l = 0; l < latency_count; l++) {
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+      wooting_usb_sim_remove_all();
+      wooting_usb_sim_add_device(0x31E3, 0x1200, false, LAYOUT_ANSI);
+      wooting_usb_sim_set_latency(0, latencies[l], 0);
+      if (!wooting_rgb_kbd_connected()) {
+        printf("Failed to connect to the simulated device\n");
+        return 1;
+      }
+      wooting_rgb_array_async_update(m == 1);
+
+      double fps, mean_us, p95_us;
+      if (!measure_fps(&fps) ||
+          !measure_latency(latencies[l], &mean_us, &p95_us)) {
+        printf("Frames didn't reach the simulated device\n");
+        return 1;
+      }
+      wooting_rgb_array_async_update(false);
+      wooting_rgb_close();
+
+      printf("%9u %6s %10.1f %12.1f %12.1f\n", latencies[l], modes[m], fps,
+             mean_us, p95_us);
+
+      char name[64];
+      snprintf(name, sizeof(name), "frames/write_%uus/%s/fps", latencies[l],
+               modes[m]);
+      bench_result(name, fps, "fps", BENCH_HIGHER);
+      snprintf(name, sizeof(name), "frames/write_%uus/%s/latency_us",
+               latencies[l], modes[m]);
+      bench_result(name, mean_us, "us", BENCH_LOWER);
+      snprintf(name, sizeof(name), "frames/write_%uus/%s/p95_us", latencies[l],
+               modes[m]);
+      bench_result(name, p95_us, "us", BENCH_LOWER);
+    }
+  }
+
+  wooting_usb_sim_remove_all();
+  wooting_usb_set_transport(NULL);
+  return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+// Measures scaling screen sized BGRA frames down to the key grid with every
+// kernel this CPU can run. The core column is the share of one core a 144 Hz
+// capture would take. A small image, for which
+// every line is read, is first checked against a plain box filter.
+#include "bench.h"
+#include "wooting-platform.h"
+#include "wooting-rgb-convert.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ITERATIONS 200
+#define CAPTURE_HZ 144
+
+static const struct {
+  const char *name;
+  uint32_t features;
+} kernels[] = {{"scalar", 0},
+               {"sse2", WOOTING_CPU_SSE2},
+               {"avx2", WOOTING_CPU_SSE2 | WOOTING_CPU_AVX2},
+               {"neon", WOOTING_CPU_NEON}};
+
+static const struct {
+  const char *name;
+  uint32_t width;
+  uint32_t height;
+} images[] = {{"1080p", 1920, 1080}, {"4k", 3840, 2160}};
+
+#define KERNEL_COUNT (sizeof(kernels) / sizeof(kernels[0]))
+#define IMAGE_COUNT (sizeof(images) / sizeof(images[0]))
+
+static void fill_image(uint8_t *pixels, size_t size) {
+  uint32_t state = 12345;
+  for (size_t i = 0; i < size; i++) {
+    state = state * 1103515245 + 12345;
+    pixels[i] = (uint8_t)(state >> 16);
+  }
+}
+
+// Averages every pixel of each key's part of a BGRA image
+static void box_filter(const uint8_t *pixels, uint32_t width, uint32_t height,
+                       WOOTING_RGB_MATRIX colours) {
+  for (uint32_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+    for (uint32_t column = 0; column < WOOTING_RGB_COLS; column++) {
+      uint32_t sums[3] = {0, 0, 0}, count = 0;
+      for (uint32_t y = row * height / WOOTING_RGB_ROWS;
+           y < (row + 1) * height / WOOTING_RGB_ROWS; y++) {
+        for (uint32_t x = column * width / WOOTING_RGB_COLS;
+             x < (column + 1) * width / WOOTING_RGB_COLS; x++) {
+          const uint8_t *pixel = pixels + (y * width + x) * 4;
+          sums[0] += pixel[2];
+          sums[1] += pixel[1];
+          sums[2] += pixel[0];
+          count++;
+        }
+      }
+
+      uint8_t red = (uint8_t)((sums[0] + count / 2) / count);
+      uint8_t green = (uint8_t)((sums[1] + count / 2) / count);
+      uint8_t blue = (uint8_t)((sums[2] + count / 2) / count);
+      colours[row][column] =
+          (uint16_t)((red & 0xf8) << 8 | (green & 0xfc) << 3 | blue >> 3);
+    }
+  }
+}
+
+int main(void) {
+  uint32_t features = wooting_platform_cpu_features();
+
+  // 10x10 pixels per key, fewer lines than the sampling limit
+  static uint8_t small[WOOTING_RGB_COLS * 10 * WOOTING_RGB_ROWS * 10 * 4];
+  WOOTING_RGB_MATRIX expected;
+  fill_image(small, sizeof(small));
+  box_filter(small, WOOTING_RGB_COLS * 10, WOOTING_RGB_ROWS * 10, expected);
+
+  for (size_t k = 0; k < KERNEL_COUNT; k++) {
+    if ((kernels[k].features & features) != kernels[k].features) {
+      continue;
+    }
+
+    WOOTING_RGB_MATRIX colours;
+    wooting_rgb_downscale(small, WOOTING_RGB_PIXEL_BGRA, WOOTING_RGB_COLS * 10,
+                          WOOTING_RGB_ROWS * 10, WOOTING_RGB_COLS * 40,
+                          WOOTING_RGB_ROWS, WOOTING_RGB_COLS, colours,
+                          kernels[k].features);
+    if (memcmp(colours, expected, sizeof(colours)) != 0) {
+      printf("The %s kernel doesn't match the box filter\n", kernels[k].name);
+      return 1;
+    }
+  }
+
+  printf("%6s %8s %12s %8s\n", "image", "kernel", "frame_us", "core");
+  for (size_t i = 0; i < IMAGE_COUNT; i++) {
+    size_t stride = (size_t)images[i].width * 4;
+    uint8_t *pixels = malloc(stride * images[i].height);
+    if (!pixels) {
+      printf("Out of memory\n");
+      return 1;
+    }
+    fill_image(pixels, stride * images[i].height);
+
+    for (size_t k = 0; k < KERNEL_COUNT; k++) {
+      if ((kernels[k].features & features) != kernels[k].features) {
+        continue;
+      }
+
+      WOOTING_RGB_MATRIX colours;
+      uint64_t start = wooting_platform_time_us();
+      for (int n = 0; n < ITERATIONS; n++) {
+        wooting_rgb_downscale(pixels, WOOTING_RGB_PIXEL_BGRA, images[i].width,
+                              images[i].height, stride, WOOTING_RGB_ROWS,
+                              WOOTING_RGB_COLS, colours, kernels[k].features);
+      }
+      double frame_us =
+          (double)(wooting_platform_time_us() - start) / ITERATIONS;
+      printf("%6s %8s %12.1f %7.1f%%\n", images[i].name, kernels[k].name,
+             frame_us, frame_us * CAPTURE_HZ / 10000.0);
+
+      char name[64];
+      snprintf(name, sizeof(name), "image/%s/%s/frame_us", images[i].name,
+               kernels[k].name);
+      bench_result(name, frame_us, "us", BENCH_LOWER);
+    }
+    free(pixels);
+  }
+
+  return 0;
+}
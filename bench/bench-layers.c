@@ -0,0 +1,127 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+// Measures composing a full stack of layers onto a colour array, against
+// updates where a single key of one layer or of the colour array changed.
+// Random edits composed one at a time are first checked against composing the
+// same layers from scratch.
+#include "bench.h"
+#include "wooting-platform.h"
+#include "wooting-rgb-layers.h"
+#include <stdio.h>
+#include <string.h>
+
+#define ITERATIONS 100000
+#define CHECK_EDITS 2000
+
+static uint32_t random_state = 12345;
+
+static uint32_t next_random(void) {
+  random_state = random_state * 1103515245 + 12345;
+  return random_state >> 8;
+}
+
+static void all_dirty(uint32_t dirty[WOOTING_RGB_ROWS]) {
+  for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+    dirty[row] = (1u << WOOTING_RGB_COLS) - 1;
+  }
+}
+
+static void fill_stack(WOOTING_RGB_LAYER_STACK *stack) {
+  wooting_rgb_layers_init(stack);
+  for (uint8_t layer = 0; layer < WOOTING_RGB_LAYERS; layer++) {
+    stack->layers[layer].mode = (WOOTING_RGB_BLEND_MODE)(layer % 3);
+    for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+      for (uint8_t column = 0; column < WOOTING_RGB_COLS; column++) {
+        wooting_rgb_layers_set_key(stack, layer, row, column,
+                                   (uint16_t)next_random(),
+                                   (uint8_t)next_random());
+      }
+    }
+  }
+}
+
+static double time_updates(WOOTING_RGB_LAYER_STACK *stack,
+                           WOOTING_RGB_MATRIX base, int layer) {
+  uint32_t dirty[WOOTING_RGB_ROWS];
+  uint64_t start = wooting_platform_time_us();
+  for (int i = 0; i < ITERATIONS; i++) {
+    uint8_t row = (uint8_t)(i % WOOTING_RGB_ROWS);
+    uint8_t column = (uint8_t)(i % WOOTING_RGB_COLS);
+    memset(dirty, 0, sizeof(dirty));
+    if (layer < 0) {
+      all_dirty(dirty);
+    } else if (layer == WOOTING_RGB_LAYERS) {
+      base[row][column] = (uint16_t)i;
+      dirty[row] = 1u << column;
+    } else {
+      wooting_rgb_layers_set_key(stack, (uint8_t)layer, row, column,
+                                 (uint16_t)i, 200);
+    }
+    wooting_rgb_layers_compose(stack, base, dirty);
+  }
+  return (double)(wooting_platform_time_us() - start) * 1000.0 / ITERATIONS;
+}
+
+static void print_result(const char *change, double compose_ns) {
+  printf("%12s %12.1f\n", change, compose_ns);
+
+  char name[64];
+  snprintf(name, sizeof(name), "layers/%s/compose_ns", change);
+  bench_result(name, compose_ns, "ns", BENCH_LOWER);
+}
+
+int main(void) {
+  static WOOTING_RGB_LAYER_STACK stack, reference;
+  WOOTING_RGB_MATRIX base;
+  uint32_t dirty[WOOTING_RGB_ROWS];
+
+  for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+    for (uint8_t column = 0; column < WOOTING_RGB_COLS; column++) {
+      base[row][column] = (uint16_t)next_random();
+    }
+  }
+  fill_stack(&stack);
+  all_dirty(dirty);
+  wooting_rgb_layers_compose(&stack, base, dirty);
+
+  for (int i = 0; i < CHECK_EDITS; i++) {
+    uint8_t row = (uint8_t)(next_random() % WOOTING_RGB_ROWS);
+    uint8_t column = (uint8_t)(next_random() % WOOTING_RGB_COLS);
+    memset(dirty, 0, sizeof(dirty));
+    if (i % 5 == 0) {
+      base[row][column] = (uint16_t)next_random();
+      dirty[row] = 1u << column;
+    } else if (i % 97 == 0) {
+      uint8_t layer = (uint8_t)(next_random() % WOOTING_RGB_LAYERS);
+      stack.layers[layer].visible = !stack.layers[layer].visible;
+      wooting_rgb_layers_touch(&stack, layer);
+    } else {
+      wooting_rgb_layers_set_key(
+          &stack, (uint8_t)(next_random() % WOOTING_RGB_LAYERS), row, column,
+          (uint16_t)next_random(), (uint8_t)next_random());
+    }
+    wooting_rgb_layers_compose(&stack, base, dirty);
+  }
+
+  memcpy(reference.layers, stack.layers, sizeof(reference.layers));
+  reference.used = WOOTING_RGB_LAYERS;
+  all_dirty(dirty);
+  wooting_rgb_layers_compose(&reference, base, dirty);
+  if (memcmp(stack.output.matrix, reference.output.matrix,
+             sizeof(stack.output.matrix)) != 0) {
+    printf("Composing changed keys doesn't match composing everything\n");
+    return 1;
+  }
+
+  printf("%12s %12s\n", "change", "compose_ns");
+  print_result("everything", time_updates(&stack, base, -1));
+  print_result("array_key", time_updates(&stack, base, WOOTING_RGB_LAYERS));
+  print_result("bottom_key", time_updates(&stack, base, 0));
+  print_result("top_key", time_updates(&stack, base, WOOTING_RGB_LAYERS - 1));
+  return 0;
+}
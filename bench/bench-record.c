@@ -0,0 +1,110 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+// Measures recording frames where a few keys or every key changes, how big
+// they end up in the file, and how fast a recording is read back. The frames
+// read back are checked against the ones recorded.
+#include "bench.h"
+#include "wooting-platform.h"
+#include "wooting-rgb-record.h"
+#include <stdio.h>
+#include <string.h>
+
+#define FRAMES 100000
+// Simulated time between frames, a 1000 Hz app
+#define FRAME_INTERVAL_US 1000
+#define RECORDING_PATH "bench-record.bin"
+
+static void make_frame(WOOTING_RGB_MATRIX frame, int n, bool all_keys) {
+  if (all_keys) {
+    for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+      for (uint8_t column = 0; column < WOOTING_RGB_COLS; column++) {
+        frame[row][column] = (uint16_t)(n * 31 + row * 7 + column);
+      }
+    }
+  } else {
+    frame[n % WOOTING_RGB_ROWS][n % WOOTING_RGB_COLS] = (uint16_t)n;
+  }
+}
+
+int main(void) {
+  static const struct {
+    const char *name;
+    bool all_keys;
+  } cases[] = {{"one_key", false}, {"all_keys", true}};
+
+  printf("%10s %12s %14s %12s\n", "case", "record_ns", "bytes_frame",
+         "replay_ns");
+  for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+    WOOTING_RECORDER recorder;
+    WOOTING_RGB_MATRIX frame;
+    memset(frame, 0, sizeof(frame));
+    if (!wooting_recorder_open(&recorder, RECORDING_PATH, 0)) {
+      printf("Couldn't create %s\n", RECORDING_PATH);
+      return 1;
+    }
+
+    uint64_t start = wooting_platform_time_us();
+    for (int n = 0; n < FRAMES; n++) {
+      make_frame(frame, n, cases[c].all_keys);
+      // Opening a recording already applies what happened at time 0
+      wooting_recorder_frame(&recorder, (uint64_t)(n + 1) * FRAME_INTERVAL_US,
+                             0, (const uint16_t(*)[WOOTING_RGB_COLS])frame);
+    }
+    uint64_t size = recorder.offset;
+    if (!wooting_recorder_close(&recorder)) {
+      printf("Writing %s failed\n", RECORDING_PATH);
+      return 1;
+    }
+    double record_ns =
+        (double)(wooting_platform_time_us() - start) * 1000.0 / FRAMES;
+
+    WOOTING_PLAYER player;
+    WOOTING_RECORD_EVENT event;
+    WOOTING_RGB_MATRIX expected;
+    memset(expected, 0, sizeof(expected));
+    if (!wooting_player_open(&player, RECORDING_PATH)) {
+      printf("Couldn't open %s\n", RECORDING_PATH);
+      return 1;
+    }
+
+    int frames = 0;
+    start = wooting_platform_time_us();
+    while (wooting_player_next(&player, &event)) {
+      if (event.type != WOOTING_RECORD_FRAME_KEYS &&
+          event.type != WOOTING_RECORD_FRAME_MASKED) {
+        continue;
+      }
+      make_frame(expected, frames++, cases[c].all_keys);
+      if (memcmp(player.frames[0], expected, sizeof(expected)) != 0) {
+        printf("Frame %d doesn't match what was recorded\n", frames - 1);
+        return 1;
+      }
+    }
+    double replay_ns =
+        (double)(wooting_platform_time_us() - start) * 1000.0 / FRAMES;
+    wooting_player_close(&player);
+
+    if (frames != FRAMES) {
+      printf("Read back %d of %d frames\n", frames, FRAMES);
+      return 1;
+    }
+    printf("%10s %12.1f %14.1f %12.1f\n", cases[c].name, record_ns,
+           (double)size / FRAMES, replay_ns);
+
+    char name[64];
+    snprintf(name, sizeof(name), "record/%s/record_ns", cases[c].name);
+    bench_result(name, record_ns, "ns", BENCH_LOWER);
+    snprintf(name, sizeof(name), "record/%s/bytes_frame", cases[c].name);
+    bench_result(name, (double)size / FRAMES, "bytes", BENCH_LOWER);
+    snprintf(name, sizeof(name), "record/%s/replay_ns", cases[c].name);
+    bench_result(name, replay_ns, "ns", BENCH_LOWER);
+  }
+
+  remove(RECORDING_PATH);
+  return 0;
+}
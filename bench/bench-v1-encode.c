@@ -0,0 +1,145 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+// Measures the CPU side of a v1 frame: encoding the colour array into the LED
+// driver buffers and checksumming the reports. The bitwise column replays the
+// CRC the SDK used to run over every report, the update column is a full
+// frame through the simulated transport with no write latency.
+#include "bench.h"
+#include "wooting-platform.h"
+#include "wooting-rgb-sdk.h"
+#include "wooting-usb-sim.h"
+#include <stdio.h>
+
+#define ITERATIONS 100000
+#define UPDATE_ITERATIONS 2000
+#define V1_REPORT_CRC_SIZE 127
+
+// Not part of the public header, only kept for backwards compatibility
+bool wooting_rgb_build_v1_buffers();
+
+static uint16_t bitwise_crc16ccitt(const uint8_t *buffer, uint16_t size) {
+  uint16_t crc = 0;
+
+  while (size--) {
+    crc ^= (*buffer++ << 8);
+
+    for (uint8_t i = 0; i < 8; ++i) {
+      if (crc & 0x8000) {
+        crc = (crc << 1) ^ 0x1021;
+      } else {
+        crc = crc << 1;
+      }
+    }
+  }
+
+  return crc;
+}
+
+static void fill_colours(int frame) {
+  for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+    for (uint8_t column = 0; column < WOOTING_RGB_COLS; column++) {
+      wooting_rgb_array_set_single(row, column, (uint8_t)(frame + column * 12),
+                                   (uint8_t)(frame * 3 + row * 40),
+                                   (uint8_t)(column * row));
+    }
+  }
+}
+
+static double per_op_ns(uint64_t elapsed_us, int iterations) {
+  return (double)elapsed_us * 1000.0 / iterations;
+}
+
+int main(void) {
+  static const uint16_t pids[] = {0xFF01, 0xFF02};
+  static const char *names[] = {"one", "two"};
+  uint8_t report[V1_REPORT_CRC_SIZE];
+  volatile uint16_t sink = 0;
+
+  for (size_t i = 0; i < sizeof(report); i++) {
+    report[i] = (uint8_t)(i * 31 + 7);
+  }
+  if (bitwise_crc16ccitt(report, sizeof(report)) !=
+      wooting_usb_crc16ccitt(report, sizeof(report))) {
+    printf("CRC doesn't match the bitwise reference\n");
+    return 1;
+  }
+
+  uint64_t start = wooting_platform_time_us();
+  for (int i = 0; i < ITERATIONS; i++) {
+    report[0] = (uint8_t)i;
+    sink ^= bitwise_crc16ccitt(report, sizeof(report));
+  }
+  uint64_t bitwise_us = wooting_platform_time_us() - start;
+
+  start = wooting_platform_time_us();
+  for (int i = 0; i < ITERATIONS; i++) {
+    report[0] = (uint8_t)i;
+    sink ^= wooting_usb_crc16ccitt(report, sizeof(report));
+  }
+  uint64_t table_us = wooting_platform_time_us() - start;
+
+  printf("%8s %14s %14s\n", "crc", "bitwise_ns", "table_ns");
+  printf("%8s %14.1f %14.1f\n", "report", per_op_ns(bitwise_us, ITERATIONS),
+         per_op_ns(table_us, ITERATIONS));
+  bench_result("v1-encode/crc/bitwise_ns", per_op_ns(bitwise_us, ITERATIONS),
+               "ns", BENCH_LOWER);
+  bench_result("v1-encode/crc/table_ns", per_op_ns(table_us, ITERATIONS),
+               "ns", BENCH_LOWER);
+
+  wooting_usb_set_transport(wooting_usb_sim_transport());
+
+  printf("%8s %14s %14s\n", "model", "encode_ns", "update_ns");
+  for (size_t m = 0; m < sizeof(pids) / sizeof(pids[0]); m++) {
+    wooting_usb_sim_remove_all();
+    wooting_usb_sim_add_device(0x03EB, pids[m], false, LAYOUT_ANSI);
+    wooting_usb_sim_set_latency(0, 0, 0);
+    if (!wooting_rgb_kbd_connected()) {
+      printf("Failed to connect to the simulated device\n");
+      return 1;
+    }
+
+    fill_colours(0);
+    start = wooting_platform_time_us();
+    for (int i = 0; i < ITERATIONS; i++) {
+      wooting_rgb_build_v1_buffers();
+    }
+    uint64_t encode_us = wooting_platform_time_us() - start;
+
+    start = wooting_platform_time_us();
+    for (int i = 0; i < UPDATE_ITERATIONS; i++) {
+      fill_colours(i + 1);
+      if (!wooting_rgb_array_update_keyboard()) {
+        printf("Failed to update the simulated device\n");
+        return 1;
+      }
+    }
+    uint64_t update_us = wooting_platform_time_us() - start;
+
+    WOOTING_USB_SIM_STATE state;
+    if (!wooting_usb_sim_get_state(0, &state) || state.bad_reports) {
+      printf("The simulated device rejected reports\n");
+      return 1;
+    }
+
+    printf("%8s %14.1f %14.1f\n", names[m], per_op_ns(encode_us, ITERATIONS),
+           per_op_ns(update_us, UPDATE_ITERATIONS));
+
+    char name[64];
+    snprintf(name, sizeof(name), "v1-encode/%s/encode_ns", names[m]);
+    bench_result(name, per_op_ns(encode_us, ITERATIONS), "ns", BENCH_LOWER);
+    snprintf(name, sizeof(name), "v1-encode/%s/update_ns", names[m]);
+    bench_result(name, per_op_ns(update_us, UPDATE_ITERATIONS), "ns",
+                 BENCH_LOWER);
+    wooting_usb_disconnect(false);
+  }
+
+  (void)sink;
+  wooting_usb_sim_remove_all();
+  wooting_usb_set_transport(NULL);
+  return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+// Measures the CPU side of a v2 frame: putting the colour array into a report,
+// sending it with wooting_usb_send_buffer_v2, which splits it into 64 byte
+// packets for keyboards that need them, and a full update through the SDK.
+// Every send goes to a simulated keyboard with no write latency, which has to
+// end up showing the colours sent.
+#include "bench.h"
+#include "wooting-platform.h"
+#include "wooting-rgb-sdk.h"
+#include "wooting-usb-sim.h"
+#include <stdio.h>
+#include <string.h>
+
+#define ITERATIONS 100000
+#define SEND_ITERATIONS 20000
+
+static void fill_matrix(WOOTING_RGB_MATRIX matrix, int frame) {
+  for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+    for (uint8_t column = 0; column < WOOTING_RGB_COLS; column++) {
+      matrix[row][column] = (uint16_t)(frame * 131 + row * 29 + column);
+    }
+  }
+}
+
+static double per_op_ns(uint64_t elapsed_us, int iterations) {
+  return (double)elapsed_us * 1000.0 / iterations;
+}
+
+int main(void) {
+  static const struct {
+    const char *name;
+    uint16_t product_id;
+    bool small_packets;
+  } models[] = {{"full", 0x1200, false}, {"small", 0x1301, true}};
+  WOOTING_RGB_MATRIX matrix;
+  WOOTING_USB_V2_REPORT report;
+  volatile uint16_t sink = 0;
+
+  fill_matrix(matrix, 0);
+  uint64_t start = wooting_platform_time_us();
+  for (int i = 0; i < ITERATIONS; i++) {
+    matrix[0][0] = (uint16_t)i;
+    wooting_usb_v2_report_init(&report);
+    memcpy(report.matrix, matrix, sizeof(report.matrix));
+    sink ^= report.matrix[i % WOOTING_RGB_ROWS][i % WOOTING_RGB_COLS];
+  }
+  double assemble_ns =
+      per_op_ns(wooting_platform_time_us() - start, ITERATIONS);
+  printf("%8s %14s\n", "report", "assemble_ns");
+  printf("%8s %14.1f\n", "v2", assemble_ns);
+  bench_result("v2-report/assemble_ns", assemble_ns, "ns", BENCH_LOWER);
+
+  wooting_usb_set_transport(wooting_usb_sim_transport());
+
+  printf("%8s %14s %14s\n", "model", "send_ns", "update_ns");
+  for (size_t m = 0; m < sizeof(models) / sizeof(models[0]); m++) {
+    wooting_usb_sim_remove_all();
+    wooting_usb_sim_add_device(0x31E3, models[m].product_id,
+                               models[m].small_packets, LAYOUT_ANSI);
+    wooting_usb_sim_set_latency(0, 0, 0);
+    if (!wooting_rgb_kbd_connected()) {
+      printf("Failed to connect to the simulated device\n");
+      return 1;
+    }
+
+    start = wooting_platform_time_us();
+    for (int i = 0; i < SEND_ITERATIONS; i++) {
+      fill_matrix(matrix, i);
+      if (!wooting_usb_send_buffer_v2(matrix)) {
+        printf("Failed to send to the simulated device\n");
+        return 1;
+      }
+    }
+    uint64_t send_us = wooting_platform_time_us() - start;
+
+    WOOTING_USB_SIM_STATE state;
+    if (!wooting_usb_sim_get_state(0, &state) || state.bad_reports ||
+        memcmp(state.matrix, matrix, sizeof(matrix)) != 0) {
+      printf("The simulated device doesn't show what was sent\n");
+      return 1;
+    }
+
+    uint8_t colours[WOOTING_RGB_ROWS * WOOTING_RGB_COLS * 3];
+    start = wooting_platform_time_us();
+    for (int i = 0; i < SEND_ITERATIONS; i++) {
+      for (size_t k = 0; k < sizeof(colours); k++) {
+        colours[k] = (uint8_t)(i + k);
+      }
+      wooting_rgb_array_set_full(colours);
+      if (!wooting_rgb_array_update_keyboard()) {
+        printf("Failed to update the simulated device\n");
+        return 1;
+      }
+    }
+    uint64_t update_us = wooting_platform_time_us() - start;
+
+    printf("%8s %14.1f %14.1f\n", models[m].name,
+           per_op_ns(send_us, SEND_ITERATIONS),
+           per_op_ns(update_us, SEND_ITERATIONS));
+
+    char name[64];
+    snprintf(name, sizeof(name), "v2-report/%s/send_ns", models[m].name);
+    bench_result(name, per_op_ns(send_us, SEND_ITERATIONS), "ns", BENCH_LOWER);
+    snprintf(name, sizeof(name), "v2-report/%s/update_ns", models[m].name);
+    bench_result(name, per_op_ns(update_us, SEND_ITERATIONS), "ns",
+                 BENCH_LOWER);
+    wooting_usb_disconnect(false);
+  }
+
+  (void)sink;
+  wooting_usb_sim_remove_all();
+  wooting_usb_set_transport(NULL);
+  return 0;
+}
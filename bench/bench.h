@@ -0,0 +1,42 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Results the benchmarks print are also reported with bench_result. When the
+// WOOTING_BENCH_JSON environment variable names a file, every result is
+// appended to it as one JSON object per line:
+//
+//   {"name": "v1-encode/crc/table_ns", "value": 414.8, "unit": "ns",
+//    "better": "lower"}
+//
+// bench-compare reads two of those files and fails when a result got worse
+// by more than a threshold.
+
+typedef enum BENCH_BETTER { BENCH_LOWER, BENCH_HIGHER } BENCH_BETTER;
+
+// Names are made of letters, digits and "/_-." so they need no escaping
+static void bench_result(const char *name, double value, const char *unit,
+                         BENCH_BETTER better) {
+  const char *path = getenv("WOOTING_BENCH_JSON");
+  if (!path || !*path) {
+    return;
+  }
+
+  FILE *file = fopen(path, "a");
+  if (!file) {
+    return;
+  }
+  fprintf(file,
+          "{\"name\": \"%s\", \"value\": %.3f, \"unit\": \"%s\", "
+          "\"better\": \"%s\"}\n",
+          name, value, unit, better == BENCH_HIGHER ? "higher" : "lower");
+  fclose(file);
+}
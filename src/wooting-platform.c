@@ -0,0 +1,388 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "wooting-platform.h"
+#include "wooting-trace.h"
+
+#include "stdlib.h"
+#include "string.h"
+
+#include "stdio.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+uint64_t wooting_platform_time_us(void) {
+#ifdef _WIN32
+  static LARGE_INTEGER frequency = {0};
+  LARGE_INTEGER counter;
+  if (frequency.QuadPart == 0)
+    QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000 +
+         (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000 /
+             frequency.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+#endif
+}
+
+void wooting_platform_sleep_us(uint64_t microseconds) {
+  if (microseconds == 0)
+    return;
+#ifdef _WIN32
+  // Sleep only has millisecond granularity, round up so we never sleep short
+  Sleep((DWORD)((microseconds + 999) / 1000));
+#else
+  struct timespec ts;
+  ts.tv_sec = (time_t)(microseconds / 1000000);
+  ts.tv_nsec = (long)(microseconds % 1000000) * 1000;
+  while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+  }
+#endif
+}
+
+typedef struct WOOTING_THREAD_START {
+  wooting_thread_func func;
+  void *arg;
+} WOOTING_THREAD_START;
+
+#ifdef _WIN32
+static DWORD WINAPI wooting_thread_entry(LPVOID param) {
+#else
+static void *wooting_thread_entry(void *param) {
+#endif
+  // Copy the start info out so it can be freed before running the thread body
+  WOOTING_THREAD_START start = *(WOOTING_THREAD_START *)param;
+  free(param);
+  start.func(start.arg);
+  // Some SDK threads only live for a connect, a close or until async update
+  // or an effect is turned off. Their trace ring is handed on to the next
+  // thread rather than piling up over an app's reconnects
+  wooting_trace_thread_exit();
+  return 0;
+}
+
+bool wooting_thread_create(wooting_thread *thread, wooting_thread_func func,
+                           void *arg) {
+  WOOTING_THREAD_START *start =
+      (WOOTING_THREAD_START *)malloc(sizeof(WOOTING_THREAD_START));
+  if (!start)
+    return false;
+  start->func = func;
+  start->arg = arg;
+
+#ifdef _WIN32
+  *thread = CreateThread(NULL, 0, wooting_thread_entry, start, 0, NULL);
+  if (*thread == NULL) {
+#else
+  if (pthread_create(thread, NULL, wooting_thread_entry, start) != 0) {
+#endif
+    free(start);
+    return false;
+  }
+
+  return true;
+}
+
+void wooting_thread_join(wooting_thread thread) {
+#ifdef _WIN32
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+#else
+  pthread_join(thread, NULL);
+#endif
+}
+
+void wooting_mutex_init(wooting_mutex *mutex) {
+#ifdef _WIN32
+  InitializeSRWLock(mutex);
+#else
+  pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+void wooting_mutex_destroy(wooting_mutex *mutex) {
+#ifdef _WIN32
+  // SRW locks don't hold any resources
+  (void)mutex;
+#else
+  pthread_mutex_destroy(mutex);
+#endif
+}
+
+void wooting_mutex_lock(wooting_mutex *mutex) {
+#ifdef _WIN32
+  AcquireSRWLockExclusive(mutex);
+#else
+  pthread_mutex_lock(mutex);
+#endif
+}
+
+void wooting_mutex_unlock(wooting_mutex *mutex) {
+#ifdef _WIN32
+  ReleaseSRWLockExclusive(mutex);
+#else
+  pthread_mutex_unlock(mutex);
+#endif
+}
+
+void wooting_cond_init(wooting_cond *cond) {
+#ifdef _WIN32
+  InitializeConditionVariable(cond);
+#else
+  pthread_cond_init(cond, NULL);
+#endif
+}
+
+void wooting_cond_destroy(wooting_cond *cond) {
+#ifdef _WIN32
+  (void)cond;
+#else
+  pthread_cond_destroy(cond);
+#endif
+}
+
+void wooting_cond_wait(wooting_cond *cond, wooting_mutex *mutex) {
+#ifdef _WIN32
+  SleepConditionVariableSRW(cond, mutex, INFINITE, 0);
+#else
+  pthread_cond_wait(cond, mutex);
+#endif
+}
+
+void wooting_cond_signal(wooting_cond *cond) {
+#ifdef _WIN32
+  WakeConditionVariable(cond);
+#else
+  pthread_cond_signal(cond);
+#endif
+}
+
+void wooting_cond_broadcast(wooting_cond *cond) {
+#ifdef _WIN32
+  WakeAllConditionVariable(cond);
+#else
+  pthread_cond_broadcast(cond);
+#endif
+}
+
+int32_t wooting_atomic_load(wooting_atomic *value) {
+#ifdef _WIN32
+  return InterlockedCompareExchange(value, 0, 0);
+#else
+  return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+void wooting_atomic_store(wooting_atomic *value, int32_t new_value) {
+#ifdef _WIN32
+  InterlockedExchange(value, new_value);
+#else
+  __atomic_store_n(value, new_value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+int32_t wooting_atomic_exchange(wooting_atomic *value, int32_t new_value) {
+#ifdef _WIN32
+  return InterlockedExchange(value, new_value);
+#else
+  return __atomic_exchange_n(value, new_value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+int32_t wooting_atomic_add(wooting_atomic *value, int32_t delta) {
+#ifdef _WIN32
+  return InterlockedExchangeAdd(value, delta) + delta;
+#else
+  return __atomic_add_fetch(value, delta, __ATOMIC_SEQ_CST);
+#endif
+}
+
+int32_t wooting_atomic_max(wooting_atomic *value, int32_t candidate) {
+  int32_t current = wooting_atomic_load(value);
+  while (current < candidate) {
+#ifdef _WIN32
+    LONG previous = InterlockedCompareExchange(value, candidate, current);
+    if (previous == current)
+      return candidate;
+    current = previous;
+#else
+    if (__atomic_compare_exchange_n(value, &current, candidate, false,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+      return candidate;
+#endif
+  }
+  return current;
+}
+
+int64_t wooting_atomic64_load(wooting_atomic64 *value) {
+#ifdef _WIN32
+  return InterlockedCompareExchange64(value, 0, 0);
+#else
+  return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+int64_t wooting_atomic64_add(wooting_atomic64 *value, int64_t delta) {
+#ifdef _WIN32
+  return InterlockedExchangeAdd64(value, delta) + delta;
+#else
+  return __atomic_add_fetch(value, delta, __ATOMIC_SEQ_CST);
+#endif
+}
+
+bool wooting_platform_replace_file(const char *path, const void *data,
+                                   size_t len) {
+  // The process id keeps processes writing at the same time from sharing a
+  // temporary file
+  char temp_path[1024];
+#ifdef _WIN32
+  unsigned long process_id = GetCurrentProcessId();
+#else
+  unsigned long process_id = (unsigned long)getpid();
+#endif
+  if (snprintf(temp_path, sizeof(temp_path), "%s.%lu.tmp", path, process_id) >=
+      (int)sizeof(temp_path))
+    return false;
+
+  FILE *file = fopen(temp_path, "wb");
+  if (!file)
+    return false;
+  bool written = fwrite(data, 1, len, file) == len;
+  written = fclose(file) == 0 && written;
+
+#ifdef _WIN32
+  written = written && MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING);
+#else
+  written = written && rename(temp_path, path) == 0;
+#endif
+  if (!written)
+    remove(temp_path);
+  return written;
+}
+
+bool wooting_platform_map_file(const char *path, wooting_mapped_file *file) {
+  memset(file, 0, sizeof(*file));
+#ifdef _WIN32
+  file->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                           OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (file->file == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file->file, &size) || size.QuadPart == 0) {
+    CloseHandle(file->file);
+    return false;
+  }
+
+  file->mapping =
+      CreateFileMappingA(file->file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (!file->mapping) {
+    CloseHandle(file->file);
+    return false;
+  }
+
+  file->data = (const uint8_t *)MapViewOfFile(file->mapping, FILE_MAP_READ,
+                                              0, 0, 0);
+  if (!file->data) {
+    CloseHandle(file->mapping);
+    CloseHandle(file->file);
+    return false;
+  }
+  file->size = (uint64_t)size.QuadPart;
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat info;
+  // Files that don't fit the address space can't be mapped in one go
+  if (fstat(fd, &info) != 0 || info.st_size <= 0 ||
+      (uint64_t)info.st_size > SIZE_MAX) {
+    close(fd);
+    return false;
+  }
+
+  void *data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping keeps the file open
+  close(fd);
+  if (data == MAP_FAILED)
+    return false;
+
+  madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+  file->data = (const uint8_t *)data;
+  file->size = (uint64_t)info.st_size;
+#endif
+  return true;
+}
+
+void wooting_platform_unmap_file(wooting_mapped_file *file) {
+  if (!file->data)
+    return;
+
+#ifdef _WIN32
+  UnmapViewOfFile(file->data);
+  CloseHandle(file->mapping);
+  CloseHandle(file->file);
+#else
+  munmap((void *)file->data, (size_t)file->size);
+#endif
+  memset(file, 0, sizeof(*file));
+}
+
+static uint32_t platform_detect_cpu_features(void) {
+  uint32_t features = 0;
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) ||            \
+    defined(_M_IX86)
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 1);
+  if (info[3] & (1 << 26))
+    features |= WOOTING_CPU_SSE2;
+  // AVX2 also needs the OS to save the upper halves of the YMM registers
+  bool os_avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) &&
+                (_xgetbv(0) & 6) == 6;
+  __cpuidex(info, 7, 0);
+  if (os_avx && (info[1] & (1 << 5)))
+    features |= WOOTING_CPU_AVX2;
+#else
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    features |= WOOTING_CPU_SSE2;
+  if (__builtin_cpu_supports("avx2"))
+    features |= WOOTING_CPU_AVX2;
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+  // NEON is part of the base instruction set on 64 bit ARM
+  features |= WOOTING_CPU_NEON;
+#endif
+  return features;
+}
+
+uint32_t wooting_platform_cpu_features(void) {
+  // Threads racing to detect the CPU all come to the same answer
+  static wooting_atomic cpu_features = -1;
+  int32_t features = wooting_atomic_load(&cpu_features);
+  if (features < 0) {
+    features = (int32_t)platform_detect_cpu_features();
+    wooting_atomic_store(&cpu_features, features);
+  }
+  return (uint32_t)features;
+}
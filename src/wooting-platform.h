@@ -0,0 +1,115 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdbool.h"
+#include "stddef.h"
+#include "stdint.h"
+
+#ifdef _WIN32
+#include <windows.h>
+typedef HANDLE wooting_thread;
+typedef SRWLOCK wooting_mutex;
+typedef CONDITION_VARIABLE wooting_cond;
+typedef volatile LONG wooting_atomic;
+typedef volatile LONG64 wooting_atomic64;
+#else
+#include <pthread.h>
+typedef pthread_t wooting_thread;
+typedef pthread_mutex_t wooting_mutex;
+typedef pthread_cond_t wooting_cond;
+typedef int32_t wooting_atomic;
+typedef int64_t wooting_atomic64;
+#endif
+
+// Storage class for variables that every thread has its own copy of
+#ifdef _MSC_VER
+#define WOOTING_THREAD_LOCAL __declspec(thread)
+#else
+#define WOOTING_THREAD_LOCAL __thread
+#endif
+
+typedef void (*wooting_thread_func)(void *arg);
+
+/// @brief Monotonic clock in microseconds, only useful for measuring intervals
+uint64_t wooting_platform_time_us(void);
+
+/// @brief Sleeps the calling thread for roughly the given amount of time
+void wooting_platform_sleep_us(uint64_t microseconds);
+
+/// @brief Starts a new thread running func(arg)
+/// @return false if the thread couldn't be created
+bool wooting_thread_create(wooting_thread *thread, wooting_thread_func func,
+                           void *arg);
+/// @brief Waits for a thread to finish and releases it
+void wooting_thread_join(wooting_thread thread);
+
+void wooting_mutex_init(wooting_mutex *mutex);
+void wooting_mutex_destroy(wooting_mutex *mutex);
+void wooting_mutex_lock(wooting_mutex *mutex);
+void wooting_mutex_unlock(wooting_mutex *mutex);
+
+void wooting_cond_init(wooting_cond *cond);
+void wooting_cond_destroy(wooting_cond *cond);
+/// @brief Atomically releases the mutex and waits for the condition to be
+/// signalled, the mutex is held again when this returns
+void wooting_cond_wait(wooting_cond *cond, wooting_mutex *mutex);
+void wooting_cond_signal(wooting_cond *cond);
+void wooting_cond_broadcast(wooting_cond *cond);
+
+/// @brief Sequentially consistent operations on a 32 bit integer shared
+/// between threads. wooting_atomic_add returns the new value,
+/// wooting_atomic_exchange the one it replaced
+int32_t wooting_atomic_load(wooting_atomic *value);
+void wooting_atomic_store(wooting_atomic *value, int32_t new_value);
+int32_t wooting_atomic_exchange(wooting_atomic *value, int32_t new_value);
+int32_t wooting_atomic_add(wooting_atomic *value, int32_t delta);
+/// @brief Raises value to candidate if it's lower, returns the new value
+int32_t wooting_atomic_max(wooting_atomic *value, int32_t candidate);
+int64_t wooting_atomic64_load(wooting_atomic64 *value);
+int64_t wooting_atomic64_add(wooting_atomic64 *value, int64_t delta);
+
+/// @brief Replaces the contents of a file in one go. The data is written to a
+/// temporary file next to it first, so a reader in another process sees either
+/// the old or the new contents, never half of it
+/// @return false if the file couldn't be written
+bool wooting_platform_replace_file(const char *path, const void *data,
+                                   size_t len);
+
+/// A file mapped into memory read-only, see wooting_platform_map_file
+typedef struct wooting_mapped_file {
+  const uint8_t *data;
+  uint64_t size;
+#ifdef _WIN32
+  HANDLE file;
+  HANDLE mapping;
+#endif
+} wooting_mapped_file;
+
+/// @brief Maps a whole file into memory read-only. Pages are only read from
+/// disk once they're touched, so files larger than memory can be mapped
+/// @return false if the file couldn't be opened or mapped, or is empty
+bool wooting_platform_map_file(const char *path, wooting_mapped_file *file);
+void wooting_platform_unmap_file(wooting_mapped_file *file);
+
+// SIMD instruction sets reported by wooting_platform_cpu_features
+#define WOOTING_CPU_SSE2 (1u << 0)
+#define WOOTING_CPU_AVX2 (1u << 1)
+#define WOOTING_CPU_NEON (1u << 2)
+
+/// @brief Returns the SIMD instruction sets the CPU and OS support, as a mask
+/// of WOOTING_CPU_* flags. Detected on the first call
+uint32_t wooting_platform_cpu_features(void);
+
+#ifdef __cplusplus
+}
+#endif
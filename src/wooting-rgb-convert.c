@@ -0,0 +1,469 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "wooting-rgb-convert.h"
+#include "string.h"
+#include "wooting-platform.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) ||            \
+    defined(_M_IX86)
+#define CONVERT_X86
+#include <immintrin.h>
+// GCC and clang only allow intrinsics of instruction sets the function is
+// compiled for, MSVC allows them anywhere
+#if defined(_MSC_VER) && !defined(__clang__)
+#define TARGET_SSE2
+#define TARGET_AVX2
+#else
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define CONVERT_NEON
+#include <arm_neon.h>
+#endif
+
+uint8_t wooting_rgb_pixel_size(WOOTING_RGB_PIXEL_FORMAT format) {
+  switch (format) {
+  case WOOTING_RGB_PIXEL_RGB:
+  case WOOTING_RGB_PIXEL_BGR:
+    return 3;
+  case WOOTING_RGB_PIXEL_RGBA:
+  case WOOTING_RGB_PIXEL_BGRA:
+    return 4;
+  case WOOTING_RGB_PIXEL_RGB_FLOAT:
+    return 3 * sizeof(float);
+  case WOOTING_RGB_PIXEL_RGBA_FLOAT:
+    return 4 * sizeof(float);
+  default:
+    return 0;
+  }
+}
+
+static inline uint16_t encode_565(uint8_t red, uint8_t green, uint8_t blue) {
+  return (uint16_t)((red & 0xf8) << 8 | (green & 0xfc) << 3 | blue >> 3);
+}
+
+// Rows can have any stride, so floats aren't necessarily aligned
+static inline uint8_t float_channel(const uint8_t *channel) {
+  float value;
+  memcpy(&value, channel, sizeof(value));
+
+  // Written so NaN ends up as 0
+  if (!(value > 0.0f)) {
+    return 0;
+  }
+  if (value >= 1.0f) {
+    return 255;
+  }
+  return (uint8_t)(value * 255.0f + 0.5f);
+}
+
+static bool is_bgr(WOOTING_RGB_PIXEL_FORMAT format) {
+  return format == WOOTING_RGB_PIXEL_BGR || format == WOOTING_RGB_PIXEL_BGRA;
+}
+
+static void convert_row_scalar(const uint8_t *pixels,
+                               WOOTING_RGB_PIXEL_FORMAT format,
+                               uint16_t *colours, uint8_t count) {
+  uint8_t size = wooting_rgb_pixel_size(format);
+
+  switch (format) {
+  case WOOTING_RGB_PIXEL_RGB:
+  case WOOTING_RGB_PIXEL_RGBA:
+    for (uint8_t i = 0; i < count; i++, pixels += size) {
+      colours[i] = encode_565(pixels[0], pixels[1], pixels[2]);
+    }
+    break;
+  case WOOTING_RGB_PIXEL_BGR:
+  case WOOTING_RGB_PIXEL_BGRA:
+    for (uint8_t i = 0; i < count; i++, pixels += size) {
+      colours[i] = encode_565(pixels[2], pixels[1], pixels[0]);
+    }
+    break;
+  case WOOTING_RGB_PIXEL_RGB_FLOAT:
+  case WOOTING_RGB_PIXEL_RGBA_FLOAT:
+    for (uint8_t i = 0; i < count; i++, pixels += size) {
+      colours[i] = encode_565(float_channel(pixels),
+                              float_channel(pixels + sizeof(float)),
+                              float_channel(pixels + 2 * sizeof(float)));
+    }
+    break;
+  }
+}
+
+static void sum_row_scalar(const uint8_t *pixels,
+                           WOOTING_RGB_PIXEL_FORMAT format, uint32_t count,
+                           uint32_t sums[3]) {
+  uint8_t size = wooting_rgb_pixel_size(format);
+  uint32_t first = 0, second = 0, third = 0;
+
+  if (format == WOOTING_RGB_PIXEL_RGB_FLOAT ||
+      format == WOOTING_RGB_PIXEL_RGBA_FLOAT) {
+    for (uint32_t i = 0; i < count; i++, pixels += size) {
+      first += float_channel(pixels);
+      second += float_channel(pixels + sizeof(float));
+      third += float_channel(pixels + 2 * sizeof(float));
+    }
+  } else {
+    for (uint32_t i = 0; i < count; i++, pixels += size) {
+      first += pixels[0];
+      second += pixels[1];
+      third += pixels[2];
+    }
+  }
+
+  sums[0] += first;
+  sums[1] += second;
+  sums[2] += third;
+}
+
+#ifdef CONVERT_X86
+// Each 32 bit lane holds a pixel with its first channel in the low byte and
+// the third channel in byte 2, the result is the RGB565 colour in the low half
+TARGET_SSE2 static inline __m128i encode_565_sse2(__m128i pixels, bool bgr) {
+  __m128i first = _mm_and_si128(pixels, _mm_set1_epi32(0xf8));
+  __m128i green = _mm_srli_epi32(_mm_and_si128(pixels, _mm_set1_epi32(0xfc00)),
+                                 5);
+  __m128i third =
+      _mm_and_si128(_mm_srli_epi32(pixels, 16), _mm_set1_epi32(0xf8));
+  __m128i red = bgr ? third : first;
+  __m128i blue = bgr ? first : third;
+  return _mm_or_si128(_mm_or_si128(_mm_slli_epi32(red, 8), green),
+                      _mm_srli_epi32(blue, 3));
+}
+
+// SSE2 can only narrow with signed saturation, so the colours are sign
+// extended first to come through unchanged
+TARGET_SSE2 static inline __m128i narrow_sse2(__m128i low, __m128i high) {
+  return _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(low, 16), 16),
+                         _mm_srai_epi32(_mm_slli_epi32(high, 16), 16));
+}
+
+// Only the four byte formats, SSE2 has no byte shuffle to spread out three
+// byte pixels
+TARGET_SSE2 static void convert_row_sse2(const uint8_t *pixels,
+                                         WOOTING_RGB_PIXEL_FORMAT format,
+                                         uint16_t *colours, uint8_t count) {
+  uint8_t i = 0;
+  if (format == WOOTING_RGB_PIXEL_RGBA || format == WOOTING_RGB_PIXEL_BGRA) {
+    bool bgr = is_bgr(format);
+    for (; i + 8 <= count; i += 8) {
+      __m128i low = _mm_loadu_si128((const __m128i *)(pixels + i * 4));
+      __m128i high = _mm_loadu_si128((const __m128i *)(pixels + i * 4 + 16));
+      _mm_storeu_si128((__m128i *)(colours + i),
+                       narrow_sse2(encode_565_sse2(low, bgr),
+                                   encode_565_sse2(high, bgr)));
+    }
+  }
+
+  convert_row_scalar(pixels + i * wooting_rgb_pixel_size(format), format,
+                     colours + i, count - i);
+}
+
+TARGET_AVX2 static inline __m256i encode_565_avx2(__m256i pixels, bool bgr) {
+  __m256i first = _mm256_and_si256(pixels, _mm256_set1_epi32(0xf8));
+  __m256i green = _mm256_srli_epi32(
+      _mm256_and_si256(pixels, _mm256_set1_epi32(0xfc00)), 5);
+  __m256i third =
+      _mm256_and_si256(_mm256_srli_epi32(pixels, 16), _mm256_set1_epi32(0xf8));
+  __m256i red = bgr ? third : first;
+  __m256i blue = bgr ? first : third;
+  return _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(red, 8), green),
+                         _mm256_srli_epi32(blue, 3));
+}
+
+TARGET_AVX2 static void convert_row_avx2(const uint8_t *pixels,
+                                         WOOTING_RGB_PIXEL_FORMAT format,
+                                         uint16_t *colours, uint8_t count) {
+  bool bgr = is_bgr(format);
+  uint8_t i = 0;
+
+  if (format == WOOTING_RGB_PIXEL_RGBA || format == WOOTING_RGB_PIXEL_BGRA) {
+    for (; i + 16 <= count; i += 16) {
+      __m256i low = _mm256_loadu_si256((const __m256i *)(pixels + i * 4));
+      __m256i high =
+          _mm256_loadu_si256((const __m256i *)(pixels + i * 4 + 32));
+      // Narrowing works per 128 bit lane, which leaves the quarters in the
+      // order low 0-3, high 0-3, low 4-7, high 4-7
+      __m256i narrowed = _mm256_packus_epi32(encode_565_avx2(low, bgr),
+                                             encode_565_avx2(high, bgr));
+      _mm256_storeu_si256((__m256i *)(colours + i),
+                          _mm256_permute4x64_epi64(narrowed, 0xd8));
+    }
+  } else if (format == WOOTING_RGB_PIXEL_RGB ||
+             format == WOOTING_RGB_PIXEL_BGR) {
+    // Spreads the four pixels in the first 12 bytes of a lane over 32 bits each
+    const __m256i spread = _mm256_setr_epi8(
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1, 0, 1, 2, -1, 3,
+        4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    // Every load reads 4 bytes more than the pixels it uses, the loop stops
+    // early enough not to read past the end of the row
+    for (; i + 10 <= count; i += 8) {
+      __m128i low = _mm_loadu_si128((const __m128i *)(pixels + i * 3));
+      __m128i high = _mm_loadu_si128((const __m128i *)(pixels + i * 3 + 12));
+      __m256i packed =
+          _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+      __m256i encoded =
+          encode_565_avx2(_mm256_shuffle_epi8(packed, spread), bgr);
+      __m256i narrowed =
+          _mm256_permute4x64_epi64(_mm256_packus_epi32(encoded, encoded), 0x08);
+      _mm_storeu_si128((__m128i *)(colours + i),
+                       _mm256_castsi256_si128(narrowed));
+    }
+  }
+
+  convert_row_scalar(pixels + i * wooting_rgb_pixel_size(format), format,
+                     colours + i, count - i);
+}
+TARGET_SSE2 static uint32_t add_lanes_sse2(__m128i lanes) {
+  uint32_t values[4];
+  _mm_storeu_si128((__m128i *)values, lanes);
+  return values[0] + values[1] + values[2] + values[3];
+}
+
+// Four byte formats only, the others go to the scalar kernel
+TARGET_SSE2 static void sum_row_sse2(const uint8_t *pixels,
+                                     WOOTING_RGB_PIXEL_FORMAT format,
+                                     uint32_t count, uint32_t sums[3]) {
+  uint32_t i = 0;
+  if (format == WOOTING_RGB_PIXEL_RGBA || format == WOOTING_RGB_PIXEL_BGRA) {
+    const __m128i mask = _mm_set1_epi32(0xff);
+    __m128i first = _mm_setzero_si128();
+    __m128i second = _mm_setzero_si128();
+    __m128i third = _mm_setzero_si128();
+    for (; i + 4 <= count; i += 4) {
+      __m128i quad = _mm_loadu_si128((const __m128i *)(pixels + i * 4));
+      first = _mm_add_epi32(first, _mm_and_si128(quad, mask));
+      second =
+          _mm_add_epi32(second, _mm_and_si128(_mm_srli_epi32(quad, 8), mask));
+      third =
+          _mm_add_epi32(third, _mm_and_si128(_mm_srli_epi32(quad, 16), mask));
+    }
+    sums[0] += add_lanes_sse2(first);
+    sums[1] += add_lanes_sse2(second);
+    sums[2] += add_lanes_sse2(third);
+  }
+
+  sum_row_scalar(pixels + i * wooting_rgb_pixel_size(format), format,
+                 count - i, sums);
+}
+
+TARGET_AVX2 static uint32_t add_lanes_avx2(__m256i lanes) {
+  __m128i half = _mm_add_epi32(_mm256_castsi256_si128(lanes),
+                               _mm256_extracti128_si256(lanes, 1));
+  half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4e));
+  half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xb1));
+  return (uint32_t)_mm_cvtsi128_si32(half);
+}
+
+TARGET_AVX2 static void sum_row_avx2(const uint8_t *pixels,
+                                     WOOTING_RGB_PIXEL_FORMAT format,
+                                     uint32_t count, uint32_t sums[3]) {
+  uint32_t i = 0;
+  if (format == WOOTING_RGB_PIXEL_RGBA || format == WOOTING_RGB_PIXEL_BGRA) {
+    const __m256i mask = _mm256_set1_epi32(0xff);
+    __m256i first = _mm256_setzero_si256();
+    __m256i second = _mm256_setzero_si256();
+    __m256i third = _mm256_setzero_si256();
+    for (; i + 8 <= count; i += 8) {
+      __m256i octet = _mm256_loadu_si256((const __m256i *)(pixels + i * 4));
+      first = _mm256_add_epi32(first, _mm256_and_si256(octet, mask));
+      second = _mm256_add_epi32(
+          second, _mm256_and_si256(_mm256_srli_epi32(octet, 8), mask));
+      third = _mm256_add_epi32(
+          third, _mm256_and_si256(_mm256_srli_epi32(octet, 16), mask));
+    }
+    sums[0] += add_lanes_avx2(first);
+    sums[1] += add_lanes_avx2(second);
+    sums[2] += add_lanes_avx2(third);
+  }
+
+  sum_row_scalar(pixels + i * wooting_rgb_pixel_size(format), format,
+                 count - i, sums);
+}
+#endif
+
+#ifdef CONVERT_NEON
+static inline uint16x8_t encode_565_neon(uint8x8_t red, uint8x8_t green,
+                                         uint8x8_t blue) {
+  uint16x8_t colour = vshll_n_u8(vand_u8(red, vdup_n_u8(0xf8)), 8);
+  colour = vorrq_u16(colour, vshll_n_u8(vand_u8(green, vdup_n_u8(0xfc)), 3));
+  return vorrq_u16(colour, vmovl_u8(vshr_n_u8(blue, 3)));
+}
+
+static void convert_row_neon(const uint8_t *pixels,
+                             WOOTING_RGB_PIXEL_FORMAT format,
+                             uint16_t *colours, uint8_t count) {
+  bool bgr = is_bgr(format);
+  uint8_t i = 0;
+
+  // The structured loads split the channels up as they load
+  if (format == WOOTING_RGB_PIXEL_RGB || format == WOOTING_RGB_PIXEL_BGR) {
+    for (; i + 8 <= count; i += 8) {
+      uint8x8x3_t channels = vld3_u8(pixels + i * 3);
+      vst1q_u16(colours + i,
+                encode_565_neon(channels.val[bgr ? 2 : 0], channels.val[1],
+                                channels.val[bgr ? 0 : 2]));
+    }
+  } else if (format == WOOTING_RGB_PIXEL_RGBA ||
+             format == WOOTING_RGB_PIXEL_BGRA) {
+    for (; i + 8 <= count; i += 8) {
+      uint8x8x4_t channels = vld4_u8(pixels + i * 4);
+      vst1q_u16(colours + i,
+                encode_565_neon(channels.val[bgr ? 2 : 0], channels.val[1],
+                                channels.val[bgr ? 0 : 2]));
+    }
+  }
+
+  convert_row_scalar(pixels + i * wooting_rgb_pixel_size(format), format,
+                     colours + i, count - i);
+}
+// The 16 bit pairwise sums of a 16 pixel block can't overflow, they're widened
+// into the 32 bit totals after every block
+static void sum_row_neon(const uint8_t *pixels, WOOTING_RGB_PIXEL_FORMAT format,
+                         uint32_t count, uint32_t sums[3]) {
+  uint32x4_t first = vdupq_n_u32(0);
+  uint32x4_t second = vdupq_n_u32(0);
+  uint32x4_t third = vdupq_n_u32(0);
+  uint32_t i = 0;
+
+  if (format == WOOTING_RGB_PIXEL_RGB || format == WOOTING_RGB_PIXEL_BGR) {
+    for (; i + 16 <= count; i += 16) {
+      uint8x16x3_t channels = vld3q_u8(pixels + i * 3);
+      first = vpadalq_u16(first, vpaddlq_u8(channels.val[0]));
+      second = vpadalq_u16(second, vpaddlq_u8(channels.val[1]));
+      third = vpadalq_u16(third, vpaddlq_u8(channels.val[2]));
+    }
+  } else if (format == WOOTING_RGB_PIXEL_RGBA ||
+             format == WOOTING_RGB_PIXEL_BGRA) {
+    for (; i + 16 <= count; i += 16) {
+      uint8x16x4_t channels = vld4q_u8(pixels + i * 4);
+      first = vpadalq_u16(first, vpaddlq_u8(channels.val[0]));
+      second = vpadalq_u16(second, vpaddlq_u8(channels.val[1]));
+      third = vpadalq_u16(third, vpaddlq_u8(channels.val[2]));
+    }
+  }
+
+  sums[0] += vaddvq_u32(first);
+  sums[1] += vaddvq_u32(second);
+  sums[2] += vaddvq_u32(third);
+  sum_row_scalar(pixels + i * wooting_rgb_pixel_size(format), format,
+                 count - i, sums);
+}
+#endif
+
+wooting_rgb_convert_kernel
+wooting_rgb_convert_get_kernel(uint32_t features,
+                               WOOTING_RGB_PIXEL_FORMAT format) {
+  // A SIMD kernel that doesn't cover the format only adds its format checks
+  // in front of the scalar loop
+  bool four_bytes =
+      format == WOOTING_RGB_PIXEL_RGBA || format == WOOTING_RGB_PIXEL_BGRA;
+  bool bytes = four_bytes || format == WOOTING_RGB_PIXEL_RGB ||
+               format == WOOTING_RGB_PIXEL_BGR;
+#ifdef CONVERT_X86
+  if (bytes && (features & WOOTING_CPU_AVX2)) {
+    return convert_row_avx2;
+  }
+  if (four_bytes && (features & WOOTING_CPU_SSE2)) {
+    return convert_row_sse2;
+  }
+#endif
+#ifdef CONVERT_NEON
+  if (bytes && (features & WOOTING_CPU_NEON)) {
+    return convert_row_neon;
+  }
+#endif
+  (void)features;
+  (void)four_bytes;
+  (void)bytes;
+  return convert_row_scalar;
+}
+
+void wooting_rgb_convert_row(const uint8_t *pixels,
+                             WOOTING_RGB_PIXEL_FORMAT format,
+                             uint16_t *colours, uint8_t count) {
+  wooting_rgb_convert_get_kernel(wooting_platform_cpu_features(), format)(
+      pixels, format, colours, count);
+}
+
+wooting_rgb_sum_kernel wooting_rgb_sum_get_kernel(uint32_t features) {
+#ifdef CONVERT_X86
+  if (features & WOOTING_CPU_AVX2) {
+    return sum_row_avx2;
+  }
+  if (features & WOOTING_CPU_SSE2) {
+    return sum_row_sse2;
+  }
+#endif
+#ifdef CONVERT_NEON
+  if (features & WOOTING_CPU_NEON) {
+    return sum_row_neon;
+  }
+#endif
+  (void)features;
+  return sum_row_scalar;
+}
+
+void wooting_rgb_downscale(const uint8_t *pixels,
+                           WOOTING_RGB_PIXEL_FORMAT format, uint32_t width,
+                           uint32_t height, size_t stride, uint8_t rows,
+                           uint8_t columns, WOOTING_RGB_MATRIX colours,
+                           uint32_t features) {
+  if (rows > WOOTING_RGB_ROWS) {
+    rows = WOOTING_RGB_ROWS;
+  }
+  if (columns > WOOTING_RGB_COLS) {
+    columns = WOOTING_RGB_COLS;
+  }
+
+  uint8_t size = wooting_rgb_pixel_size(format);
+  bool bgr = is_bgr(format);
+  wooting_rgb_sum_kernel sum = wooting_rgb_sum_get_kernel(features);
+
+  // Image columns covered by each key column, from start up to end
+  uint32_t column_start[WOOTING_RGB_COLS];
+  uint32_t column_end[WOOTING_RGB_COLS];
+  for (uint8_t column = 0; column < columns; column++) {
+    uint32_t start = (uint32_t)((uint64_t)column * width / columns);
+    uint32_t end = (uint32_t)((uint64_t)(column + 1) * width / columns);
+    column_start[column] = start;
+    column_end[column] = end > start ? end : start + 1;
+  }
+
+  for (uint8_t row = 0; row < rows; row++) {
+    // Every key gets at least one line and column, also for tiny images
+    uint32_t start = (uint32_t)((uint64_t)row * height / rows);
+    uint32_t end = (uint32_t)((uint64_t)(row + 1) * height / rows);
+    if (end <= start) {
+      end = start + 1;
+    }
+    uint32_t step = (end - start + WOOTING_RGB_DOWNSCALE_SAMPLES - 1) /
+                    WOOTING_RGB_DOWNSCALE_SAMPLES;
+
+    uint32_t sums[WOOTING_RGB_COLS][3];
+    memset(sums, 0, sizeof(sums));
+    uint32_t lines = 0;
+    for (uint32_t y = start; y < end; y += step, lines++) {
+      const uint8_t *line = pixels + y * stride;
+      for (uint8_t column = 0; column < columns; column++) {
+        sum(line + column_start[column] * size, format,
+            column_end[column] - column_start[column], sums[column]);
+      }
+    }
+
+    for (uint8_t column = 0; column < columns; column++) {
+      uint32_t samples = lines * (column_end[column] - column_start[column]);
+      uint8_t first = (uint8_t)((sums[column][0] + samples / 2) / samples);
+      uint8_t second = (uint8_t)((sums[column][1] + samples / 2) / samples);
+      uint8_t third = (uint8_t)((sums[column][2] + samples / 2) / samples);
+      colours[row][column] = bgr ? encode_565(third, second, first)
+                                 : encode_565(first, second, third);
+    }
+  }
+}
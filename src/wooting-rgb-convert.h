@@ -0,0 +1,67 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "wooting-rgb-sdk.h"
+
+// Conversion of app pixel formats to the RGB565 colours of the colour array.
+// Every format has a scalar kernel, SIMD kernels cover the byte formats on the
+// instruction sets they were written for and leave the rest to the scalar one.
+
+typedef void (*wooting_rgb_convert_kernel)(const uint8_t *pixels,
+                                           WOOTING_RGB_PIXEL_FORMAT format,
+                                           uint16_t *colours, uint8_t count);
+
+/// @brief Size of a pixel in bytes, 0 if the format is unknown
+uint8_t wooting_rgb_pixel_size(WOOTING_RGB_PIXEL_FORMAT format);
+
+/// @brief Converts count pixels with the fastest kernel the CPU supports
+void wooting_rgb_convert_row(const uint8_t *pixels,
+                             WOOTING_RGB_PIXEL_FORMAT format,
+                             uint16_t *colours, uint8_t count);
+
+/// @brief Returns the fastest kernel for a format that only uses the given
+/// instruction sets, a mask of WOOTING_CPU_* flags. 0 gives the scalar kernel,
+/// as does a format no SIMD kernel for those sets covers
+wooting_rgb_convert_kernel
+wooting_rgb_convert_get_kernel(uint32_t features,
+                               WOOTING_RGB_PIXEL_FORMAT format);
+
+// Adds up the channels of count pixels onto sums, in the order they are stored
+// in, e.g. blue first for BGR. Channels are counted as 0-255
+typedef void (*wooting_rgb_sum_kernel)(const uint8_t *pixels,
+                                       WOOTING_RGB_PIXEL_FORMAT format,
+                                       uint32_t count, uint32_t sums[3]);
+
+/// @brief Returns the fastest summing kernel that only uses the given
+/// instruction sets, see wooting_rgb_convert_get_kernel
+wooting_rgb_sum_kernel wooting_rgb_sum_get_kernel(uint32_t features);
+
+/// @brief Area averages an image down to rows x columns RGB565 colours
+///
+/// Every colour is the average of the part of the image its key covers. To
+/// keep the cost of large images down, at most WOOTING_RGB_DOWNSCALE_SAMPLES
+/// evenly spread lines of each part are read, each of them in full.
+/// @param features Instruction sets the kernels may use, see
+/// wooting_rgb_convert_get_kernel
+void wooting_rgb_downscale(const uint8_t *pixels,
+                           WOOTING_RGB_PIXEL_FORMAT format, uint32_t width,
+                           uint32_t height, size_t stride, uint8_t rows,
+                           uint8_t columns, WOOTING_RGB_MATRIX colours,
+                           uint32_t features);
+
+// Most image lines read for each row of keys
+#define WOOTING_RGB_DOWNSCALE_SAMPLES 32
+
+#ifdef __cplusplus
+}
+#endif
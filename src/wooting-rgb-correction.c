@@ -0,0 +1,62 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "wooting-rgb-correction.h"
+#include "math.h"
+
+bool wooting_rgb_correction_is_identity(
+    const WOOTING_RGB_CORRECTION *correction) {
+  return (correction->gamma == 0 || correction->gamma == 1) &&
+         correction->brightness == 255 && correction->white_red == 255 &&
+         correction->white_green == 255 && correction->white_blue == 255;
+}
+
+// Output of one channel for each of its 8 bit values
+static void build_channel(uint8_t channel[256],
+                          const WOOTING_RGB_CORRECTION *correction,
+                          const uint8_t device_curve[256], uint8_t white) {
+  uint32_t scale = (uint32_t)correction->brightness * white;
+  for (uint32_t value = 0; value < 256; value++) {
+    uint32_t curved = value;
+    if (correction->gamma > 0) {
+      curved = (uint32_t)(pow(value / 255.0, correction->gamma) * 255.0 + 0.5);
+    } else if (device_curve) {
+      curved = device_curve[value];
+    }
+    channel[value] = (uint8_t)((curved * scale + 255 * 255 / 2) / (255 * 255));
+  }
+}
+
+void wooting_rgb_correction_build(WOOTING_RGB_CORRECTION_TABLE table,
+                                  const WOOTING_RGB_CORRECTION *correction,
+                                  const uint8_t device_curve[256]) {
+  uint8_t red[256], green[256], blue[256];
+  build_channel(red, correction, device_curve, correction->white_red);
+  build_channel(green, correction, device_curve, correction->white_green);
+  build_channel(blue, correction, device_curve, correction->white_blue);
+
+  // Channels are expanded the way the v1 encoding always did, without
+  // repeating the top bits, so the device curve gives what it used to
+  for (uint32_t colour = 0; colour < WOOTING_RGB_CORRECTION_ENTRIES;
+       colour++) {
+    table[colour] = (uint32_t)red[(colour >> 8) & 0xf8] << 16 |
+                    (uint32_t)green[(colour >> 3) & 0xfc] << 8 |
+                    blue[(colour << 3) & 0xf8];
+  }
+}
+
+void wooting_rgb_correction_apply(const WOOTING_RGB_CORRECTION_TABLE table,
+                                  const WOOTING_RGB_MATRIX matrix,
+                                  WOOTING_RGB_MATRIX corrected) {
+  const uint16_t *keys = &matrix[0][0];
+  uint16_t *out = &corrected[0][0];
+  for (uint32_t i = 0; i < WOOTING_RGB_ROWS * WOOTING_RGB_COLS; i++) {
+    uint32_t colour = table[keys[i]];
+    out[i] = (uint16_t)((colour >> 8 & 0xf800) | (colour >> 5 & 0x07e0) |
+                        (colour >> 3 & 0x001f));
+  }
+}
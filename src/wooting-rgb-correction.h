@@ -0,0 +1,45 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "wooting-rgb-sdk.h"
+
+// Colour correction on the way to a device. Gamma, brightness and white
+// balance are compiled into one table with the output colour of every RGB565
+// colour, so correcting a key is a single lookup however many stages there
+// are. The table only has to be rebuilt when the correction changes.
+
+#define WOOTING_RGB_CORRECTION_ENTRIES 65536
+
+/// The corrected colour of each RGB565 colour as 0x00RRGGBB
+typedef uint32_t WOOTING_RGB_CORRECTION_TABLE[WOOTING_RGB_CORRECTION_ENTRIES];
+
+/// @brief Whether the correction changes nothing for a device without a curve
+/// of its own
+bool wooting_rgb_correction_is_identity(
+    const WOOTING_RGB_CORRECTION *correction);
+
+/// @brief Fills table with the corrected colour of every RGB565 colour
+/// @param device_curve Used when the correction has no gamma of its own, NULL
+/// for devices that show colours as they are
+void wooting_rgb_correction_build(WOOTING_RGB_CORRECTION_TABLE table,
+                                  const WOOTING_RGB_CORRECTION *correction,
+                                  const uint8_t device_curve[256]);
+
+/// @brief Replaces every key of matrix with its corrected RGB565 colour
+void wooting_rgb_correction_apply(const WOOTING_RGB_CORRECTION_TABLE table,
+                                  const WOOTING_RGB_MATRIX matrix,
+                                  WOOTING_RGB_MATRIX corrected);
+
+#ifdef __cplusplus
+}
+#endif
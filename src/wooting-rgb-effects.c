@@ -0,0 +1,185 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "wooting-rgb-effects.h"
+#include "string.h"
+
+#define DEFAULT_PERIOD_MS 2000
+#define DEFAULT_FRAME_RATE 60
+// Width of a ripple ring, in 1/16 keys
+#define RIPPLE_WIDTH 32
+
+// One cycle of a smooth pulse, (1 - cos) / 2 scaled to 0-255
+static const uint8_t pulse[WOOTING_RGB_EFFECT_STEPS] = {
+    0,   0,   0,   0,   1,   1,   1,   2,   2,   3,   4,   5,   5,   6,   7,
+    9,   10,  11,  12,  14,  15,  17,  18,  20,  21,  23,  25,  27,  29,  31,
+    33,  35,  37,  40,  42,  44,  47,  49,  52,  54,  57,  59,  62,  65,  67,
+    70,  73,  76,  79,  82,  85,  88,  90,  93,  97,  100, 103, 106, 109, 112,
+    115, 118, 121, 124, 127, 131, 134, 137, 140, 143, 146, 149, 152, 155, 158,
+    162, 165, 167, 170, 173, 176, 179, 182, 185, 188, 190, 193, 196, 198, 201,
+    203, 206, 208, 211, 213, 215, 218, 220, 222, 224, 226, 228, 230, 232, 234,
+    235, 237, 238, 240, 241, 243, 244, 245, 246, 248, 249, 250, 250, 251, 252,
+    253, 253, 254, 254, 254, 255, 255, 255, 255, 255, 255, 255, 254, 254, 254,
+    253, 253, 252, 251, 250, 250, 249, 248, 246, 245, 244, 243, 241, 240, 238,
+    237, 235, 234, 232, 230, 228, 226, 224, 222, 220, 218, 215, 213, 211, 208,
+    206, 203, 201, 198, 196, 193, 190, 188, 185, 182, 179, 176, 173, 170, 167,
+    165, 162, 158, 155, 152, 149, 146, 143, 140, 137, 134, 131, 128, 124, 121,
+    118, 115, 112, 109, 106, 103, 100, 97,  93,  90,  88,  85,  82,  79,  76,
+    73,  70,  67,  65,  62,  59,  57,  54,  52,  49,  47,  44,  42,  40,  37,
+    35,  33,  31,  29,  27,  25,  23,  21,  20,  18,  17,  15,  14,  12,  11,
+    10,  9,   7,   6,   5,   5,   4,   3,   2,   2,   1,   1,   1,   0,   0,
+    0};
+
+static uint16_t encode_colour(uint8_t red, uint8_t green, uint8_t blue) {
+  return (uint16_t)((red & 0xf8) << 8 | (green & 0xfc) << 3 | blue >> 3);
+}
+
+static uint8_t mix(uint8_t from, uint8_t to, uint8_t amount) {
+  return (uint8_t)(from + ((int)to - from) * amount / 255);
+}
+
+static uint16_t mix_colour(const WOOTING_RGB_EFFECT_PARAMS *params,
+                           uint8_t amount) {
+  return encode_colour(mix(params->background_red, params->red, amount),
+                       mix(params->background_green, params->green, amount),
+                       mix(params->background_blue, params->blue, amount));
+}
+
+// Fully saturated colour at a position on the colour wheel, starting at red
+static uint16_t hue_colour(uint32_t step) {
+  uint32_t position = step * 6 * 256 / WOOTING_RGB_EFFECT_STEPS;
+  uint8_t rising = (uint8_t)(position & 0xff);
+  uint8_t falling = (uint8_t)(255 - rising);
+
+  switch (position >> 8) {
+  case 0:
+    return encode_colour(255, rising, 0);
+  case 1:
+    return encode_colour(falling, 255, 0);
+  case 2:
+    return encode_colour(0, 255, rising);
+  case 3:
+    return encode_colour(0, falling, 255);
+  case 4:
+    return encode_colour(rising, 0, 255);
+  default:
+    return encode_colour(255, 0, falling);
+  }
+}
+
+static uint16_t square_root(uint32_t value) {
+  uint32_t root = 0;
+  for (uint32_t bit = 1u << 30; bit; bit >>= 2) {
+    if (value >= root + bit) {
+      value -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+  }
+  return (uint16_t)root;
+}
+
+bool wooting_rgb_effect_prepare(WOOTING_RGB_EFFECT_STATE *state,
+                                WOOTING_RGB_EFFECT effect,
+                                const WOOTING_RGB_EFFECT_PARAMS *params) {
+  if (effect > WOOTING_RGB_EFFECT_RIPPLE) {
+    return false;
+  }
+
+  memset(state, 0, sizeof(*state));
+  state->effect = effect;
+  if (params) {
+    state->params = *params;
+  } else {
+    state->params.red = 255;
+    state->params.green = 255;
+    state->params.blue = 255;
+  }
+
+  WOOTING_RGB_EFFECT_PARAMS *settings = &state->params;
+  if (settings->period_ms == 0) {
+    settings->period_ms = DEFAULT_PERIOD_MS;
+  }
+  if (settings->frame_rate == 0) {
+    settings->frame_rate = DEFAULT_FRAME_RATE;
+  }
+  if (settings->wavelength == 0 && effect == WOOTING_RGB_EFFECT_WAVE) {
+    settings->wavelength = WOOTING_RGB_COLS;
+  }
+  if (settings->origin_row >= WOOTING_RGB_ROWS) {
+    settings->origin_row = WOOTING_RGB_ROWS - 1;
+  }
+  if (settings->origin_column >= WOOTING_RGB_COLS) {
+    settings->origin_column = WOOTING_RGB_COLS - 1;
+  }
+
+  for (uint32_t step = 0; step < WOOTING_RGB_EFFECT_STEPS; step++) {
+    switch (effect) {
+    case WOOTING_RGB_EFFECT_WAVE:
+    case WOOTING_RGB_EFFECT_BREATHING:
+      state->gradient[step] = mix_colour(settings, pulse[step]);
+      break;
+    case WOOTING_RGB_EFFECT_SPECTRUM:
+      state->gradient[step] = hue_colour(step);
+      break;
+    case WOOTING_RGB_EFFECT_RIPPLE:
+      state->gradient[step] = mix_colour(settings, (uint8_t)step);
+      break;
+    }
+  }
+
+  for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+    for (uint8_t column = 0; column < WOOTING_RGB_COLS; column++) {
+      if (effect == WOOTING_RGB_EFFECT_RIPPLE) {
+        int32_t rows = (row - settings->origin_row) * 16;
+        int32_t columns = (column - settings->origin_column) * 16;
+        uint16_t distance =
+            square_root((uint32_t)(rows * rows + columns * columns));
+        state->offset[row][column] = distance;
+        if (distance + RIPPLE_WIDTH > state->ripple_end) {
+          state->ripple_end = distance + RIPPLE_WIDTH;
+        }
+      } else if (effect != WOOTING_RGB_EFFECT_BREATHING &&
+                 settings->wavelength) {
+        state->offset[row][column] =
+            (uint16_t)(column * 65536u / settings->wavelength);
+      }
+    }
+  }
+
+  return true;
+}
+
+void wooting_rgb_effect_render(const WOOTING_RGB_EFFECT_STATE *state,
+                               uint32_t time_ms, WOOTING_RGB_MATRIX colours) {
+  uint32_t period = state->params.period_ms;
+  uint16_t phase = (uint16_t)((uint64_t)(time_ms % period) * 65536 / period);
+
+  if (state->effect == WOOTING_RGB_EFFECT_RIPPLE) {
+    uint32_t radius = (uint32_t)phase * state->ripple_end >> 16;
+    for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+      for (uint8_t column = 0; column < WOOTING_RGB_COLS; column++) {
+        uint32_t distance = state->offset[row][column];
+        uint32_t away =
+            distance > radius ? distance - radius : radius - distance;
+        colours[row][column] =
+            away < RIPPLE_WIDTH
+                ? state->gradient[255 - away * 255 / RIPPLE_WIDTH]
+                : state->gradient[0];
+      }
+    }
+    return;
+  }
+
+  for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+    for (uint8_t column = 0; column < WOOTING_RGB_COLS; column++) {
+      uint16_t position = (uint16_t)(phase - state->offset[row][column]);
+      colours[row][column] = state->gradient[position >> 8];
+    }
+  }
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "wooting-rgb-sdk.h"
+
+// Procedural effects, rendered a whole colour array at a time. Everything that
+// only depends on the parameters, the colours an effect goes through and where
+// each key is in its cycle, is worked out once when the effect is prepared, so
+// rendering a frame costs one table lookup per key.
+
+// Number of colours in an effect's gradient
+#define WOOTING_RGB_EFFECT_STEPS 256
+
+typedef struct WOOTING_RGB_EFFECT_STATE {
+  WOOTING_RGB_EFFECT effect;
+  // With the defaults filled in
+  WOOTING_RGB_EFFECT_PARAMS params;
+  // RGB565 colours of one cycle. For the ripple these go from the background
+  // to the colour instead
+  uint16_t gradient[WOOTING_RGB_EFFECT_STEPS];
+  // How far behind the start of the cycle each key is, in 1/65536 of a cycle.
+  // For the ripple the distance of the key to the origin in 1/16 keys
+  uint16_t offset[WOOTING_RGB_ROWS][WOOTING_RGB_COLS];
+  // Radius at which the ripple has left the last key, in 1/16 keys
+  uint16_t ripple_end;
+} WOOTING_RGB_EFFECT_STATE;
+
+/// @brief Fills in the defaults of params, which may be NULL, and builds the
+/// tables of the effect
+/// @return false if the effect is unknown
+bool wooting_rgb_effect_prepare(WOOTING_RGB_EFFECT_STATE *state,
+                                WOOTING_RGB_EFFECT effect,
+                                const WOOTING_RGB_EFFECT_PARAMS *params);
+
+/// @brief Renders the effect as it looks time_ms after it started
+void wooting_rgb_effect_render(const WOOTING_RGB_EFFECT_STATE *state,
+                               uint32_t time_ms, WOOTING_RGB_MATRIX colours);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,119 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "wooting-rgb-layers.h"
+#include "string.h"
+
+#define ALL_KEYS ((1u << WOOTING_RGB_COLS) - 1)
+
+void wooting_rgb_layers_init(WOOTING_RGB_LAYER_STACK *stack) {
+  memset(stack, 0, sizeof(*stack));
+  for (uint8_t i = 0; i < WOOTING_RGB_LAYERS; i++) {
+    stack->layers[i].mode = WOOTING_RGB_BLEND_NORMAL;
+    stack->layers[i].visible = true;
+  }
+  wooting_usb_v2_report_init(&stack->output);
+}
+
+void wooting_rgb_layers_set_key(WOOTING_RGB_LAYER_STACK *stack, uint8_t layer,
+                                uint8_t row, uint8_t column, uint16_t colour,
+                                uint8_t alpha) {
+  // A layer that is drawn on for the first time has nothing cached yet, and
+  // neither do the unused ones below it
+  while (stack->used <= layer) {
+    wooting_rgb_layers_touch(stack, stack->used++);
+  }
+
+  WOOTING_RGB_LAYER *target = &stack->layers[layer];
+  if (target->colours[row][column] != colour ||
+      target->alpha[row][column] != alpha) {
+    target->colours[row][column] = colour;
+    target->alpha[row][column] = alpha;
+    stack->dirty[layer][row] |= 1u << column;
+  }
+}
+
+void wooting_rgb_layers_touch(WOOTING_RGB_LAYER_STACK *stack, uint8_t layer) {
+  for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+    stack->dirty[layer][row] = ALL_KEYS;
+  }
+}
+
+static uint8_t blend_channel(WOOTING_RGB_BLEND_MODE mode, uint32_t below,
+                             uint32_t top, uint32_t alpha) {
+  switch (mode) {
+  case WOOTING_RGB_BLEND_ADD: {
+    uint32_t sum = below + top * alpha / 255;
+    return (uint8_t)(sum > 255 ? 255 : sum);
+  }
+  case WOOTING_RGB_BLEND_MULTIPLY:
+    // A transparent key multiplies by white
+    return (uint8_t)(below * (255 - alpha + top * alpha / 255) / 255);
+  default:
+    return (uint8_t)(below + ((int32_t)top - (int32_t)below) *
+                                 (int32_t)alpha / 255);
+  }
+}
+
+static uint16_t blend(const WOOTING_RGB_LAYER *layer, uint16_t below,
+                      uint8_t row, uint8_t column) {
+  uint8_t alpha = layer->alpha[row][column];
+  if (!layer->visible || alpha == 0) {
+    return below;
+  }
+
+  uint16_t top = layer->colours[row][column];
+  if (alpha == 255 && layer->mode == WOOTING_RGB_BLEND_NORMAL) {
+    return top;
+  }
+
+  uint8_t red = blend_channel(layer->mode, (below >> 8) & 0xf8,
+                              (top >> 8) & 0xf8, alpha);
+  uint8_t green = blend_channel(layer->mode, (below >> 3) & 0xfc,
+                                (top >> 3) & 0xfc, alpha);
+  uint8_t blue = blend_channel(layer->mode, (below << 3) & 0xf8,
+                               (top << 3) & 0xf8, alpha);
+  return (uint16_t)((red & 0xf8) << 8 | (green & 0xfc) << 3 | blue >> 3);
+}
+
+void wooting_rgb_layers_compose(WOOTING_RGB_LAYER_STACK *stack,
+                                const WOOTING_RGB_MATRIX base,
+                                uint32_t dirty[WOOTING_RGB_ROWS]) {
+  // Keys whose input changed are carried up the stack, each layer adds its
+  // own changed keys
+  for (uint8_t i = 0; i < stack->used; i++) {
+    const WOOTING_RGB_LAYER *layer = &stack->layers[i];
+    const uint16_t(*below)[WOOTING_RGB_COLS] =
+        i ? (const uint16_t(*)[WOOTING_RGB_COLS])stack->blended[i - 1] : base;
+
+    for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+      dirty[row] |= stack->dirty[i][row];
+      stack->dirty[i][row] = 0;
+
+      uint32_t keys = dirty[row] & ALL_KEYS;
+      for (uint8_t column = 0; keys; column++, keys >>= 1) {
+        if (keys & 1) {
+          stack->blended[i][row][column] =
+              blend(layer, below[row][column], row, column);
+        }
+      }
+    }
+  }
+
+  const uint16_t(*top)[WOOTING_RGB_COLS] =
+      stack->used ? (const uint16_t(*)[WOOTING_RGB_COLS])
+                        stack->blended[stack->used - 1]
+                  : base;
+  for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+    uint32_t keys = dirty[row] & ALL_KEYS;
+    for (uint8_t column = 0; keys; column++, keys >>= 1) {
+      if (keys & 1) {
+        stack->output.matrix[row][column] = top[row][column];
+      }
+    }
+  }
+}
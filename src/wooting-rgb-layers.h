@@ -0,0 +1,65 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "wooting-rgb-sdk.h"
+
+// Layers drawn on top of a device's colour array. The result of blending each
+// layer onto everything below it is cached, so composing only redoes the keys
+// that changed, from the lowest layer they changed in upwards. Layers and
+// keys that didn't change are never blended again.
+
+typedef struct WOOTING_RGB_LAYER {
+  // RGB565 like the colour array
+  WOOTING_RGB_MATRIX colours;
+  // 0 leaves the key below untouched, 255 applies the layer in full
+  uint8_t alpha[WOOTING_RGB_ROWS][WOOTING_RGB_COLS];
+  WOOTING_RGB_BLEND_MODE mode;
+  bool visible;
+} WOOTING_RGB_LAYER;
+
+typedef struct WOOTING_RGB_LAYER_STACK {
+  WOOTING_RGB_LAYER layers[WOOTING_RGB_LAYERS];
+  // Keys of each layer changed since the last composition
+  uint32_t dirty[WOOTING_RGB_LAYERS][WOOTING_RGB_ROWS];
+  // The colour array with layers 0 to i blended onto it
+  WOOTING_RGB_MATRIX blended[WOOTING_RGB_LAYERS];
+  // Layers from this one up have never been drawn on and are skipped
+  uint8_t used;
+  // The top of the stack, kept in a report so it can be sent in place
+  WOOTING_USB_V2_REPORT output;
+} WOOTING_RGB_LAYER_STACK;
+
+/// @brief Makes all layers empty and visible, with normal blending
+void wooting_rgb_layers_init(WOOTING_RGB_LAYER_STACK *stack);
+
+/// @brief Changes one key of a layer, marking it dirty if it changed
+void wooting_rgb_layers_set_key(WOOTING_RGB_LAYER_STACK *stack, uint8_t layer,
+                                uint8_t row, uint8_t column, uint16_t colour,
+                                uint8_t alpha);
+
+/// @brief Marks every key of a layer dirty, after its mode or visibility
+/// changed
+void wooting_rgb_layers_touch(WOOTING_RGB_LAYER_STACK *stack, uint8_t layer);
+
+/// @brief Blends the changed keys of the stack onto the colour array into
+/// stack->output
+/// @param base The colour array
+/// @param dirty Keys of the colour array that changed. Replaced by the keys of
+/// the output that may have changed
+void wooting_rgb_layers_compose(WOOTING_RGB_LAYER_STACK *stack,
+                                const WOOTING_RGB_MATRIX base,
+                                uint32_t dirty[WOOTING_RGB_ROWS]);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,494 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "wooting-rgb-record.h"
+#include "stdlib.h"
+#include "string.h"
+
+#define KEY_COUNT (WOOTING_RGB_ROWS * WOOTING_RGB_COLS)
+#define ROW_MASK_SIZE 3
+// A frame with more changed keys than this is smaller with row masks
+#define MAX_LISTED_KEYS (WOOTING_RGB_ROWS * ROW_MASK_SIZE)
+#define MAX_PAYLOAD (WOOTING_RGB_ROWS * ROW_MASK_SIZE + KEY_COUNT * 2)
+
+static void put_u16(uint8_t *out, uint16_t value) {
+  out[0] = (uint8_t)value;
+  out[1] = (uint8_t)(value >> 8);
+}
+
+static void put_u32(uint8_t *out, uint32_t value) {
+  put_u16(out, (uint16_t)value);
+  put_u16(out + 2, (uint16_t)(value >> 16));
+}
+
+static void put_u64(uint8_t *out, uint64_t value) {
+  put_u32(out, (uint32_t)value);
+  put_u32(out + 4, (uint32_t)(value >> 32));
+}
+
+static uint16_t get_u16(const uint8_t *in) {
+  return (uint16_t)(in[0] | in[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *in) {
+  return get_u16(in) | (uint32_t)get_u16(in + 2) << 16;
+}
+
+static uint64_t get_u64(const uint8_t *in) {
+  return get_u32(in) | (uint64_t)get_u32(in + 4) << 32;
+}
+
+static void recorder_write(WOOTING_RECORDER *recorder, const void *data,
+                           size_t length) {
+  if (recorder->failed) {
+    return;
+  }
+
+  if (fwrite(data, 1, length, recorder->file) != length) {
+    recorder->failed = true;
+    return;
+  }
+  recorder->offset += length;
+}
+
+static void recorder_entry(WOOTING_RECORDER *recorder, uint64_t time_us,
+                           uint8_t device_index, WOOTING_RECORD_TYPE type,
+                           const uint8_t *data, uint16_t length) {
+  uint8_t header[WOOTING_RECORD_ENTRY_HEADER_SIZE];
+  header[0] = (uint8_t)type;
+  header[1] = device_index;
+  put_u16(header + 2, length);
+  put_u32(header + 4, (uint32_t)(time_us - recorder->last_us));
+  recorder->last_us = time_us;
+
+  recorder_write(recorder, header, sizeof(header));
+  recorder_write(recorder, data, length);
+}
+
+// Stores the keys of frame that are set in changed
+static uint16_t encode_frame(const WOOTING_RGB_MATRIX frame,
+                             const uint32_t changed[WOOTING_RGB_ROWS],
+                             uint8_t count, uint8_t *out,
+                             WOOTING_RECORD_TYPE *type) {
+  uint8_t *next = out;
+  if (count <= MAX_LISTED_KEYS) {
+    *type = WOOTING_RECORD_FRAME_KEYS;
+  } else {
+    *type = WOOTING_RECORD_FRAME_MASKED;
+    for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+      next[0] = (uint8_t)changed[row];
+      next[1] = (uint8_t)(changed[row] >> 8);
+      next[2] = (uint8_t)(changed[row] >> 16);
+      next += ROW_MASK_SIZE;
+    }
+  }
+
+  for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+    for (uint8_t column = 0; column < WOOTING_RGB_COLS; column++) {
+      if (!(changed[row] & (1u << column))) {
+        continue;
+      }
+      if (*type == WOOTING_RECORD_FRAME_KEYS) {
+        *next++ = (uint8_t)(row * WOOTING_RGB_COLS + column);
+      }
+      put_u16(next, frame[row][column]);
+      next += 2;
+    }
+  }
+  return (uint16_t)(next - out);
+}
+
+// Writes a sync record and the full frame of every device seen so far
+static void recorder_sync(WOOTING_RECORDER *recorder, uint64_t time_us) {
+  if (recorder->sync_count == recorder->sync_capacity) {
+    uint32_t capacity =
+        recorder->sync_capacity ? recorder->sync_capacity * 2 : 64;
+    WOOTING_RECORD_SYNC_POINT *syncs = (WOOTING_RECORD_SYNC_POINT *)realloc(
+        recorder->syncs, capacity * sizeof(*syncs));
+    if (!syncs) {
+      recorder->failed = true;
+      return;
+    }
+    recorder->syncs = syncs;
+    recorder->sync_capacity = capacity;
+  }
+  recorder->syncs[recorder->sync_count].time_us = time_us;
+  recorder->syncs[recorder->sync_count].offset = recorder->offset;
+  recorder->sync_count++;
+  recorder->last_sync_us = time_us;
+
+  uint8_t absolute[8];
+  put_u64(absolute, time_us);
+  recorder_entry(recorder, time_us, 0, WOOTING_RECORD_SYNC, absolute,
+                 sizeof(absolute));
+
+  uint32_t all[WOOTING_RGB_ROWS];
+  for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+    all[row] = (1u << WOOTING_RGB_COLS) - 1;
+  }
+  for (uint8_t i = 0; i < WOOTING_MAX_RGB_DEVICES; i++) {
+    if (recorder->seen[i]) {
+      uint8_t payload[MAX_PAYLOAD];
+      WOOTING_RECORD_TYPE type;
+      uint16_t length = encode_frame(
+          (const uint16_t(*)[WOOTING_RGB_COLS])recorder->frames[i], all,
+          KEY_COUNT, payload, &type);
+      recorder_entry(recorder, time_us, i, WOOTING_RECORD_SYNC_FRAME, payload,
+                     length);
+    }
+  }
+}
+
+// Time of a new record since the start, writing a sync record first when one
+// is due
+static uint64_t recorder_time(WOOTING_RECORDER *recorder, uint64_t now_us) {
+  uint64_t time_us =
+      now_us > recorder->start_us ? now_us - recorder->start_us : 0;
+  // Records can't go back in time, and the gap to the record before has to
+  // fit its header
+  if (time_us < recorder->last_us) {
+    time_us = recorder->last_us;
+  }
+  if (time_us - recorder->last_sync_us >= WOOTING_RECORD_SYNC_INTERVAL_US ||
+      time_us - recorder->last_us > UINT32_MAX) {
+    recorder_sync(recorder, time_us);
+  }
+  return time_us;
+}
+
+bool wooting_recorder_open(WOOTING_RECORDER *recorder, const char *path,
+                           uint64_t now_us) {
+  memset(recorder, 0, sizeof(*recorder));
+  recorder->file = fopen(path, "wb");
+  if (!recorder->file) {
+    return false;
+  }
+  recorder->start_us = now_us;
+
+  uint8_t header[WOOTING_RECORD_HEADER_SIZE] = WOOTING_RECORD_MAGIC;
+  put_u32(header + 8, WOOTING_RECORD_VERSION);
+  put_u32(header + 12, WOOTING_RECORD_HEADER_SIZE);
+  recorder_write(recorder, header, sizeof(header));
+  recorder_sync(recorder, 0);
+  if (recorder->failed) {
+    fclose(recorder->file);
+    free(recorder->syncs);
+    memset(recorder, 0, sizeof(*recorder));
+    return false;
+  }
+  return true;
+}
+
+void wooting_recorder_frame(WOOTING_RECORDER *recorder, uint64_t now_us,
+                            uint8_t device_index,
+                            const WOOTING_RGB_MATRIX frame) {
+  if (device_index >= WOOTING_MAX_RGB_DEVICES) {
+    return;
+  }
+
+  uint64_t time_us = recorder_time(recorder, now_us);
+  uint16_t(*last)[WOOTING_RGB_COLS] = recorder->frames[device_index];
+  bool seen = recorder->seen[device_index];
+  uint32_t changed[WOOTING_RGB_ROWS];
+  uint8_t count = 0;
+  for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+    changed[row] = 0;
+    for (uint8_t column = 0; column < WOOTING_RGB_COLS; column++) {
+      if (!seen || frame[row][column] != last[row][column]) {
+        changed[row] |= 1u << column;
+        count++;
+      }
+    }
+  }
+
+  // A frame without changes is still recorded, the update happened
+  uint8_t payload[MAX_PAYLOAD];
+  WOOTING_RECORD_TYPE type;
+  uint16_t length = encode_frame(frame, changed, count, payload, &type);
+  recorder_entry(recorder, time_us, device_index, type, payload, length);
+
+  memcpy(last, frame, sizeof(recorder->frames[device_index]));
+  recorder->seen[device_index] = true;
+}
+
+void wooting_recorder_command(WOOTING_RECORDER *recorder, uint64_t now_us,
+                              uint8_t device_index, WOOTING_RECORD_TYPE type,
+                              const uint8_t *data, uint16_t length) {
+  uint64_t time_us = recorder_time(recorder, now_us);
+  recorder_entry(recorder, time_us, device_index, type, data, length);
+}
+
+bool wooting_recorder_close(WOOTING_RECORDER *recorder) {
+  if (!recorder->file) {
+    return false;
+  }
+
+  uint64_t index_offset = recorder->offset;
+  for (uint32_t i = 0; i < recorder->sync_count; i++) {
+    uint8_t entry[16];
+    put_u64(entry, recorder->syncs[i].time_us);
+    put_u64(entry + 8, recorder->syncs[i].offset);
+    recorder_write(recorder, entry, sizeof(entry));
+  }
+
+  uint8_t trailer[WOOTING_RECORD_TRAILER_SIZE] = {0};
+  put_u64(trailer, index_offset);
+  put_u64(trailer + 8, recorder->last_us);
+  put_u32(trailer + 16, recorder->sync_count);
+  memcpy(trailer + 24, WOOTING_RECORD_MAGIC, 8);
+  recorder_write(recorder, trailer, sizeof(trailer));
+
+  bool result = fclose(recorder->file) == 0 && !recorder->failed;
+  free(recorder->syncs);
+  memset(recorder, 0, sizeof(*recorder));
+  return result;
+}
+
+// Time of the record at position, the absolute one for sync records
+static uint64_t record_time(const WOOTING_PLAYER *player, uint64_t position) {
+  const uint8_t *record = player->file.data + position;
+  if (record[0] == WOOTING_RECORD_SYNC && get_u16(record + 2) == 8 &&
+      player->end - position >= WOOTING_RECORD_ENTRY_HEADER_SIZE + 8) {
+    return get_u64(record + WOOTING_RECORD_ENTRY_HEADER_SIZE);
+  }
+  return player->time_us + get_u32(record + 4);
+}
+
+static bool decode_frame(WOOTING_PLAYER *player, WOOTING_RECORD_EVENT *event,
+                         const uint8_t *data, uint16_t length) {
+  uint16_t(*frame)[WOOTING_RGB_COLS] = player->frames[event->device_index];
+  memset(event->changed, 0, sizeof(event->changed));
+
+  if (event->type == WOOTING_RECORD_FRAME_KEYS) {
+    if (length % 3) {
+      return false;
+    }
+    for (uint16_t i = 0; i < length; i += 3) {
+      uint8_t key = data[i];
+      if (key >= KEY_COUNT) {
+        return false;
+      }
+      uint8_t row = key / WOOTING_RGB_COLS, column = key % WOOTING_RGB_COLS;
+      frame[row][column] = get_u16(data + i + 1);
+      event->changed[row] |= 1u << column;
+    }
+  } else {
+    if (length < WOOTING_RGB_ROWS * ROW_MASK_SIZE) {
+      return false;
+    }
+    const uint8_t *colours = data + WOOTING_RGB_ROWS * ROW_MASK_SIZE;
+    const uint8_t *end = data + length;
+    for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+      const uint8_t *mask = data + row * ROW_MASK_SIZE;
+      event->changed[row] = (mask[0] | mask[1] << 8 | (uint32_t)mask[2] << 16) &
+                            ((1u << WOOTING_RGB_COLS) - 1);
+      for (uint8_t column = 0; column < WOOTING_RGB_COLS; column++) {
+        if (event->changed[row] & (1u << column)) {
+          if (colours + 2 > end) {
+            return false;
+          }
+          frame[row][column] = get_u16(colours);
+          colours += 2;
+        }
+      }
+    }
+  }
+
+  player->seen[event->device_index] = true;
+  return true;
+}
+
+bool wooting_player_next(WOOTING_PLAYER *player, WOOTING_RECORD_EVENT *event) {
+  while (player->end - player->position >= WOOTING_RECORD_ENTRY_HEADER_SIZE) {
+    const uint8_t *record = player->file.data + player->position;
+    uint16_t length = get_u16(record + 2);
+    if (player->end - player->position <
+        (uint64_t)WOOTING_RECORD_ENTRY_HEADER_SIZE + length) {
+      return false;
+    }
+
+    const uint8_t *data = record + WOOTING_RECORD_ENTRY_HEADER_SIZE;
+    memset(event, 0, sizeof(*event));
+    event->type = (WOOTING_RECORD_TYPE)record[0];
+    event->device_index = record[1];
+    event->time_us = record_time(player, player->position);
+    if (event->device_index >= WOOTING_MAX_RGB_DEVICES) {
+      return false;
+    }
+    player->time_us = event->time_us;
+    player->position += WOOTING_RECORD_ENTRY_HEADER_SIZE + length;
+
+    switch (event->type) {
+    case WOOTING_RECORD_SYNC:
+    case WOOTING_RECORD_RESET_ALL:
+      return true;
+    case WOOTING_RECORD_SYNC_FRAME:
+    case WOOTING_RECORD_FRAME_KEYS:
+    case WOOTING_RECORD_FRAME_MASKED:
+      return decode_frame(player, event, data, length);
+    case WOOTING_RECORD_DIRECT_SET:
+      if (length < 5) {
+        return false;
+      }
+      event->red = data[2];
+      event->green = data[3];
+      event->blue = data[4];
+      // fall through
+    case WOOTING_RECORD_DIRECT_RESET:
+      if (length < 2) {
+        return false;
+      }
+      event->row = data[0];
+      event->column = data[1];
+      return true;
+    default:
+      // Written by a newer version, skipped
+      break;
+    }
+  }
+  return false;
+}
+
+// Reads through a recording that has no index for its sync records
+static bool player_scan(WOOTING_PLAYER *player) {
+  uint32_t capacity = 0;
+  WOOTING_RECORD_EVENT event;
+  uint64_t position = player->position;
+
+  while (wooting_player_next(player, &event)) {
+    if (event.type == WOOTING_RECORD_SYNC) {
+      if (player->sync_count == capacity) {
+        capacity = capacity ? capacity * 2 : 64;
+        WOOTING_RECORD_SYNC_POINT *syncs = (WOOTING_RECORD_SYNC_POINT *)realloc(
+            player->syncs, capacity * sizeof(*syncs));
+        if (!syncs) {
+          return false;
+        }
+        player->syncs = syncs;
+      }
+      player->syncs[player->sync_count].time_us = event.time_us;
+      player->syncs[player->sync_count].offset = position;
+      player->sync_count++;
+    }
+    position = player->position;
+  }
+
+  // A recording cut short ends at its last complete record
+  player->end = player->position;
+  player->duration_us = player->time_us;
+  return true;
+}
+
+static bool player_read_index(WOOTING_PLAYER *player, uint64_t header_size) {
+  const uint8_t *data = player->file.data;
+  uint64_t size = player->file.size;
+  if (size < header_size + WOOTING_RECORD_TRAILER_SIZE) {
+    return false;
+  }
+
+  // Everything in the trailer comes from the file, so nothing is added up
+  // before it's known not to wrap around
+  const uint8_t *trailer = data + size - WOOTING_RECORD_TRAILER_SIZE;
+  uint64_t index_offset = get_u64(trailer);
+  uint32_t count = get_u32(trailer + 16);
+  if (memcmp(trailer + 24, WOOTING_RECORD_MAGIC, 8) != 0 ||
+      index_offset < header_size ||
+      index_offset > size - WOOTING_RECORD_TRAILER_SIZE ||
+      count != (size - WOOTING_RECORD_TRAILER_SIZE - index_offset) / 16 ||
+      (size - WOOTING_RECORD_TRAILER_SIZE - index_offset) % 16) {
+    return false;
+  }
+
+  player->syncs = (WOOTING_RECORD_SYNC_POINT *)malloc(
+      (count ? count : 1) * sizeof(*player->syncs));
+  if (!player->syncs) {
+    return false;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    const uint8_t *entry = data + index_offset + (uint64_t)i * 16;
+    player->syncs[i].time_us = get_u64(entry);
+    player->syncs[i].offset = get_u64(entry + 8);
+    // Seeking starts reading at the offset and searches by time
+    if (player->syncs[i].offset < header_size ||
+        player->syncs[i].offset >
+            index_offset - WOOTING_RECORD_ENTRY_HEADER_SIZE ||
+        (i > 0 && player->syncs[i].time_us < player->syncs[i - 1].time_us)) {
+      free(player->syncs);
+      player->syncs = NULL;
+      return false;
+    }
+  }
+  player->sync_count = count;
+  player->end = index_offset;
+  player->duration_us = get_u64(trailer + 8);
+  return true;
+}
+
+bool wooting_player_open(WOOTING_PLAYER *player, const char *path) {
+  memset(player, 0, sizeof(*player));
+  if (!wooting_platform_map_file(path, &player->file)) {
+    return false;
+  }
+
+  const uint8_t *data = player->file.data;
+  if (player->file.size < WOOTING_RECORD_HEADER_SIZE ||
+      memcmp(data, WOOTING_RECORD_MAGIC, 8) != 0 ||
+      get_u32(data + 8) != WOOTING_RECORD_VERSION ||
+      get_u32(data + 12) < WOOTING_RECORD_HEADER_SIZE ||
+      get_u32(data + 12) > player->file.size) {
+    wooting_platform_unmap_file(&player->file);
+    return false;
+  }
+
+  player->position = get_u32(data + 12);
+  if (!player_read_index(player, player->position)) {
+    player->end = player->file.size;
+    if (!player_scan(player)) {
+      wooting_player_close(player);
+      return false;
+    }
+  }
+  return wooting_player_seek(player, 0);
+}
+
+bool wooting_player_seek(WOOTING_PLAYER *player, uint64_t time_us) {
+  // The last sync record at or before the time
+  uint32_t low = 0, high = player->sync_count;
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2;
+    if (player->syncs[middle].time_us <= time_us) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  memset(player->frames, 0, sizeof(player->frames));
+  memset(player->seen, 0, sizeof(player->seen));
+  if (low > 0) {
+    player->position = player->syncs[low - 1].offset;
+    player->time_us = player->syncs[low - 1].time_us;
+  } else {
+    player->position = get_u32(player->file.data + 12);
+    player->time_us = 0;
+  }
+
+  WOOTING_RECORD_EVENT event;
+  while (player->end - player->position >= WOOTING_RECORD_ENTRY_HEADER_SIZE &&
+         record_time(player, player->position) <= time_us) {
+    if (!wooting_player_next(player, &event)) {
+      break;
+    }
+  }
+  return true;
+}
+
+void wooting_player_close(WOOTING_PLAYER *player) {
+  wooting_platform_unmap_file(&player->file);
+  free(player->syncs);
+  memset(player, 0, sizeof(*player));
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdio.h"
+#include "wooting-platform.h"
+#include "wooting-rgb-sdk.h"
+#include "wooting-usb.h"
+
+// Recordings of what an app sent to its keyboards, see
+// wooting_rgb_record_start.
+//
+// A recording is a header followed by records, all little endian. Every record
+// starts with a type, a device index, the length of what follows and the time
+// since the record before it in microseconds. Frames only hold the keys that
+// changed since the last frame of their device, either as a list of keys or as
+// a mask per row, whichever is smaller.
+//
+// Every second a sync record with the absolute time is written, followed by
+// the full frame of every device seen so far, so playback can start from any
+// sync record. Closing the recording appends an index of the sync records and
+// a trailer pointing at it. A recording that was never closed is still
+// readable, its sync records are found by reading through it once.
+
+#define WOOTING_RECORD_MAGIC "WOOTREC"
+#define WOOTING_RECORD_VERSION 1
+// Size of the file header and of the header in front of every record
+#define WOOTING_RECORD_HEADER_SIZE 16
+#define WOOTING_RECORD_ENTRY_HEADER_SIZE 8
+#define WOOTING_RECORD_TRAILER_SIZE 32
+// Longest time between two sync records
+#define WOOTING_RECORD_SYNC_INTERVAL_US 1000000
+
+typedef enum WOOTING_RECORD_TYPE {
+  // Absolute time since the recording started, as 8 bytes
+  WOOTING_RECORD_SYNC = 1,
+  // Full frame of a device following a sync record, laid out like
+  // WOOTING_RECORD_FRAME_MASKED
+  WOOTING_RECORD_SYNC_FRAME,
+  // 3 bytes per changed key: its index in the colour array and its colour
+  WOOTING_RECORD_FRAME_KEYS,
+  // A 3 byte mask of changed columns per row, then the colours of those keys
+  WOOTING_RECORD_FRAME_MASKED,
+  // wooting_rgb_direct_set_key: row, column, red, green and blue
+  WOOTING_RECORD_DIRECT_SET,
+  // wooting_rgb_direct_reset_key: row and column
+  WOOTING_RECORD_DIRECT_RESET,
+  // wooting_rgb_reset_rgb, nothing follows
+  WOOTING_RECORD_RESET_ALL
+} WOOTING_RECORD_TYPE;
+
+/// Where a sync record is in the recording
+typedef struct WOOTING_RECORD_SYNC_POINT {
+  uint64_t time_us;
+  uint64_t offset;
+} WOOTING_RECORD_SYNC_POINT;
+
+typedef struct WOOTING_RECORDER {
+  FILE *file;
+  // Set once a write failed, nothing is written after that
+  bool failed;
+  uint64_t start_us;
+  // Time of the last record and of the last sync record, since start_us
+  uint64_t last_us;
+  uint64_t last_sync_us;
+  // Bytes written so far
+  uint64_t offset;
+  // The last frame recorded for each device
+  WOOTING_RGB_MATRIX frames[WOOTING_MAX_RGB_DEVICES];
+  bool seen[WOOTING_MAX_RGB_DEVICES];
+  WOOTING_RECORD_SYNC_POINT *syncs;
+  uint32_t sync_count;
+  uint32_t sync_capacity;
+} WOOTING_RECORDER;
+
+/// @brief Creates the recording, now_us is the time it starts at
+bool wooting_recorder_open(WOOTING_RECORDER *recorder, const char *path,
+                           uint64_t now_us);
+/// @brief Records the frame sent to a device. Unchanged keys aren't stored
+void wooting_recorder_frame(WOOTING_RECORDER *recorder, uint64_t now_us,
+                            uint8_t device_index,
+                            const WOOTING_RGB_MATRIX frame);
+/// @brief Records a command that isn't a frame
+/// @param data The bytes that go with the type, see WOOTING_RECORD_TYPE
+void wooting_recorder_command(WOOTING_RECORDER *recorder, uint64_t now_us,
+                              uint8_t device_index, WOOTING_RECORD_TYPE type,
+                              const uint8_t *data, uint16_t length);
+/// @brief Writes the index and closes the file
+/// @return false if anything in the recording failed to be written
+bool wooting_recorder_close(WOOTING_RECORDER *recorder);
+
+/// One record of a recording, with frames already applied to the player
+typedef struct WOOTING_RECORD_EVENT {
+  WOOTING_RECORD_TYPE type;
+  uint8_t device_index;
+  // Since the recording started
+  uint64_t time_us;
+  // Frames: a bit per column of the keys that changed
+  uint32_t changed[WOOTING_RGB_ROWS];
+  // Direct commands
+  uint8_t row;
+  uint8_t column;
+  uint8_t red;
+  uint8_t green;
+  uint8_t blue;
+} WOOTING_RECORD_EVENT;
+
+typedef struct WOOTING_PLAYER {
+  wooting_mapped_file file;
+  // Read from the index, or found by reading through the recording when it
+  // was never closed
+  WOOTING_RECORD_SYNC_POINT *syncs;
+  uint32_t sync_count;
+  // End of the records, where the index starts if there is one
+  uint64_t end;
+  uint64_t duration_us;
+  // Next record to read and the time of the record before it
+  uint64_t position;
+  uint64_t time_us;
+  // What each device shows at the current position
+  WOOTING_RGB_MATRIX frames[WOOTING_MAX_RGB_DEVICES];
+  bool seen[WOOTING_MAX_RGB_DEVICES];
+} WOOTING_PLAYER;
+
+/// @brief Maps a recording and finds its sync records
+bool wooting_player_open(WOOTING_PLAYER *player, const char *path);
+/// @brief Reads the next record, frames are applied to player->frames
+/// @return false at the end of the recording or at a damaged record
+bool wooting_player_next(WOOTING_PLAYER *player, WOOTING_RECORD_EVENT *event);
+/// @brief Moves to the given time, player->frames then hold what every device
+/// showed at that time and the next record is the first one after it
+bool wooting_player_seek(WOOTING_PLAYER *player, uint64_t time_us);
+void wooting_player_close(WOOTING_PLAYER *player);
+
+#ifdef __cplusplus
+}
+#endif
@@ -6,6 +6,15 @@
  * file, You can obtain one at http://mozilla.org/MPL/2.0/.
  */
 #include "wooting-rgb-sdk.h"
+#include "stdlib.h"
+#include "string.h"
+#include "wooting-platform.h"
+#include "wooting-rgb-convert.h"
+#include "wooting-rgb-correction.h"
+#include "wooting-rgb-effects.h"
+#include "wooting-rgb-layers.h"
+#include "wooting-rgb-record.h"
+#include "wooting-trace.h"
 
 /** @brief Builds the V1 buffers from a full matrix
 
@@ -24,14 +33,104 @@ bool wooting_rgb_build_v1_buffers();
 #define LED_ENTER_ISO 62
 
 static bool wooting_rgb_auto_update = false;
+static bool wooting_rgb_async_update = false;
+static bool wooting_rgb_delta_update = false;
+
+// One bit per column for each row
+typedef uint32_t WOOTING_RGB_KEY_MASK[WOOTING_RGB_ROWS];
+
+// Keys to look at on the next update of a device
+typedef struct WOOTING_RGB_CHANGES {
+  // The colour changed in the array since it was last sent
+  WOOTING_RGB_KEY_MASK dirty;
+  // The key was set outside of the array (direct key commands, reset), so the
+  // device may not show the array colour even if it didn't change
+  WOOTING_RGB_KEY_MASK stale;
+} WOOTING_RGB_CHANGES;
 
 // Each rgb buffer is able to hold RGB values for 24 keys
 // There is some overhead because of the memory layout of the LED drivers
-static uint8_t rgb_buffer0[RGB_RAW_BUFFER_SIZE] = {0};
-static uint8_t rgb_buffer1[RGB_RAW_BUFFER_SIZE] = {0};
-static uint8_t rgb_buffer2[RGB_RAW_BUFFER_SIZE] = {0};
-static uint8_t rgb_buffer3[RGB_RAW_BUFFER_SIZE] = {0};
-static uint8_t rgb_buffer4[RGB_RAW_BUFFER_SIZE] = {0};
+typedef uint8_t WOOTING_RGB_V1_BUFFERS[PART4 + 1][RGB_RAW_BUFFER_SIZE];
+// The v1 parts last sent to each device
+static WOOTING_RGB_V1_BUFFERS rgb_v1_buffer_array[WOOTING_MAX_RGB_DEVICES];
+
+// A frame handed to a writer, with the keys that changed since the last frame
+// that was sent
+typedef struct WOOTING_RGB_WRITER_FRAME {
+  WOOTING_USB_V2_REPORT report;
+  WOOTING_RGB_CHANGES changes;
+  uint32_t sequence;
+} WOOTING_RGB_WRITER_FRAME;
+
+// The newest committed frame is kept in the writer's ready slot as an index,
+// with this bit set until the writer takes it
+#define WRITER_FRAME_FRESH 0x4
+#define WRITER_FRAME_INDEX 0x3
+
+// Background writer of a device. In async update mode the app thread only
+// publishes the latest frame, if the writer is still busy sending the previous
+// one the published frame is simply replaced by newer ones. A synchronous
+// update of all devices commits to every writer and waits for them to present.
+//
+// The frames are triple buffered: the app thread fills its back frame and
+// swaps it with the ready one, the writer swaps the frame it sent with the
+// ready one once it's fresh. Neither side ever waits for the other to finish
+// with a frame, so a commit can't get stuck behind USB I/O and the writer
+// never sees a half written frame.
+typedef struct WOOTING_RGB_WRITER {
+  uint8_t device_index;
+  bool running;
+  bool stop;
+  wooting_atomic failed;
+  WOOTING_RGB_WRITER_FRAME frames[3];
+  // Index of the committed frame, see WRITER_FRAME_FRESH
+  wooting_atomic ready;
+  // Set while the writer waits for a frame, a commit only wakes it up then
+  wooting_atomic waiting;
+  wooting_thread thread;
+  wooting_mutex lock;
+  wooting_cond cond;
+  // Sequence of the last frame presented, signalled on presented_cond for
+  // threads waiting on a frame they committed. Guarded by lock
+  uint32_t presented;
+  wooting_cond presented_cond;
+
+  // Only one thread commits at a time, the effects engine and the app can
+  // both be committing. The writer never takes this lock
+  wooting_mutex commit_lock;
+  uint8_t back;
+  // Sequence of the last frame committed
+  uint32_t committed;
+  // Keys of frames that were replaced before the writer got to them, they are
+  // added to the next commit
+  WOOTING_RGB_CHANGES carry;
+
+  // Only used by the writer thread
+  uint8_t front;
+
+  // Counted by committing threads, see wooting_rgb_array_pacing_stats
+  wooting_atomic frames_dropped;
+
+  // Frame pacing, see wooting_rgb_array_frame_rate. Everything below is
+  // guarded by lock
+  uint64_t next_present_us;
+  // Moving average of how long presenting a frame takes, 0 until measured
+  uint32_t present_us;
+  uint32_t frames_presented;
+  uint32_t deadlines_missed;
+  uint32_t jitter_count;
+  uint64_t jitter_total_us;
+  uint32_t jitter_max_us;
+} WOOTING_RGB_WRITER;
+
+static WOOTING_RGB_WRITER rgb_writer_array[WOOTING_MAX_RGB_DEVICES];
+static bool rgb_writers_initialised = false;
+
+// Target time between paced presents, 0 when pacing is off
+static wooting_atomic rgb_frame_interval_us = 0;
+// Headroom left on a device's measured rate, in percent, so pacing never
+// fills the USB pipe completely
+#define PACING_HEADROOM_PERCENT 125
 
 static uint8_t gammaFilter[256] = {
     0,   0,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
@@ -53,12 +152,141 @@ static uint8_t gammaFilter[256] = {
     215, 218, 220, 223, 225, 228, 231, 233, 236, 239, 241, 244, 247, 249, 252,
     255};
 
-static WOOTING_RGB_MATRIX rgb_buffer_matrix_array[WOOTING_MAX_RGB_DEVICES];
-static WOOTING_RGB_MATRIX *rgb_buffer_matrix;
+// The colour arrays the app writes to live inside v2 reports, so a v2 device
+// can be sent its colours straight from here
+static WOOTING_USB_V2_REPORT rgb_report_array[WOOTING_MAX_RGB_DEVICES];
+static bool rgb_reports_initialised = false;
+static WOOTING_RGB_CHANGES rgb_changes_array[WOOTING_MAX_RGB_DEVICES];
+// Layers drawn over each colour array, see wooting_rgb_layer_set_single
+static WOOTING_RGB_LAYER_STACK rgb_layer_stack_array[WOOTING_MAX_RGB_DEVICES];
+
+// The colour state of a device. The handle API hands these out, the global
+// API works on the one of the selected device. Nothing in here is shared with
+// other devices, so different devices can be driven from different threads
+struct wooting_device {
+  uint8_t index;
+  // Handed out by wooting_device_open and not closed since
+  bool open;
+  WOOTING_RGB_MATRIX *matrix;
+  WOOTING_RGB_CHANGES *changes;
+  WOOTING_RGB_LAYER_STACK *layers;
+};
+
+static wooting_device rgb_device_array[WOOTING_MAX_RGB_DEVICES];
+static wooting_device *rgb_selected;
+
+// Estimated time in microseconds to send a full frame or a single key to a
+// device. Seeded from the defaults below and refined with every send
+typedef struct WOOTING_RGB_COST_MODEL {
+  uint32_t frame_us;
+  uint32_t key_us;
+  bool frame_measured;
+  bool key_measured;
+} WOOTING_RGB_COST_MODEL;
+
+// Per report and per key round-trip estimates for the different packet
+// modes. A single key is a feature report followed by reading the full
+// response, which takes several USB frames
+#define COST_V1_REPORT_US 3000
+#define COST_V1_KEY_US 3000
+#define COST_V2_REPORT_US 4000
+#define COST_V2_SMALL_PACKET_US 1000
+#define COST_V2_KEY_US 4000
+
+// Where the colour of a key ends up in the v1 buffers. The red channel is at
+// offset, green and blue follow 0x10 and 0x20 further
+typedef struct WOOTING_RGB_V1_PLAN_ENTRY {
+  // row * WOOTING_RGB_COLS + column
+  uint8_t key;
+  // Into WOOTING_RGB_V1_BUFFERS as a flat array
+  uint16_t offset;
+} WOOTING_RGB_V1_PLAN_ENTRY;
+
+// Every LED a v1 device has, in the order they are encoded. The ANSI keys that
+// also drive their ISO counterpart get an entry for both
+typedef struct WOOTING_RGB_V1_PLAN {
+  bool built;
+  uint8_t count;
+  WOOTING_RGB_V1_PLAN_ENTRY entries[WOOTING_RGB_ROWS * WOOTING_RGB_COLS + 2];
+} WOOTING_RGB_V1_PLAN;
+
+typedef struct WOOTING_RGB_DEVICE_STATE {
+  // Whether the device currently shows last_frame, only then can unchanged
+  // frames be skipped and changes be sent per key
+  bool frame_sent;
+  // Whether rgb_v1_buffer_array holds what the device's LED drivers contain
+  bool v1_parts_sent;
+  WOOTING_RGB_MATRIX last_frame;
+  WOOTING_RGB_COST_MODEL cost;
+  // Worked out on the first v1 frame after connecting
+  WOOTING_RGB_V1_PLAN v1_plan;
+} WOOTING_RGB_DEVICE_STATE;
+
+static WOOTING_RGB_DEVICE_STATE rgb_device_state_array[WOOTING_MAX_RGB_DEVICES];
+
+// Colour correction of a device, see wooting_rgb_array_correction. The app
+// changes the settings, the thread sending to the device rebuilds its table
+// once it sees a new version. Kept apart from the state above as corrections
+// survive reconnects
+typedef struct WOOTING_RGB_CORRECTION_STATE {
+  wooting_mutex lock;
+  // Guarded by lock
+  WOOTING_RGB_CORRECTION settings;
+  wooting_atomic version;
+
+  // Only used by the thread sending to the device
+  uint32_t *table;
+  int32_t table_version;
+  bool table_v1;
+  // Whether colours go through the table, not when it would change nothing
+  bool active;
+} WOOTING_RGB_CORRECTION_STATE;
+
+static WOOTING_RGB_CORRECTION_STATE
+    rgb_correction_array[WOOTING_MAX_RGB_DEVICES];
+
+// Recording of everything sent, see wooting_rgb_record_start. Whether a
+// recording is running is checked without the lock, so updates don't take it
+// when nothing is recorded
+static WOOTING_RECORDER rgb_recorder;
+static wooting_atomic rgb_recording = 0;
+static wooting_mutex rgb_record_lock;
+static bool rgb_record_lock_initialised = false;
+
+struct wooting_replay {
+  WOOTING_PLAYER player;
+};
+
+static const WOOTING_RGB_CORRECTION rgb_default_correction = {
+    .gamma = 0,
+    .brightness = 255,
+    .white_red = 255,
+    .white_green = 255,
+    .white_blue = 255};
+
+// Atomic counterpart of WOOTING_RGB_WRITE_STATS, as the writers update it
+// while the app may be reading it
+typedef struct WOOTING_RGB_WRITE_COUNTERS {
+  wooting_atomic frames_sent;
+  wooting_atomic frames_elided;
+  wooting_atomic reports_sent;
+  wooting_atomic reports_elided;
+  wooting_atomic keys_sent;
+  wooting_atomic frames_submitted;
+  wooting_atomic frames_replaced;
+} WOOTING_RGB_WRITE_COUNTERS;
+
+// Kept apart from the state above as they survive reconnects
+static WOOTING_RGB_WRITE_COUNTERS
+    rgb_write_stats_array[WOOTING_MAX_RGB_DEVICES];
+
+// One bit for each column of the colour array
+#define KEY_MASK_ROW ((1u << WOOTING_RGB_COLS) - 1)
 
 // Converts the array index to a memory location in the RGB buffers
-static uint8_t get_safe_led_idex(uint8_t row, uint8_t column) {
-  const uint8_t rgb_led_index[WOOTING_RGB_ROWS][WOOTING_RGB_COLS] = {
+static uint8_t get_safe_led_idex(const WOOTING_USB_META *meta, uint8_t row,
+                                 uint8_t column) {
+  static const uint8_t rgb_led_index[WOOTING_RGB_ROWS][WOOTING_RGB_COLS] = {
       {0,  NOLED, 11, 12, 23, 24, 36,  47,  85,  84, 49,
        48, 59,    61, 73, 81, 80, 113, 114, 115, 116},
       {2,  1,  14, 13, 26, 25, 35, 38, 37, 87, 86,
@@ -72,7 +300,6 @@ static uint8_t get_safe_led_idex(uint8_t row, uint8_t column) {
       {10, 22, 21, NOLED, NOLED, NOLED, 33,    NOLED, NOLED, NOLED, 94,
        58, 67, 68, 70,    79,    82,    NOLED, 111,   112,   NOLED}};
 
-  WOOTING_USB_META *meta = wooting_usb_get_meta();
   if (row < meta->max_rows && column < meta->max_columns) {
     return rgb_led_index[row][column];
   } else {
@@ -97,279 +324,1925 @@ static inline void decodeColor(uint16_t color, uint8_t *red, uint8_t *green,
   *blue = (color << 3) & 0xf8;
 }
 
-bool wooting_rgb_kbd_connected() { return wooting_usb_find_keyboard(); }
+static void wooting_rgb_encode_v1_buffers(uint8_t device_index,
+                                          const WOOTING_RGB_MATRIX matrix,
+                                          const uint32_t *correction,
+                                          WOOTING_RGB_V1_BUFFERS buffers);
 
-void wooting_rgb_set_disconnected_cb(void_cb cb) {
-  wooting_usb_set_disconnected_cb(cb);
-}
+// The correction table to send the colours of a device through, NULL when
+// they are sent as they are. The table is rebuilt here when the correction
+// changed, changed is then set as every key has to be sent again.
+static const uint32_t *wooting_rgb_correction_table(
+    uint8_t device_index, const WOOTING_USB_META *meta, bool *changed) {
+  WOOTING_RGB_CORRECTION_STATE *state = &rgb_correction_array[device_index];
+  bool v1 = !meta->v2_interface;
+  *changed = false;
+  if (wooting_atomic_load(&state->version) == state->table_version &&
+      v1 == state->table_v1) {
+    return state->active ? state->table : NULL;
+  }
 
-bool wooting_rgb_reset_rgb() {
-  return wooting_usb_send_feature(WOOTING_RESET_ALL_COMMAND, 0, 0, 0, 0);
+  wooting_mutex_lock(&state->lock);
+  WOOTING_RGB_CORRECTION settings = state->settings;
+  state->table_version = wooting_atomic_load(&state->version);
+  wooting_mutex_unlock(&state->lock);
+
+  state->table_v1 = v1;
+  state->active = v1 || !wooting_rgb_correction_is_identity(&settings);
+  if (state->active && !state->table) {
+    state->table = (uint32_t *)malloc(sizeof(WOOTING_RGB_CORRECTION_TABLE));
+  }
+  if (!state->table) {
+    // Without memory for the table colours are sent as they are, with the
+    // v1 curve applied by the encoder
+    state->active = false;
+  }
+
+  if (state->active) {
+    uint64_t trace = wooting_trace_begin();
+    wooting_rgb_correction_build(state->table, &settings,
+                                 v1 ? gammaFilter : NULL);
+    wooting_trace_end(trace, "build_correction", device_index, v1);
+  }
+  *changed = true;
+  return state->active ? state->table : NULL;
 }
 
-bool wooting_rgb_close() {
-  bool result = false;
+// Sends a full frame to the given device, without touching the selected
+// device. v1 parts that are unchanged since the last send are skipped unless
+// resend_all is set.
+static bool wooting_rgb_send_frame(uint8_t device_index,
+                                   WOOTING_USB_V2_REPORT *frame,
+                                   const uint32_t *correction,
+                                   bool resend_all) {
+  const WOOTING_USB_META *meta = wooting_usb_get_device_meta(device_index);
+  if (!meta) {
+    return false;
+  }
 
-  for (uint8_t i = 0; i < wooting_usb_device_count(); i++) {
-    if (wooting_usb_select_device(i)) {
-      result |= wooting_rgb_reset_rgb();
+  WOOTING_RGB_WRITE_COUNTERS *stats = &rgb_write_stats_array[device_index];
+
+  if (meta->v2_interface) {
+    WOOTING_USB_V2_REPORT corrected;
+    if (correction) {
+      corrected = *frame;
+      wooting_rgb_correction_apply(correction,
+                                   (const uint16_t(*)[WOOTING_RGB_COLS])
+                                       frame->matrix,
+                                   corrected.matrix);
+      frame = &corrected;
+    }
+
+    if (!wooting_usb_device_send_report_v2(device_index, frame)) {
+      return false;
     }
+    wooting_atomic_add(&stats->reports_sent, 1);
+    return true;
   }
 
-  // The disconnect call disconnects all devices, so we do it after we've
-  // attempted to reset rgb on all of them
-  wooting_usb_disconnect(false);
+  WOOTING_RGB_DEVICE_STATE *state = &rgb_device_state_array[device_index];
+  uint8_t(*sent)[RGB_RAW_BUFFER_SIZE] = rgb_v1_buffer_array[device_index];
+  WOOTING_RGB_V1_BUFFERS buffers;
+  // The encoder only writes the LEDs the device has, so start from what was
+  // sent before to keep the comparison below meaningful
+  memcpy(buffers, sent, sizeof(buffers));
+  uint64_t trace = wooting_trace_begin();
+  wooting_rgb_encode_v1_buffers(
+      device_index, (const uint16_t(*)[WOOTING_RGB_COLS])frame->matrix,
+      correction, buffers);
+  wooting_trace_end(trace, "build_v1_buffers", device_index, 0);
 
-  return result;
+  if (!state->v1_parts_sent) {
+    resend_all = true;
+  }
+
+  // The Wooting One doesn't have the last part
+  RGB_PARTS last_part = meta->device_type == DEVICE_KEYBOARD ? PART4 : PART3;
+  for (uint8_t part = PART0; part <= last_part; part++) {
+    if (!resend_all &&
+        memcmp(buffers[part], sent[part], RGB_RAW_BUFFER_SIZE) == 0) {
+      wooting_atomic_add(&stats->reports_elided, 1);
+      continue;
+    }
+
+    if (!wooting_usb_device_send_buffer_v1(device_index, (RGB_PARTS)part,
+                                           buffers[part])) {
+      state->v1_parts_sent = false;
+      return false;
+    }
+
+    memcpy(sent[part], buffers[part], RGB_RAW_BUFFER_SIZE);
+    wooting_atomic_add(&stats->reports_sent, 1);
+  }
+
+  state->v1_parts_sent = true;
+  return true;
 }
 
-bool wooting_rgb_reset() { return wooting_rgb_close(); }
+static void wooting_rgb_seed_cost_model(uint8_t device_index,
+                                        const WOOTING_USB_META *meta,
+                                        WOOTING_RGB_COST_MODEL *cost) {
+  if (!meta->v2_interface) {
+    uint8_t parts = meta->device_type == DEVICE_KEYBOARD ? PART4 + 1 : PART4;
+    cost->frame_us = parts * COST_V1_REPORT_US;
+    cost->key_us = COST_V1_KEY_US;
+  } else if (wooting_usb_device_small_packets(device_index)) {
+    cost->frame_us = 4 * COST_V2_SMALL_PACKET_US;
+    cost->key_us = COST_V2_KEY_US;
+  } else {
+    cost->frame_us = COST_V2_REPORT_US;
+    cost->key_us = COST_V2_KEY_US;
+  }
+}
 
-bool wooting_rgb_direct_set_key(uint8_t row, uint8_t column, uint8_t red,
-                                uint8_t green, uint8_t blue) {
-  // We don't need to call this here as the wooting_usb_send_feature calls will
-  // perform the check again and there's no need to run this multiple times,
-  // especially when each call will attempt to ensure connection is still
-  // available if (!wooting_rgb_kbd_connected()) { 	return false;
-  // }
-  if (wooting_usb_use_v2_interface()) {
-    KeyboardMatrixID id = {.row = row, .column = column};
-    return wooting_usb_send_feature(WOOTING_SINGLE_COLOR_COMMAND,
-                                    *(uint8_t *)&id, red, green, blue);
+// The first measurement replaces the seeded estimate, after that an
+// exponential moving average follows the measured cost
+static void wooting_rgb_update_cost(uint32_t *estimate, bool *measured,
+                                    uint64_t measured_us) {
+  if (*measured) {
+    *estimate = (uint32_t)((*estimate * 7 + measured_us) / 8);
   } else {
-    uint8_t keyCode = get_safe_led_idex(row, column);
+    *estimate = (uint32_t)measured_us;
+    *measured = true;
+  }
+}
 
-    if (keyCode == NOLED || keyCode > wooting_usb_get_meta()->led_index_max) {
-      return false;
-    } else if (keyCode == LED_LEFT_SHIFT_ANSI) {
-      bool update_ansi = wooting_usb_send_feature(
-          WOOTING_SINGLE_COLOR_COMMAND, LED_LEFT_SHIFT_ANSI, red, green, blue);
-      bool update_iso = wooting_usb_send_feature(
-          WOOTING_SINGLE_COLOR_COMMAND, LED_LEFT_SHIFT_ISO, red, green, blue);
-
-      return update_ansi && update_iso;
-    } else if (keyCode == LED_ENTER_ANSI) {
-      bool update_ansi = wooting_usb_send_feature(
-          WOOTING_SINGLE_COLOR_COMMAND, LED_ENTER_ANSI, red, green, blue);
-      bool update_iso = wooting_usb_send_feature(
-          WOOTING_SINGLE_COLOR_COMMAND, LED_ENTER_ISO, red, green, blue);
-
-      return update_ansi && update_iso;
-    } else {
-      return wooting_usb_send_feature(WOOTING_SINGLE_COLOR_COMMAND, keyCode,
-                                      red, green, blue);
+static uint8_t wooting_rgb_count_keys(const WOOTING_RGB_KEY_MASK mask) {
+  uint8_t count = 0;
+  for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+    for (uint32_t bits = mask[row]; bits; bits &= bits - 1) {
+      count++;
     }
   }
+  return count;
 }
 
-bool wooting_rgb_direct_reset_key(uint8_t row, uint8_t column) {
-  if (!wooting_rgb_kbd_connected()) {
-    return false;
+// LEDs a key lights up: its matrix ID on v2 devices, on v1 devices its LED and
+// for the keys that sit somewhere else on ISO boards the ISO one as well.
+// Returns how many, 0 for keys without an LED
+static uint8_t wooting_rgb_key_leds(const WOOTING_USB_META *meta, uint8_t row,
+                                    uint8_t column, uint8_t leds[2]) {
+  if (meta->v2_interface) {
+    KeyboardMatrixID id = {.row = row, .column = column};
+    leds[0] = *(uint8_t *)&id;
+    return 1;
   }
 
-  if (wooting_usb_use_v2_interface()) {
-    KeyboardMatrixID id = {.row = row, .column = column};
-    return wooting_usb_send_feature(WOOTING_SINGLE_RESET_COMMAND, 0, 0, 0,
-                                    *(uint8_t *)&id);
-  } else {
-    uint8_t keyCode = get_safe_led_idex(row, column);
+  uint8_t keyCode = get_safe_led_idex(meta, row, column);
+  if (keyCode == NOLED || keyCode > meta->led_index_max) {
+    return 0;
+  }
 
-    if (keyCode == NOLED || keyCode > wooting_usb_get_meta()->led_index_max) {
-      return false;
-    } else if (keyCode == LED_LEFT_SHIFT_ANSI) {
-      bool update_ansi = wooting_usb_send_feature(WOOTING_SINGLE_RESET_COMMAND,
-                                                  0, 0, 0, LED_LEFT_SHIFT_ANSI);
-      bool update_iso = wooting_usb_send_feature(WOOTING_SINGLE_RESET_COMMAND,
-                                                 0, 0, 0, LED_LEFT_SHIFT_ISO);
-
-      return update_ansi && update_iso;
-    } else if (keyCode == LED_ENTER_ANSI) {
-      bool update_ansi = wooting_usb_send_feature(WOOTING_SINGLE_RESET_COMMAND,
-                                                  0, 0, 0, LED_ENTER_ANSI);
-      bool update_iso = wooting_usb_send_feature(WOOTING_SINGLE_RESET_COMMAND,
-                                                 0, 0, 0, LED_ENTER_ISO);
-
-      return update_ansi && update_iso;
+  leds[0] = keyCode;
+  if (keyCode == LED_LEFT_SHIFT_ANSI) {
+    leds[1] = LED_LEFT_SHIFT_ISO;
+    return 2;
+  } else if (keyCode == LED_ENTER_ANSI) {
+    leds[1] = LED_ENTER_ISO;
+    return 2;
+  }
+  return 1;
+}
+
+// Sends a single key command to every LED of a key, colour is NULL for a
+// reset. Returns false for keys without an LED
+static bool wooting_rgb_key_command(uint8_t device_index,
+                                    const WOOTING_USB_META *meta,
+                                    uint8_t command, uint8_t row,
+                                    uint8_t column, const uint8_t *colour) {
+  uint8_t leds[2];
+  uint8_t count = wooting_rgb_key_leds(meta, row, column, leds);
+  bool result = count > 0;
+  for (uint8_t i = 0; i < count; i++) {
+    // The colour command takes the LED first, the reset command last
+    if (colour) {
+      result &= wooting_usb_device_send_feature(device_index, command, leds[i],
+                                                colour[0], colour[1],
+                                                colour[2]);
     } else {
-      return wooting_usb_send_feature(WOOTING_SINGLE_RESET_COMMAND, 0, 0, 0,
-                                      keyCode);
+      result &= wooting_usb_device_send_feature(device_index, command, 0, 0, 0,
+                                                leds[i]);
     }
   }
+  return result;
 }
 
-void wooting_rgb_array_auto_update(bool auto_update) {
-  wooting_rgb_auto_update = auto_update;
+static bool wooting_rgb_device_set_key(uint8_t device_index,
+                                       const WOOTING_USB_META *meta,
+                                       uint8_t row, uint8_t column,
+                                       uint8_t red, uint8_t green,
+                                       uint8_t blue) {
+  return wooting_rgb_key_command(device_index, meta,
+                                 WOOTING_SINGLE_COLOR_COMMAND, row, column,
+                                 (const uint8_t[]){red, green, blue});
 }
 
-bool wooting_rgb_array_update_keyboard() {
-  if (!wooting_rgb_kbd_connected()) {
+static bool wooting_rgb_device_reset_key(uint8_t device_index,
+                                         const WOOTING_USB_META *meta,
+                                         uint8_t row, uint8_t column) {
+  return wooting_rgb_key_command(device_index, meta,
+                                 WOOTING_SINGLE_RESET_COMMAND, row, column,
+                                 NULL);
+}
+
+static bool wooting_rgb_send_key(uint8_t device_index,
+                                 const WOOTING_USB_META *meta, uint8_t row,
+                                 uint8_t column, uint16_t color,
+                                 const uint32_t *correction) {
+  uint8_t red, green, blue;
+  if (correction) {
+    red = (uint8_t)(correction[color] >> 16);
+    green = (uint8_t)(correction[color] >> 8);
+    blue = (uint8_t)correction[color];
+  } else {
+    decodeColor(color, &red, &green, &blue);
+  }
+
+  // Keys without an LED are in the frame too, there's just nothing to send
+  uint8_t leds[2];
+  if (!wooting_rgb_key_leds(meta, row, column, leds)) {
+    return true;
+  }
+  return wooting_rgb_device_set_key(device_index, meta, row, column, red,
+                                    green, blue);
+}
+
+// Sends a frame to a device. Keys that match the last sent frame aren't sent
+// again, so an unchanged frame causes no writes at all. Otherwise either a full
+// frame or, when only a few keys changed, single key updates are sent,
+// whichever is cheaper according to the device's cost model.
+static bool wooting_rgb_present(uint8_t device_index,
+                                WOOTING_USB_V2_REPORT *frame,
+                                const WOOTING_RGB_CHANGES *changes) {
+  const WOOTING_USB_META *meta = wooting_usb_get_device_meta(device_index);
+  if (!meta) {
     return false;
   }
 
-  if (wooting_usb_use_v2_interface()) {
-    if (!wooting_usb_send_buffer_v2(*rgb_buffer_matrix)) {
-      return false;
+  const uint16_t(*matrix)[WOOTING_RGB_COLS] =
+      (const uint16_t(*)[WOOTING_RGB_COLS])frame->matrix;
+
+  WOOTING_RGB_DEVICE_STATE *state = &rgb_device_state_array[device_index];
+  WOOTING_RGB_WRITE_COUNTERS *stats = &rgb_write_stats_array[device_index];
+  if (state->cost.frame_us == 0) {
+    wooting_rgb_seed_cost_model(device_index, meta, &state->cost);
+  }
+
+  bool correction_changed;
+  const uint32_t *correction =
+      wooting_rgb_correction_table(device_index, meta, &correction_changed);
+
+  // Narrow the changed keys down to the ones that differ from what the device
+  // shows. A key that was changed and changed back doesn't need sending
+  WOOTING_RGB_KEY_MASK send_mask;
+  bool any_stale = false;
+  for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+    uint32_t stale = correction_changed ? KEY_MASK_ROW : changes->stale[row];
+    send_mask[row] = stale;
+    any_stale |= stale != 0;
+
+    uint32_t dirty = changes->dirty[row] & ~stale;
+    for (uint8_t column = 0; dirty; column++, dirty >>= 1) {
+      if ((dirty & 1) &&
+          matrix[row][column] != state->last_frame[row][column]) {
+        send_mask[row] |= 1u << column;
+      }
+    }
+  }
+
+  uint8_t send_keys = wooting_rgb_count_keys(send_mask);
+  if (state->frame_sent && send_keys == 0) {
+    wooting_atomic_add(&stats->frames_elided, 1);
+    wooting_trace_instant("frame_elided", device_index, 0);
+    return true;
+  }
+
+  bool use_keys = wooting_rgb_delta_update && state->frame_sent &&
+                  (uint64_t)send_keys * state->cost.key_us <
+                      state->cost.frame_us;
+
+  uint64_t trace = wooting_trace_begin();
+  uint64_t start = wooting_platform_time_us();
+  bool result = true;
+
+  if (use_keys) {
+    for (uint8_t row = 0; row < WOOTING_RGB_ROWS && result; row++) {
+      for (uint8_t column = 0; column < WOOTING_RGB_COLS && result;
+           column++) {
+        if (send_mask[row] & (1u << column)) {
+          result = wooting_rgb_send_key(device_index, meta, row, column,
+                                        matrix[row][column], correction);
+        }
+      }
+    }
+
+    if (result) {
+      wooting_rgb_update_cost(&state->cost.key_us, &state->cost.key_measured,
+                              (wooting_platform_time_us() - start) /
+                                  send_keys);
+      wooting_atomic_add(&stats->keys_sent, send_keys);
     }
+
+    // The single key commands bypass the LED driver buffers we keep
+    state->v1_parts_sent = false;
   } else {
-    if (!wooting_rgb_build_v1_buffers())
-      return false;
+    result = wooting_rgb_send_frame(device_index, frame, correction,
+                                    !state->frame_sent || any_stale);
 
-    if (!wooting_usb_send_buffer_v1(PART0, rgb_buffer0)) {
-      return false;
+    if (result) {
+      wooting_rgb_update_cost(&state->cost.frame_us,
+                              &state->cost.frame_measured,
+                              wooting_platform_time_us() - start);
+      wooting_atomic_add(&stats->frames_sent, 1);
     }
+  }
 
-    if (!wooting_usb_send_buffer_v1(PART1, rgb_buffer1)) {
-      return false;
+  wooting_trace_end(trace, use_keys ? "send_keys" : "send_frame", device_index,
+                    use_keys ? send_keys : result);
+
+  // After a failure we don't know what the device shows anymore
+  state->frame_sent = result;
+  if (result) {
+    memcpy(state->last_frame, matrix, sizeof(state->last_frame));
+  }
+  return result;
+}
+
+void wooting_rgb_reset_device_state(void) {
+  memset(rgb_device_state_array, 0, sizeof(rgb_device_state_array));
+  // After a disconnect an index can end up belonging to another keyboard
+  for (uint8_t i = 0; i < WOOTING_MAX_RGB_DEVICES; i++) {
+    rgb_device_array[i].open = false;
+  }
+}
+
+void wooting_rgb_invalidate_device(uint8_t device_index) {
+  if (device_index < WOOTING_MAX_RGB_DEVICES) {
+    rgb_device_state_array[device_index].frame_sent = false;
+    rgb_device_state_array[device_index].v1_parts_sent = false;
+  }
+}
+
+// Time between presents of a paced writer: the requested rate, slowed down
+// to what the device has been measured to keep up with. Must be called with
+// the writer lock held
+static uint32_t wooting_rgb_writer_interval(const WOOTING_RGB_WRITER *writer) {
+  uint32_t interval = (uint32_t)wooting_atomic_load(&rgb_frame_interval_us);
+  // A synchronous update doesn't wait for a tick
+  if (!interval || !wooting_rgb_async_update) {
+    return 0;
+  }
+
+  uint32_t capacity = writer->present_us * PACING_HEADROOM_PERCENT / 100;
+  return capacity > interval ? capacity : interval;
+}
+
+static bool wooting_rgb_writer_has_frame(WOOTING_RGB_WRITER *writer) {
+  return wooting_atomic_load(&writer->ready) & WRITER_FRAME_FRESH;
+}
+
+static void wooting_rgb_writer_thread(void *arg) {
+  WOOTING_RGB_WRITER *writer = (WOOTING_RGB_WRITER *)arg;
+
+  wooting_mutex_lock(&writer->lock);
+  while (true) {
+    // Announced before looking, so a commit either is seen here or sees this
+    // and signals
+    wooting_atomic_store(&writer->waiting, 1);
+    while (!wooting_rgb_writer_has_frame(writer) && !writer->stop) {
+      wooting_cond_wait(&writer->cond, &writer->lock);
     }
+    wooting_atomic_store(&writer->waiting, 0);
 
-    if (!wooting_usb_send_buffer_v1(PART2, rgb_buffer2)) {
-      return false;
+    // A pending frame is still flushed when asked to stop
+    if (!wooting_rgb_writer_has_frame(writer)) {
+      break;
     }
 
-    if (!wooting_usb_send_buffer_v1(PART3, rgb_buffer3)) {
-      return false;
+    // With pacing on, a frame waits for its tick. Frames submitted in the
+    // meantime replace it, so the tick gets the newest one
+    uint32_t interval = wooting_rgb_writer_interval(writer);
+    uint64_t start = wooting_platform_time_us();
+    uint64_t tick = start;
+    if (interval && start < writer->next_present_us) {
+      tick = writer->next_present_us;
+      wooting_mutex_unlock(&writer->lock);
+      wooting_platform_sleep_us(tick - start);
+      wooting_mutex_lock(&writer->lock);
+      start = wooting_platform_time_us();
+
+      uint32_t jitter = (uint32_t)(start - tick);
+      writer->jitter_count++;
+      writer->jitter_total_us += jitter;
+      if (jitter > writer->jitter_max_us) {
+        writer->jitter_max_us = jitter;
+      }
     }
 
-    if (wooting_usb_get_meta()->device_type == DEVICE_KEYBOARD) {
-      if (!wooting_usb_send_buffer_v1(PART4, rgb_buffer4)) {
-        return false;
+    // Take the newest frame, the one that was sent goes back to the ready
+    // slot for a commit to draw into
+    writer->front = (uint8_t)(wooting_atomic_exchange(&writer->ready,
+                                                      writer->front) &
+                              WRITER_FRAME_INDEX);
+    WOOTING_RGB_WRITER_FRAME *frame = &writer->frames[writer->front];
+    wooting_mutex_unlock(&writer->lock);
+
+    uint32_t elided = (uint32_t)wooting_atomic_load(
+        &rgb_write_stats_array[writer->device_index].frames_elided);
+    bool result = wooting_rgb_present(writer->device_index, &frame->report,
+                                      &frame->changes);
+    uint64_t end = wooting_platform_time_us();
+
+    wooting_mutex_lock(&writer->lock);
+    writer->frames_presented++;
+    writer->presented = frame->sequence;
+    wooting_cond_broadcast(&writer->presented_cond);
+    // Only frames that were actually sent say something about the device
+    if (result &&
+        elided == (uint32_t)wooting_atomic_load(
+                      &rgb_write_stats_array[writer->device_index]
+                           .frames_elided)) {
+      uint32_t measured = (uint32_t)(end - start);
+      writer->present_us = writer->present_us
+                               ? (writer->present_us * 7 + measured) / 8
+                               : measured;
+    }
+    if (interval) {
+      writer->next_present_us = tick + interval;
+      // A frame that was already waiting when its tick passed missed it
+      if (end > writer->next_present_us &&
+          wooting_rgb_writer_has_frame(writer)) {
+        writer->deadlines_missed +=
+            1 + (uint32_t)((end - writer->next_present_us) / interval);
+        writer->next_present_us = end;
       }
     }
+    if (!result) {
+      // The device has been dropped, the app thread picks this up on the next
+      // update. Later frames are still handed to the device, which is how it
+      // gets reopened
+      wooting_atomic_store(&writer->failed, 1);
+    }
   }
-  return true;
+  wooting_mutex_unlock(&writer->lock);
 }
 
-static bool wooting_rgb_array_change_single(uint8_t row, uint8_t column,
-                                            uint8_t red, uint8_t green,
-                                            uint8_t blue) {
-  uint16_t prevValue = (*rgb_buffer_matrix)[row][column];
-  uint16_t newValue = encodeColor(red, green, blue);
-  if (newValue != prevValue) {
-    (*rgb_buffer_matrix)[row][column] = newValue;
+static void wooting_rgb_writers_init(void) {
+  if (!rgb_writers_initialised) {
+    for (uint8_t i = 0; i < WOOTING_MAX_RGB_DEVICES; i++) {
+      wooting_mutex_init(&rgb_writer_array[i].lock);
+      wooting_cond_init(&rgb_writer_array[i].cond);
+      wooting_cond_init(&rgb_writer_array[i].presented_cond);
+      wooting_mutex_init(&rgb_writer_array[i].commit_lock);
+    }
+    rgb_writers_initialised = true;
   }
+}
 
-  return true;
+static bool wooting_rgb_writer_start(uint8_t device_index) {
+  wooting_rgb_writers_init();
+
+  WOOTING_RGB_WRITER *writer = &rgb_writer_array[device_index];
+  writer->device_index = device_index;
+  writer->stop = false;
+  wooting_atomic_store(&writer->failed, 0);
+  wooting_atomic_store(&writer->waiting, 0);
+  for (uint8_t i = 0; i < 3; i++) {
+    wooting_usb_v2_report_init(&writer->frames[i].report);
+    writer->frames[i].sequence = 0;
+  }
+  writer->presented = 0;
+  writer->committed = 0;
+  writer->back = 0;
+  wooting_atomic_store(&writer->ready, 1);
+  writer->front = 2;
+  memset(&writer->carry, 0, sizeof(writer->carry));
+  writer->next_present_us = 0;
+  writer->running = wooting_thread_create(
+      &writer->thread, wooting_rgb_writer_thread, writer);
+  return writer->running;
 }
 
-bool wooting_rgb_array_set_single(uint8_t row, uint8_t column, uint8_t red,
-                                  uint8_t green, uint8_t blue) {
-  // We just check to see if we believe the keyboard to be connected here as
-  // this call may just be updating the array and not actually communicating
-  // with the keyboard If auto update is on then the update_keyboard method will
-  // ping the keyboard before communicating with the keyboard
-  if (!wooting_usb_get_meta()->connected) {
-    return false;
+static void wooting_rgb_writer_stop(uint8_t device_index) {
+  WOOTING_RGB_WRITER *writer = &rgb_writer_array[device_index];
+  if (!writer->running) {
+    return;
+  }
+
+  wooting_mutex_lock(&writer->lock);
+  writer->stop = true;
+  wooting_cond_signal(&writer->cond);
+  wooting_mutex_unlock(&writer->lock);
+
+  wooting_thread_join(writer->thread);
+  writer->running = false;
+}
+
+void wooting_rgb_async_stop(void) {
+  // The effects engine queues frames on the writers
+  wooting_rgb_effect_stop();
+
+  for (uint8_t i = 0; i < WOOTING_MAX_RGB_DEVICES; i++) {
+    wooting_rgb_writer_stop(i);
+  }
+}
+
+static void wooting_rgb_record_frame(uint8_t device_index,
+                                     const WOOTING_RGB_MATRIX frame) {
+  if (!wooting_atomic_load(&rgb_recording)) {
+    return;
+  }
+
+  wooting_mutex_lock(&rgb_record_lock);
+  // The recording may have been stopped while waiting for the lock
+  if (rgb_recorder.file) {
+    wooting_recorder_frame(&rgb_recorder, wooting_platform_time_us(),
+                           device_index, frame);
+  }
+  wooting_mutex_unlock(&rgb_record_lock);
+}
+
+static void wooting_rgb_record_command(uint8_t device_index,
+                                       WOOTING_RECORD_TYPE type,
+                                       const uint8_t *data, uint16_t length) {
+  if (!wooting_atomic_load(&rgb_recording)) {
+    return;
+  }
+
+  wooting_mutex_lock(&rgb_record_lock);
+  if (rgb_recorder.file) {
+    wooting_recorder_command(&rgb_recorder, wooting_platform_time_us(),
+                             device_index, type, data, length);
   }
+  wooting_mutex_unlock(&rgb_record_lock);
+}
 
-  if (!wooting_rgb_array_change_single(row, column, red, green, blue)) {
+bool wooting_rgb_record_start(const char *path) {
+  if (!path) {
     return false;
   }
 
-  if (wooting_rgb_auto_update) {
-    return wooting_rgb_array_update_keyboard();
-  } else {
-    return true;
+  if (!rgb_record_lock_initialised) {
+    wooting_mutex_init(&rgb_record_lock);
+    rgb_record_lock_initialised = true;
+  }
+
+  wooting_mutex_lock(&rgb_record_lock);
+  bool result = !rgb_recorder.file &&
+                wooting_recorder_open(&rgb_recorder, path,
+                                      wooting_platform_time_us());
+  if (result) {
+    wooting_atomic_store(&rgb_recording, 1);
   }
+  wooting_mutex_unlock(&rgb_record_lock);
+  return result;
 }
 
-bool wooting_rgb_array_set_full(const uint8_t *colors_buffer) {
-  // Just need to check if we believe it is connected, the update_keyboard call
-  // will ping the keyboard if it is necessary
-  if (!wooting_usb_get_meta()->connected) {
+bool wooting_rgb_record_stop(void) {
+  if (!rgb_record_lock_initialised) {
     return false;
   }
 
-  const uint8_t columns = wooting_usb_get_meta()->max_columns;
+  wooting_mutex_lock(&rgb_record_lock);
+  wooting_atomic_store(&rgb_recording, 0);
+  bool result = wooting_recorder_close(&rgb_recorder);
+  wooting_mutex_unlock(&rgb_record_lock);
+  return result;
+}
+
+// The frame to send to a device: its colour array or, once layers are drawn
+// on, the colour array with the layers blended onto it. The dirty keys of
+// changes are widened to the keys the layers changed
+static WOOTING_USB_V2_REPORT *
+wooting_rgb_compose(uint8_t device_index, WOOTING_RGB_CHANGES *changes) {
+  WOOTING_RGB_LAYER_STACK *stack = &rgb_layer_stack_array[device_index];
+  if (!stack->used) {
+    return &rgb_report_array[device_index];
+  }
 
-  for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
-    const uint8_t *color = colors_buffer + row * WOOTING_RGB_COLS * 3;
-    for (uint8_t col = 0; col < columns; col++) {
-      uint8_t red = color[0];
-      uint8_t green = color[1];
-      uint8_t blue = color[2];
+  uint64_t trace = wooting_trace_begin();
+  wooting_rgb_layers_compose(stack, rgb_report_array[device_index].matrix,
+                             changes->dirty);
+  wooting_trace_end(trace, "compose_layers", device_index, stack->used);
+  return &stack->output;
+}
 
-      wooting_rgb_array_change_single(row, col, red, green, blue);
+// Commits a frame to the running writer of a device. The changed keys are
+// added to the ones the writer still has to look at and cleared. sequence, if
+// given, is set to what wooting_rgb_writer_wait needs to wait for the frame
+static bool wooting_rgb_writer_queue(uint8_t device_index,
+                                     const WOOTING_RGB_MATRIX matrix,
+                                     WOOTING_RGB_CHANGES *changes,
+                                     uint32_t *sequence) {
+  WOOTING_RGB_WRITER *writer = &rgb_writer_array[device_index];
 
-      color += 3;
-    }
+  wooting_atomic_add(&rgb_write_stats_array[device_index].frames_submitted, 1);
+  wooting_mutex_lock(&writer->commit_lock);
+  WOOTING_RGB_WRITER_FRAME *back = &writer->frames[writer->back];
+  memcpy(back->report.matrix, matrix, sizeof(back->report.matrix));
+  for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+    back->changes.dirty[row] = changes->dirty[row] | writer->carry.dirty[row];
+    back->changes.stale[row] = changes->stale[row] | writer->carry.stale[row];
+  }
+  memset(changes, 0, sizeof(*changes));
+  back->sequence = ++writer->committed;
+  if (sequence) {
+    *sequence = back->sequence;
   }
 
-  if (wooting_rgb_auto_update) {
-    return wooting_rgb_array_update_keyboard();
+  int32_t replaced = wooting_atomic_exchange(
+      &writer->ready, writer->back | WRITER_FRAME_FRESH);
+  writer->back = (uint8_t)(replaced & WRITER_FRAME_INDEX);
+  if (replaced & WRITER_FRAME_FRESH) {
+    // The writer never got to the replaced frame, its keys still need sending
+    writer->carry = writer->frames[writer->back].changes;
+    wooting_atomic_add(&rgb_write_stats_array[device_index].frames_replaced, 1);
+    if (wooting_atomic_load(&rgb_frame_interval_us)) {
+      wooting_atomic_add(&writer->frames_dropped, 1);
+    }
   } else {
-    return true;
+    memset(&writer->carry, 0, sizeof(writer->carry));
   }
+  wooting_mutex_unlock(&writer->commit_lock);
+
+  // The writer only holds its lock briefly around waiting, never while
+  // sending, so waking it up doesn't wait for USB I/O
+  if (wooting_atomic_load(&writer->waiting)) {
+    wooting_mutex_lock(&writer->lock);
+    wooting_cond_signal(&writer->cond);
+    wooting_mutex_unlock(&writer->lock);
+  }
+
+  // Report a frame that failed since the last commit once
+  return !wooting_atomic_exchange(&writer->failed, 0);
 }
 
-bool wooting_rgb_build_v1_buffers() {
-  const uint8_t pwm_mem_map[48] = {
-      0x0,  0x1,  0x2,  0x3,  0x4,  0x5,  0x8,  0x9,  0xa,  0xb,  0xc,  0xd,
-      0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d,
-      0x60, 0x61, 0x62, 0x63, 0x64, 0x65, 0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d,
-      0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d};
+// Hands the current colour array of a device to its writer
+static bool wooting_rgb_writer_submit(uint8_t device_index,
+                                      uint32_t *sequence) {
+  WOOTING_RGB_WRITER *writer = &rgb_writer_array[device_index];
 
-  uint8_t *buffer_pointer;
+  if (!writer->running && !wooting_rgb_writer_start(device_index)) {
+    return false;
+  }
 
-  for (int row = 0; row < WOOTING_RGB_ROWS; row++) {
-    for (int column = 0; column < WOOTING_RGB_COLS; column++) {
-      uint8_t led_index = get_safe_led_idex(row, column);
+  WOOTING_RGB_CHANGES *changes = &rgb_changes_array[device_index];
+  WOOTING_USB_V2_REPORT *frame = wooting_rgb_compose(device_index, changes);
+  wooting_rgb_record_frame(device_index, frame->matrix);
+  return wooting_rgb_writer_queue(device_index, frame->matrix, changes,
+                                  sequence);
+}
 
-      // prevent assigning led's that don't exist
-      if (led_index > wooting_usb_get_meta()->led_index_max) {
-        continue;
-      }
-      if (led_index >= 96) {
-        buffer_pointer = rgb_buffer4;
-      } else if (led_index >= 72) {
-        buffer_pointer = rgb_buffer3;
-      } else if (led_index >= 48) {
-        buffer_pointer = rgb_buffer2;
-      } else if (led_index >= 24) {
-        buffer_pointer = rgb_buffer1;
-      } else {
-        buffer_pointer = rgb_buffer0;
-      }
+// Waits until the writer of a device presented the frame with the given
+// sequence, or a newer one that replaced it
+static bool wooting_rgb_writer_wait(uint8_t device_index, uint32_t sequence) {
+  WOOTING_RGB_WRITER *writer = &rgb_writer_array[device_index];
 
-      uint8_t buffer_index = pwm_mem_map[led_index % 24];
-      uint16_t key_colour = (*rgb_buffer_matrix)[row][column];
+  wooting_mutex_lock(&writer->lock);
+  while ((int32_t)(writer->presented - sequence) < 0) {
+    wooting_cond_wait(&writer->presented_cond, &writer->lock);
+  }
+  wooting_mutex_unlock(&writer->lock);
 
-      uint8_t red, green, blue;
-      decodeColor(key_colour, &red, &green, &blue);
+  return !wooting_atomic_exchange(&writer->failed, 0);
+}
 
-      buffer_pointer[buffer_index] = gammaFilter[red];
-      buffer_pointer[buffer_index + 0x10] = gammaFilter[green];
-      buffer_pointer[buffer_index + 0x20] = gammaFilter[blue];
+// Effects engine, see wooting_rgb_effect_start. The engine thread renders the
+// running effect and queues every frame on the writers of the devices that
+// were connected when it was started.
+typedef struct WOOTING_RGB_EFFECT_ENGINE {
+  bool running;
+  wooting_atomic stop;
+  wooting_thread thread;
+  wooting_mutex lock;
 
-      if (led_index == LED_ENTER_ANSI) {
-        uint8_t iso_enter_index = pwm_mem_map[LED_ENTER_ISO - 48];
-        rgb_buffer2[iso_enter_index] = rgb_buffer2[buffer_index];
-        rgb_buffer2[iso_enter_index + 0x10] = rgb_buffer2[buffer_index + 0x10];
-        rgb_buffer2[iso_enter_index + 0x20] = rgb_buffer2[buffer_index + 0x20];
-      } else if (led_index == LED_LEFT_SHIFT_ANSI) {
-        uint8_t iso_shift_index = pwm_mem_map[LED_LEFT_SHIFT_ISO];
-        rgb_buffer0[iso_shift_index] = rgb_buffer0[buffer_index];
-        rgb_buffer0[iso_shift_index + 0x10] = rgb_buffer0[buffer_index + 0x10];
-        rgb_buffer0[iso_shift_index + 0x20] = rgb_buffer0[buffer_index + 0x20];
+  // Set by the app thread, guarded by lock
+  WOOTING_RGB_EFFECT_STATE next;
+  bool changed;
+  uint64_t start_us;
+  uint8_t device_count;
+} WOOTING_RGB_EFFECT_ENGINE;
+
+static WOOTING_RGB_EFFECT_ENGINE rgb_effect_engine;
+static bool rgb_effect_engine_initialised = false;
+
+// Longest the engine sleeps before looking at its stop flag again, so slow
+// frame rates don't hold up wooting_rgb_effect_stop
+#define EFFECT_STOP_CHECK_US 10000
+
+static void wooting_rgb_effect_thread(void *arg) {
+  WOOTING_RGB_EFFECT_ENGINE *engine = (WOOTING_RGB_EFFECT_ENGINE *)arg;
+  WOOTING_RGB_EFFECT_STATE state;
+  WOOTING_RGB_MATRIX colours;
+  uint64_t next_frame_us = wooting_platform_time_us();
+
+  while (!wooting_atomic_load(&engine->stop)) {
+    wooting_mutex_lock(&engine->lock);
+    if (engine->changed) {
+      state = engine->next;
+      engine->changed = false;
+    }
+    uint64_t start_us = engine->start_us;
+    uint8_t device_count = engine->device_count;
+    wooting_mutex_unlock(&engine->lock);
+
+    uint64_t now = wooting_platform_time_us();
+    uint64_t trace = wooting_trace_begin();
+    wooting_rgb_effect_render(&state, (uint32_t)((now - start_us) / 1000),
+                              colours);
+    wooting_trace_end(trace, "effect_render", WOOTING_TRACE_NO_DEVICE,
+                      state.effect);
+
+    // Every key is looked at, the writer only sends the ones that differ from
+    // what the device shows
+    for (uint8_t i = 0; i < device_count; i++) {
+      WOOTING_RGB_CHANGES changes;
+      for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+        changes.dirty[row] = (1u << WOOTING_RGB_COLS) - 1;
+        changes.stale[row] = 0;
       }
+      wooting_rgb_writer_queue(i, colours, &changes, NULL);
     }
-  }
 
-  return true;
+    // A frame that is late moves the schedule instead of being caught up on
+    next_frame_us += 1000000 / state.params.frame_rate;
+    now = wooting_platform_time_us();
+    if (next_frame_us < now) {
+      next_frame_us = now;
+    }
+    while (now < next_frame_us && !wooting_atomic_load(&engine->stop)) {
+      uint64_t wait = next_frame_us - now;
+      wooting_platform_sleep_us(wait < EFFECT_STOP_CHECK_US
+                                    ? wait
+                                    : EFFECT_STOP_CHECK_US);
+      now = wooting_platform_time_us();
+    }
+  }
 }
 
-bool wooting_rgb_select_buffer(uint8_t buffer_index) {
-  // Fetch pointer and buffer data from arrays
-  rgb_buffer_matrix = &rgb_buffer_matrix_array[buffer_index];
+bool wooting_rgb_effect_start(WOOTING_RGB_EFFECT effect,
+                              const WOOTING_RGB_EFFECT_PARAMS *params) {
+  WOOTING_RGB_EFFECT_ENGINE *engine = &rgb_effect_engine;
+  WOOTING_RGB_EFFECT_STATE state;
 
-  return true;
-}
+  if (!wooting_rgb_effect_prepare(&state, effect, params) ||
+      !wooting_rgb_kbd_connected()) {
+    return false;
+  }
 
-const WOOTING_USB_META *wooting_rgb_device_info() {
-  if (!wooting_usb_get_meta()->connected)
-    wooting_usb_find_keyboard();
-  return wooting_usb_get_meta();
+  // Frames reach the devices through their writers, which are started here so
+  // the engine thread never has to
+  uint8_t device_count = wooting_usb_device_count();
+  for (uint8_t i = 0; i < device_count; i++) {
+    if (!rgb_writer_array[i].running && !wooting_rgb_writer_start(i)) {
+      return false;
+    }
+  }
+
+  if (!rgb_effect_engine_initialised) {
+    wooting_mutex_init(&engine->lock);
+    rgb_effect_engine_initialised = true;
+  }
+
+  wooting_mutex_lock(&engine->lock);
+  // New parameters for the running effect carry on from where it is
+  if (!engine->running || engine->next.effect != effect) {
+    engine->start_us = wooting_platform_time_us();
+  }
+  engine->next = state;
+  engine->changed = true;
+  engine->device_count = device_count;
+  wooting_mutex_unlock(&engine->lock);
+
+  if (!engine->running) {
+    wooting_atomic_store(&engine->stop, 0);
+    engine->running = wooting_thread_create(
+        &engine->thread, wooting_rgb_effect_thread, engine);
+  }
+  return engine->running;
 }
 
-WOOTING_DEVICE_LAYOUT wooting_rgb_device_layout(void) {
-  return wooting_usb_get_meta()->layout;
-}
\ No newline at end of file
+void wooting_rgb_effect_stop(void) {
+  WOOTING_RGB_EFFECT_ENGINE *engine = &rgb_effect_engine;
+  if (!engine->running) {
+    return;
+  }
+
+  wooting_atomic_store(&engine->stop, 1);
+  wooting_thread_join(engine->thread);
+  engine->running = false;
+
+  // The devices show the last effect frame rather than the colour array, so
+  // the next update has to look at every key
+  for (uint8_t i = 0; i < engine->device_count; i++) {
+    for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+      rgb_changes_array[i].dirty[row] = (1u << WOOTING_RGB_COLS) - 1;
+    }
+  }
+}
+
+typedef bool (*wooting_rgb_device_task)(uint8_t device_index);
+
+typedef struct WOOTING_RGB_DEVICE_JOB {
+  wooting_rgb_device_task task;
+  uint8_t device_index;
+  bool result;
+  bool threaded;
+  wooting_thread thread;
+} WOOTING_RGB_DEVICE_JOB;
+
+static void wooting_rgb_device_job_thread(void *arg) {
+  WOOTING_RGB_DEVICE_JOB *job = (WOOTING_RGB_DEVICE_JOB *)arg;
+  job->result = job->task(job->device_index);
+}
+
+// Runs a task for every connected device at the same time, with one worker
+// thread per device, so the total time is set by the slowest device rather
+// than the sum of all of them. The result of each device ends up in results.
+// Only worth it for one-off tasks like the reset on close, frames go through
+// the writers of the devices instead
+static void wooting_rgb_run_on_all_devices(wooting_rgb_device_task task,
+                                           bool results[]) {
+  uint8_t count = wooting_usb_device_count();
+  WOOTING_RGB_DEVICE_JOB jobs[WOOTING_MAX_RGB_DEVICES];
+
+  for (uint8_t i = 0; i < count; i++) {
+    jobs[i].task = task;
+    jobs[i].device_index = i;
+    jobs[i].result = false;
+    // No point in paying for a thread when there's only one device
+    jobs[i].threaded =
+        count > 1 && wooting_thread_create(&jobs[i].thread,
+                                           wooting_rgb_device_job_thread,
+                                           &jobs[i]);
+  }
+
+  for (uint8_t i = 0; i < count; i++) {
+    if (jobs[i].threaded) {
+      wooting_thread_join(jobs[i].thread);
+    } else {
+      wooting_rgb_device_job_thread(&jobs[i]);
+    }
+    results[i] = jobs[i].result;
+  }
+}
+
+bool wooting_rgb_kbd_connected() { return wooting_usb_find_keyboard(); }
+
+void wooting_rgb_set_disconnected_cb(void_cb cb) {
+  wooting_usb_set_disconnected_cb(cb);
+}
+
+bool wooting_rgb_hotplug_monitor(bool enable) {
+  return wooting_usb_hotplug_monitor(enable);
+}
+
+void wooting_rgb_set_hotplug_cb(void_cb arrival_cb, void_cb removal_cb) {
+  wooting_usb_set_hotplug_cb(arrival_cb, removal_cb);
+}
+
+void wooting_rgb_set_profile_cache(const char *path) {
+  wooting_usb_set_profile_cache(path);
+}
+
+void wooting_rgb_trace(bool enable) { wooting_trace_enable(enable); }
+
+bool wooting_rgb_trace_dump(const char *path) {
+  return wooting_trace_dump(path);
+}
+
+// Marks a key as changed after it was set outside of the colour array, so the
+// next update restores it even when only changed keys are sent
+static void wooting_rgb_mark_key(wooting_device *device, uint8_t row,
+                                 uint8_t column) {
+  if (device && row < WOOTING_RGB_ROWS && column < WOOTING_RGB_COLS) {
+    device->changes->stale[row] |= 1u << column;
+  }
+}
+
+// Marks every key as changed after the device was told to show its own colours
+static void wooting_rgb_mark_reset(wooting_device *device) {
+  if (device) {
+    for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+      device->changes->stale[row] = (1u << WOOTING_RGB_COLS) - 1;
+    }
+  }
+}
+
+bool wooting_rgb_reset_rgb() {
+  wooting_rgb_record_command(wooting_usb_selected_device(),
+                             WOOTING_RECORD_RESET_ALL, NULL, 0);
+  wooting_rgb_mark_reset(rgb_selected);
+  return wooting_usb_send_feature(WOOTING_RESET_ALL_COMMAND, 0, 0, 0, 0);
+}
+
+static bool wooting_rgb_reset_device(uint8_t device_index) {
+  return wooting_usb_device_send_feature(
+      device_index, WOOTING_RESET_ALL_COMMAND, 0, 0, 0, 0);
+}
+
+bool wooting_rgb_close() {
+  bool result = false;
+  bool results[WOOTING_MAX_RGB_DEVICES];
+
+  // Flush any frames still queued so they can't land after the reset
+  wooting_rgb_async_stop();
+
+  // Each reset waits for the device's response, so reset all of them at once
+  wooting_rgb_run_on_all_devices(wooting_rgb_reset_device, results);
+  for (uint8_t i = 0; i < wooting_usb_device_count(); i++) {
+    result |= results[i];
+  }
+
+  // The disconnect call disconnects all devices, so we do it after we've
+  // attempted to reset rgb on all of them
+  wooting_usb_disconnect(false);
+
+  return result;
+}
+
+bool wooting_rgb_reset() { return wooting_rgb_close(); }
+
+bool wooting_rgb_direct_set_key(uint8_t row, uint8_t column, uint8_t red,
+                                uint8_t green, uint8_t blue) {
+  if (!wooting_rgb_kbd_connected()) {
+    return false;
+  }
+
+  uint8_t device_index = wooting_usb_selected_device();
+  wooting_rgb_record_command(device_index, WOOTING_RECORD_DIRECT_SET,
+                             (const uint8_t[]){row, column, red, green, blue},
+                             5);
+  wooting_rgb_mark_key(rgb_selected, row, column);
+  if (wooting_rgb_device_set_key(device_index, wooting_usb_get_meta(), row,
+                                 column, red, green, blue)) {
+    return true;
+  }
+  wooting_usb_handle_device_failure();
+  return false;
+}
+
+bool wooting_rgb_direct_reset_key(uint8_t row, uint8_t column) {
+  if (!wooting_rgb_kbd_connected()) {
+    return false;
+  }
+
+  uint8_t device_index = wooting_usb_selected_device();
+  wooting_rgb_record_command(device_index, WOOTING_RECORD_DIRECT_RESET,
+                             (const uint8_t[]){row, column}, 2);
+  wooting_rgb_mark_key(rgb_selected, row, column);
+  if (wooting_rgb_device_reset_key(device_index, wooting_usb_get_meta(), row,
+                                   column)) {
+    return true;
+  }
+  wooting_usb_handle_device_failure();
+  return false;
+}
+
+void wooting_rgb_array_auto_update(bool auto_update) {
+  wooting_rgb_auto_update = auto_update;
+}
+
+void wooting_rgb_array_async_update(bool async_update) {
+  // Turning async update off also stops an effect started in sync mode
+  if (!async_update &&
+      (wooting_rgb_async_update || rgb_effect_engine.running)) {
+    wooting_rgb_async_stop();
+  }
+
+  wooting_rgb_async_update = async_update;
+}
+
+void wooting_rgb_array_delta_update(bool delta_update) {
+  wooting_rgb_delta_update = delta_update;
+}
+
+void wooting_rgb_array_frame_rate(uint32_t frame_rate) {
+  // Pacing happens in the background writers
+  if (frame_rate) {
+    wooting_rgb_async_update = true;
+  }
+
+  wooting_atomic_store(&rgb_frame_interval_us,
+                       frame_rate ? (int32_t)(1000000 / frame_rate) : 0);
+}
+
+bool wooting_rgb_device_pacing_stats(uint8_t device_index,
+                                     WOOTING_RGB_PACING_STATS *stats) {
+  if (device_index >= WOOTING_MAX_RGB_DEVICES || !stats) {
+    return false;
+  }
+
+  memset(stats, 0, sizeof(*stats));
+  uint32_t target = (uint32_t)wooting_atomic_load(&rgb_frame_interval_us);
+  stats->target_hz = target ? 1000000 / target : 0;
+  if (!rgb_writers_initialised) {
+    return true;
+  }
+
+  WOOTING_RGB_WRITER *writer = &rgb_writer_array[device_index];
+  wooting_mutex_lock(&writer->lock);
+  if (writer->present_us) {
+    stats->capacity_hz = 1000000 / writer->present_us;
+  }
+  uint32_t interval = wooting_rgb_writer_interval(writer);
+  stats->effective_hz = interval ? 1000000 / interval : 0;
+  stats->frames_presented = writer->frames_presented;
+  stats->frames_dropped =
+      (uint32_t)wooting_atomic_load(&writer->frames_dropped);
+  stats->deadlines_missed = writer->deadlines_missed;
+  if (writer->jitter_count) {
+    stats->jitter_avg_us =
+        (uint32_t)(writer->jitter_total_us / writer->jitter_count);
+  }
+  stats->jitter_max_us = writer->jitter_max_us;
+  wooting_mutex_unlock(&writer->lock);
+  return true;
+}
+
+static bool wooting_rgb_update_device(uint8_t device_index) {
+  WOOTING_RGB_CHANGES *changes = &rgb_changes_array[device_index];
+  WOOTING_USB_V2_REPORT *frame = wooting_rgb_compose(device_index, changes);
+  wooting_rgb_record_frame(device_index, frame->matrix);
+  wooting_atomic_add(&rgb_write_stats_array[device_index].frames_submitted, 1);
+  if (!wooting_rgb_present(device_index, frame, changes)) {
+    return false;
+  }
+
+  memset(changes, 0, sizeof(*changes));
+  return true;
+}
+
+// Sends the colour array of a device and waits until it's written. A device
+// whose writer runs, e.g. for an effect, only gets frames from that writer, so
+// the frame is handed to it
+static bool wooting_rgb_update_device_sync(uint8_t device_index) {
+  if (!rgb_writer_array[device_index].running) {
+    return wooting_rgb_update_device(device_index);
+  }
+
+  uint32_t sequence;
+  bool result = wooting_rgb_writer_submit(device_index, &sequence);
+  return wooting_rgb_writer_wait(device_index, sequence) && result;
+}
+
+// Sends the colour array of a device, or hands it to its writer in async mode
+static bool wooting_rgb_send_device(uint8_t device_index) {
+  return wooting_rgb_async_update
+             ? wooting_rgb_writer_submit(device_index, NULL)
+             : wooting_rgb_update_device_sync(device_index);
+}
+
+bool wooting_rgb_array_update_keyboard() {
+  if (!wooting_rgb_kbd_connected()) {
+    return false;
+  }
+
+  uint8_t device_index = wooting_usb_selected_device();
+  uint64_t trace = wooting_trace_begin();
+  bool result = wooting_rgb_send_device(device_index);
+  wooting_trace_end(trace, "update_keyboard", device_index, result);
+
+  if (!result) {
+    wooting_usb_handle_device_failure();
+  }
+  return result;
+}
+
+bool wooting_rgb_array_update_all_keyboards() {
+  if (!wooting_rgb_kbd_connected()) {
+    return false;
+  }
+
+  bool result = true;
+  uint8_t count = wooting_usb_device_count();
+  uint64_t trace = wooting_trace_begin();
+
+  if (wooting_rgb_async_update) {
+    // Submitting never waits on USB, so there's nothing to gain from threads
+    for (uint8_t i = 0; i < count; i++) {
+      result &= wooting_rgb_writer_submit(i, NULL);
+    }
+  } else if (count == 1) {
+    // No point in handing a single device over to its writer
+    result = wooting_rgb_update_device_sync(0);
+  } else {
+    // Every writer sends its frame at the same time, so the total time is set
+    // by the slowest device rather than the sum of all of them
+    uint32_t sequences[WOOTING_MAX_RGB_DEVICES];
+    for (uint8_t i = 0; i < count; i++) {
+      result &= wooting_rgb_writer_submit(i, &sequences[i]);
+    }
+    // Nothing was queued on a writer that couldn't be started
+    for (uint8_t i = 0; i < count; i++) {
+      result &= rgb_writer_array[i].running &&
+                wooting_rgb_writer_wait(i, sequences[i]);
+    }
+  }
+
+  wooting_trace_end(trace, "update_all_keyboards", WOOTING_TRACE_NO_DEVICE,
+                    result);
+
+  if (!result) {
+    wooting_usb_handle_device_failure();
+  }
+  return result;
+}
+
+// Whether the colours of a device can be set: it was found and hasn't been
+// dropped since
+static bool wooting_rgb_device_connected(const wooting_device *device) {
+  if (!device) {
+    return false;
+  }
+
+  const WOOTING_USB_META *meta = wooting_usb_get_device_meta(device->index);
+  return meta && meta->connected;
+}
+
+static bool wooting_rgb_array_change_single(wooting_device *device,
+                                            uint8_t row, uint8_t column,
+                                            uint8_t red, uint8_t green,
+                                            uint8_t blue) {
+  uint16_t prevValue = (*device->matrix)[row][column];
+  uint16_t newValue = encodeColor(red, green, blue);
+  if (newValue != prevValue) {
+    (*device->matrix)[row][column] = newValue;
+    device->changes->dirty[row] |= 1u << column;
+  }
+
+  return true;
+}
+
+bool wooting_rgb_array_set_single(uint8_t row, uint8_t column, uint8_t red,
+                                  uint8_t green, uint8_t blue) {
+  // We just check to see if we believe the keyboard to be connected here as
+  // this call may just be updating the array and not actually communicating
+  // with the keyboard If auto update is on then the update_keyboard method will
+  // ping the keyboard before communicating with the keyboard
+  if (!wooting_rgb_device_connected(rgb_selected)) {
+    return false;
+  }
+
+  if (!wooting_rgb_array_change_single(rgb_selected, row, column, red, green,
+                                       blue)) {
+    return false;
+  }
+
+  if (wooting_rgb_auto_update) {
+    return wooting_rgb_array_update_keyboard();
+  } else {
+    return true;
+  }
+}
+
+// Sets every key in mask to the same colour. The colour is encoded once and
+// only keys that end up with a different colour are marked as changed
+static bool wooting_rgb_array_set_masked_colour(const WOOTING_RGB_KEY_MASK mask,
+                                                uint8_t red, uint8_t green,
+                                                uint8_t blue) {
+  // Like wooting_rgb_array_set_single, only whether we believe the keyboard to
+  // be connected matters here
+  if (!wooting_rgb_device_connected(rgb_selected)) {
+    return false;
+  }
+
+  uint16_t colour = encodeColor(red, green, blue);
+  for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+    uint16_t *keys = (*rgb_selected->matrix)[row];
+    uint32_t changed = 0;
+    uint32_t bits = mask[row] & KEY_MASK_ROW;
+    for (uint8_t column = 0; bits; column++, bits >>= 1) {
+      if ((bits & 1) && keys[column] != colour) {
+        keys[column] = colour;
+        changed |= 1u << column;
+      }
+    }
+    rgb_selected->changes->dirty[row] |= changed;
+  }
+
+  if (wooting_rgb_auto_update) {
+    return wooting_rgb_array_update_keyboard();
+  } else {
+    return true;
+  }
+}
+
+bool wooting_rgb_array_fill(uint8_t red, uint8_t green, uint8_t blue) {
+  WOOTING_RGB_KEY_MASK mask;
+  for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+    mask[row] = KEY_MASK_ROW;
+  }
+  return wooting_rgb_array_set_masked_colour(mask, red, green, blue);
+}
+
+bool wooting_rgb_array_set_row(uint8_t row, uint8_t red, uint8_t green,
+                               uint8_t blue) {
+  return wooting_rgb_array_set_rect(row, 0, 1, WOOTING_RGB_COLS, red, green,
+                                    blue);
+}
+
+bool wooting_rgb_array_set_column(uint8_t column, uint8_t red, uint8_t green,
+                                  uint8_t blue) {
+  return wooting_rgb_array_set_rect(0, column, WOOTING_RGB_ROWS, 1, red, green,
+                                    blue);
+}
+
+bool wooting_rgb_array_set_rect(uint8_t row, uint8_t column, uint8_t rows,
+                                uint8_t columns, uint8_t red, uint8_t green,
+                                uint8_t blue) {
+  if (row >= WOOTING_RGB_ROWS || column >= WOOTING_RGB_COLS) {
+    return false;
+  }
+
+  // The rectangle is clipped to the colour array
+  if (columns > WOOTING_RGB_COLS - column) {
+    columns = WOOTING_RGB_COLS - column;
+  }
+  uint32_t row_mask = ((1u << columns) - 1) << column;
+
+  WOOTING_RGB_KEY_MASK mask;
+  for (uint8_t i = 0; i < WOOTING_RGB_ROWS; i++) {
+    mask[i] = i >= row && i - row < rows ? row_mask : 0;
+  }
+  return wooting_rgb_array_set_masked_colour(mask, red, green, blue);
+}
+
+bool wooting_rgb_array_set_masked(const uint32_t key_mask[WOOTING_RGB_ROWS],
+                                  uint8_t red, uint8_t green, uint8_t blue) {
+  if (!key_mask) {
+    return false;
+  }
+
+  return wooting_rgb_array_set_masked_colour(key_mask, red, green, blue);
+}
+
+// Copies converted colours into a row of the colour array, marking the keys
+// that changed
+static void wooting_rgb_array_change_row(wooting_device *device, uint8_t row,
+                                         const uint16_t *colours,
+                                         uint8_t columns) {
+  uint16_t *keys = (*device->matrix)[row];
+  uint32_t changed = 0;
+  for (uint8_t col = 0; col < columns; col++) {
+    if (keys[col] != colours[col]) {
+      keys[col] = colours[col];
+      changed |= 1u << col;
+    }
+  }
+  device->changes->dirty[row] |= changed;
+}
+
+bool wooting_rgb_array_set_full(const uint8_t *colors_buffer) {
+  return wooting_rgb_array_set_full_ex(colors_buffer, WOOTING_RGB_PIXEL_RGB, 0);
+}
+
+// Converts a full frame of pixels into the colour array of a device
+static bool wooting_rgb_array_convert_full(wooting_device *device,
+                                           const void *pixels,
+                                           WOOTING_RGB_PIXEL_FORMAT format,
+                                           size_t stride) {
+  uint8_t pixel_size = wooting_rgb_pixel_size(format);
+  if (!pixels || !pixel_size) {
+    return false;
+  }
+  if (stride == 0) {
+    stride = WOOTING_RGB_COLS * pixel_size;
+  }
+
+  const uint8_t columns =
+      wooting_usb_get_device_meta(device->index)->max_columns;
+
+  for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+    uint16_t colours[WOOTING_RGB_COLS];
+    wooting_rgb_convert_row((const uint8_t *)pixels + row * stride, format,
+                            colours, columns);
+    wooting_rgb_array_change_row(device, row, colours, columns);
+  }
+  return true;
+}
+
+bool wooting_rgb_array_set_full_ex(const void *pixels,
+                                   WOOTING_RGB_PIXEL_FORMAT format,
+                                   size_t stride) {
+  // Just need to check if we believe it is connected, the update_keyboard call
+  // will ping the keyboard if it is necessary
+  if (!wooting_rgb_device_connected(rgb_selected)) {
+    return false;
+  }
+
+  if (!wooting_rgb_array_convert_full(rgb_selected, pixels, format, stride)) {
+    return false;
+  }
+
+  if (wooting_rgb_auto_update) {
+    return wooting_rgb_array_update_keyboard();
+  } else {
+    return true;
+  }
+}
+
+bool wooting_rgb_array_set_image(const void *pixels,
+                                 WOOTING_RGB_PIXEL_FORMAT format,
+                                 uint32_t width, uint32_t height,
+                                 size_t stride) {
+  const WOOTING_USB_META *meta = wooting_usb_get_meta();
+  if (!meta->connected) {
+    return false;
+  }
+
+  uint8_t pixel_size = wooting_rgb_pixel_size(format);
+  if (!pixels || !pixel_size || width == 0 || height == 0) {
+    return false;
+  }
+  if (stride == 0) {
+    stride = (size_t)width * pixel_size;
+  }
+
+  uint64_t trace = wooting_trace_begin();
+  WOOTING_RGB_MATRIX colours;
+  wooting_rgb_downscale((const uint8_t *)pixels, format, width, height, stride,
+                        meta->max_rows, meta->max_columns, colours,
+                        wooting_platform_cpu_features());
+  for (uint8_t row = 0; row < meta->max_rows && row < WOOTING_RGB_ROWS;
+       row++) {
+    wooting_rgb_array_change_row(rgb_selected, row, colours[row],
+                                 meta->max_columns);
+  }
+  wooting_trace_end(trace, "set_image", wooting_usb_selected_device(),
+                    width * height);
+
+  if (wooting_rgb_auto_update) {
+    return wooting_rgb_array_update_keyboard();
+  } else {
+    return true;
+  }
+}
+
+bool wooting_rgb_layer_set_single(uint8_t layer, uint8_t row, uint8_t column,
+                                  uint8_t red, uint8_t green, uint8_t blue,
+                                  uint8_t alpha) {
+  if (!wooting_rgb_device_connected(rgb_selected) ||
+      layer >= WOOTING_RGB_LAYERS ||
+      row >= WOOTING_RGB_ROWS || column >= WOOTING_RGB_COLS) {
+    return false;
+  }
+
+  wooting_rgb_layers_set_key(rgb_selected->layers, layer, row, column,
+                             encodeColor(red, green, blue), alpha);
+  if (wooting_rgb_auto_update) {
+    return wooting_rgb_array_update_keyboard();
+  } else {
+    return true;
+  }
+}
+
+bool wooting_rgb_layer_set_full(uint8_t layer, const uint8_t *rgba_buffer) {
+  if (!wooting_rgb_device_connected(rgb_selected) ||
+      layer >= WOOTING_RGB_LAYERS ||
+      !rgba_buffer) {
+    return false;
+  }
+
+  for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+    for (uint8_t column = 0; column < WOOTING_RGB_COLS; column++) {
+      const uint8_t *pixel =
+          rgba_buffer + (row * WOOTING_RGB_COLS + column) * 4;
+      wooting_rgb_layers_set_key(rgb_selected->layers, layer, row, column,
+                                 encodeColor(pixel[0], pixel[1], pixel[2]),
+                                 pixel[3]);
+    }
+  }
+  if (wooting_rgb_auto_update) {
+    return wooting_rgb_array_update_keyboard();
+  } else {
+    return true;
+  }
+}
+
+bool wooting_rgb_layer_clear(uint8_t layer) {
+  if (!wooting_rgb_device_connected(rgb_selected) ||
+      layer >= WOOTING_RGB_LAYERS) {
+    return false;
+  }
+
+  // A layer that was never drawn on is empty already
+  if (layer < rgb_selected->layers->used) {
+    for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+      for (uint8_t column = 0; column < WOOTING_RGB_COLS; column++) {
+        wooting_rgb_layers_set_key(rgb_selected->layers, layer, row, column,
+                                   0, 0);
+      }
+    }
+  }
+  if (wooting_rgb_auto_update) {
+    return wooting_rgb_array_update_keyboard();
+  } else {
+    return true;
+  }
+}
+
+bool wooting_rgb_layer_blend_mode(uint8_t layer, WOOTING_RGB_BLEND_MODE mode) {
+  if (!wooting_rgb_device_connected(rgb_selected) ||
+      layer >= WOOTING_RGB_LAYERS ||
+      mode > WOOTING_RGB_BLEND_MULTIPLY) {
+    return false;
+  }
+
+  WOOTING_RGB_LAYER *target = &rgb_selected->layers->layers[layer];
+  if (target->mode != mode) {
+    target->mode = mode;
+    wooting_rgb_layers_touch(rgb_selected->layers, layer);
+  }
+  if (wooting_rgb_auto_update) {
+    return wooting_rgb_array_update_keyboard();
+  } else {
+    return true;
+  }
+}
+
+bool wooting_rgb_layer_visible(uint8_t layer, bool visible) {
+  if (!wooting_rgb_device_connected(rgb_selected) ||
+      layer >= WOOTING_RGB_LAYERS) {
+    return false;
+  }
+
+  WOOTING_RGB_LAYER *target = &rgb_selected->layers->layers[layer];
+  if (target->visible != visible) {
+    target->visible = visible;
+    wooting_rgb_layers_touch(rgb_selected->layers, layer);
+  }
+  if (wooting_rgb_auto_update) {
+    return wooting_rgb_array_update_keyboard();
+  } else {
+    return true;
+  }
+}
+
+// Changes the correction of a device, or only its brightness. The thread
+// sending to the device picks the change up with its next frame
+static void wooting_rgb_change_correction(
+    wooting_device *device, const WOOTING_RGB_CORRECTION *correction,
+    bool brightness_only) {
+  WOOTING_RGB_CORRECTION_STATE *state = &rgb_correction_array[device->index];
+  WOOTING_RGB_CORRECTION *settings = &state->settings;
+
+  wooting_mutex_lock(&state->lock);
+  WOOTING_RGB_CORRECTION updated = *correction;
+  if (brightness_only) {
+    updated = *settings;
+    updated.brightness = correction->brightness;
+  }
+  // Setting the same correction again shouldn't resend every key
+  if (settings->gamma != updated.gamma ||
+      settings->brightness != updated.brightness ||
+      settings->white_red != updated.white_red ||
+      settings->white_green != updated.white_green ||
+      settings->white_blue != updated.white_blue) {
+    *settings = updated;
+    wooting_atomic_add(&state->version, 1);
+  }
+  wooting_mutex_unlock(&state->lock);
+}
+
+bool wooting_rgb_array_correction(const WOOTING_RGB_CORRECTION *correction) {
+  // NaN isn't >= 0 either
+  if (!wooting_rgb_device_connected(rgb_selected) ||
+      (correction && !(correction->gamma >= 0))) {
+    return false;
+  }
+
+  wooting_rgb_change_correction(
+      rgb_selected, correction ? correction : &rgb_default_correction, false);
+  if (wooting_rgb_auto_update) {
+    return wooting_rgb_array_update_keyboard();
+  } else {
+    return true;
+  }
+}
+
+bool wooting_rgb_array_brightness(uint8_t brightness) {
+  if (!wooting_rgb_device_connected(rgb_selected)) {
+    return false;
+  }
+
+  wooting_rgb_change_correction(
+      rgb_selected, &(WOOTING_RGB_CORRECTION){.brightness = brightness}, true);
+  if (wooting_rgb_auto_update) {
+    return wooting_rgb_array_update_keyboard();
+  } else {
+    return true;
+  }
+}
+
+// Offset of the red channel of an LED in the v1 buffers. Each buffer holds 24
+// LEDs, laid out the way the LED drivers' memory is
+static uint16_t wooting_rgb_v1_offset(uint8_t led_index) {
+  static const uint8_t pwm_mem_map[24] = {
+      0x0,  0x1,  0x2,  0x3,  0x4,  0x5,  0x8,  0x9,  0xa,  0xb,  0xc,  0xd,
+      0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d};
+
+  return (uint16_t)((led_index / 24) * RGB_RAW_BUFFER_SIZE +
+                    pwm_mem_map[led_index % 24]);
+}
+
+static void wooting_rgb_build_v1_plan(const WOOTING_USB_META *meta,
+                                      WOOTING_RGB_V1_PLAN *plan) {
+  plan->count = 0;
+  for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+    for (uint8_t column = 0; column < WOOTING_RGB_COLS; column++) {
+      uint8_t led_index = get_safe_led_idex(meta, row, column);
+
+      // prevent assigning led's that don't exist
+      if (led_index > meta->led_index_max) {
+        continue;
+      }
+
+      uint8_t key = row * WOOTING_RGB_COLS + column;
+      plan->entries[plan->count].key = key;
+      plan->entries[plan->count++].offset = wooting_rgb_v1_offset(led_index);
+
+      if (led_index == LED_ENTER_ANSI) {
+        plan->entries[plan->count].key = key;
+        plan->entries[plan->count++].offset =
+            wooting_rgb_v1_offset(LED_ENTER_ISO);
+      } else if (led_index == LED_LEFT_SHIFT_ANSI) {
+        plan->entries[plan->count].key = key;
+        plan->entries[plan->count++].offset =
+            wooting_rgb_v1_offset(LED_LEFT_SHIFT_ISO);
+      }
+    }
+  }
+  plan->built = true;
+}
+
+static void wooting_rgb_encode_v1_buffers(uint8_t device_index,
+                                          const WOOTING_RGB_MATRIX matrix,
+                                          const uint32_t *correction,
+                                          WOOTING_RGB_V1_BUFFERS buffers) {
+  WOOTING_RGB_V1_PLAN *plan = &rgb_device_state_array[device_index].v1_plan;
+  if (!plan->built) {
+    // A dropped device keeps its meta, so its first frame after being reopened
+    // is encoded too
+    const WOOTING_USB_META *meta = wooting_usb_get_device_meta(device_index);
+    if (!meta) {
+      return;
+    }
+    wooting_rgb_build_v1_plan(meta, plan);
+  }
+
+  const uint16_t *keys = &matrix[0][0];
+  uint8_t *buffer = &buffers[0][0];
+  for (uint8_t i = 0; i < plan->count; i++) {
+    const WOOTING_RGB_V1_PLAN_ENTRY *entry = &plan->entries[i];
+    uint16_t key_colour = keys[entry->key];
+
+    if (correction) {
+      uint32_t corrected = correction[key_colour];
+      buffer[entry->offset] = (uint8_t)(corrected >> 16);
+      buffer[entry->offset + 0x10] = (uint8_t)(corrected >> 8);
+      buffer[entry->offset + 0x20] = (uint8_t)corrected;
+    } else {
+      buffer[entry->offset] = gammaFilter[(key_colour >> 8) & 0xf8];
+      buffer[entry->offset + 0x10] = gammaFilter[(key_colour >> 3) & 0xfc];
+      buffer[entry->offset + 0x20] = gammaFilter[(key_colour << 3) & 0xf8];
+    }
+  }
+}
+
+bool wooting_rgb_build_v1_buffers() {
+  // This overwrites the record of what was last sent
+  rgb_device_state_array[wooting_usb_selected_device()].v1_parts_sent = false;
+  wooting_rgb_encode_v1_buffers(
+      wooting_usb_selected_device(),
+      (const uint16_t(*)[WOOTING_RGB_COLS]) * rgb_selected->matrix, NULL,
+      rgb_v1_buffer_array[wooting_usb_selected_device()]);
+  return true;
+}
+
+static void wooting_rgb_init_devices(void) {
+  if (rgb_reports_initialised) {
+    return;
+  }
+
+  for (uint8_t i = 0; i < WOOTING_MAX_RGB_DEVICES; i++) {
+    wooting_usb_v2_report_init(&rgb_report_array[i]);
+    wooting_rgb_layers_init(&rgb_layer_stack_array[i]);
+    rgb_device_array[i].index = i;
+    rgb_device_array[i].matrix = &rgb_report_array[i].matrix;
+    rgb_device_array[i].changes = &rgb_changes_array[i];
+    rgb_device_array[i].layers = &rgb_layer_stack_array[i];
+    wooting_mutex_init(&rgb_correction_array[i].lock);
+    rgb_correction_array[i].settings = rgb_default_correction;
+    rgb_correction_array[i].table_version = -1;
+  }
+  rgb_reports_initialised = true;
+}
+
+bool wooting_rgb_select_buffer(uint8_t buffer_index) {
+  wooting_rgb_init_devices();
+
+  // Fetch pointer and buffer data from arrays
+  rgb_selected = &rgb_device_array[buffer_index];
+
+  return true;
+}
+
+const WOOTING_USB_META *wooting_rgb_device_info() {
+  if (!wooting_usb_get_meta()->connected)
+    wooting_usb_find_keyboard();
+  // The meta is handed out whole, so it should come with the layout filled in
+  wooting_usb_device_layout(wooting_usb_selected_device());
+  return wooting_usb_get_meta();
+}
+
+bool wooting_rgb_device_write_stats(uint8_t device_index,
+                                    WOOTING_RGB_WRITE_STATS *stats) {
+  if (device_index >= WOOTING_MAX_RGB_DEVICES || !stats) {
+    return false;
+  }
+
+  WOOTING_RGB_WRITE_COUNTERS *counters = &rgb_write_stats_array[device_index];
+  stats->frames_sent = (uint32_t)wooting_atomic_load(&counters->frames_sent);
+  stats->frames_elided =
+      (uint32_t)wooting_atomic_load(&counters->frames_elided);
+  stats->reports_sent = (uint32_t)wooting_atomic_load(&counters->reports_sent);
+  stats->reports_elided =
+      (uint32_t)wooting_atomic_load(&counters->reports_elided);
+  stats->keys_sent = (uint32_t)wooting_atomic_load(&counters->keys_sent);
+  stats->frames_submitted =
+      (uint32_t)wooting_atomic_load(&counters->frames_submitted);
+  stats->frames_replaced =
+      (uint32_t)wooting_atomic_load(&counters->frames_replaced);
+  return true;
+}
+
+bool wooting_rgb_device_stats(uint8_t device_index,
+                              WOOTING_RGB_DEVICE_STATS *stats) {
+  if (!stats) {
+    return false;
+  }
+
+  return wooting_rgb_device_write_stats(device_index, &stats->write) &&
+         wooting_usb_device_stats(device_index, &stats->usb);
+}
+
+WOOTING_DEVICE_LAYOUT wooting_rgb_device_layout(void) {
+  return wooting_usb_device_layout(wooting_usb_selected_device());
+}
+
+wooting_device *wooting_device_open(uint8_t device_index) {
+  if (!wooting_rgb_kbd_connected() ||
+      device_index >= wooting_usb_device_count()) {
+    return NULL;
+  }
+
+  // Set up everything shared here, so the first update of each handle doesn't
+  // race another one doing the same
+  wooting_rgb_init_devices();
+  wooting_rgb_writers_init();
+
+  wooting_device *device = &rgb_device_array[device_index];
+  device->open = true;
+  return device;
+}
+
+// Handle calls only work between open and close, on a device that is still
+// enumerated. A device dropped after failing is usable, its next update goes
+// through wooting_usb_device_io, which reopens it
+static bool wooting_device_usable(const wooting_device *device) {
+  return device && device->open &&
+         device->index < wooting_usb_device_count();
+}
+
+bool wooting_device_close(wooting_device *device) {
+  if (!device || !device->open) {
+    return false;
+  }
+
+  device->open = false;
+  // A frame that is still queued can't land after the reset
+  wooting_rgb_writer_stop(device->index);
+  wooting_rgb_mark_reset(device);
+  return wooting_rgb_reset_device(device->index);
+}
+
+const WOOTING_USB_META *wooting_device_info(wooting_device *device) {
+  if (!device || !device->open) {
+    return NULL;
+  }
+
+  // Like wooting_rgb_device_info, the meta comes with the layout filled in
+  wooting_usb_device_layout(device->index);
+  return wooting_usb_get_device_meta(device->index);
+}
+
+bool wooting_device_set_single(wooting_device *device, uint8_t row,
+                               uint8_t column, uint8_t red, uint8_t green,
+                               uint8_t blue) {
+  if (!wooting_device_usable(device) || row >= WOOTING_RGB_ROWS ||
+      column >= WOOTING_RGB_COLS) {
+    return false;
+  }
+
+  wooting_rgb_array_change_single(device, row, column, red, green, blue);
+
+  if (wooting_rgb_auto_update) {
+    return wooting_device_update(device);
+  } else {
+    return true;
+  }
+}
+
+bool wooting_device_set_full(wooting_device *device,
+                             const uint8_t *colors_buffer) {
+  return wooting_device_set_full_ex(device, colors_buffer,
+                                    WOOTING_RGB_PIXEL_RGB, 0);
+}
+
+bool wooting_device_set_full_ex(wooting_device *device, const void *pixels,
+                                WOOTING_RGB_PIXEL_FORMAT format,
+                                size_t stride) {
+  if (!wooting_device_usable(device) ||
+      !wooting_rgb_array_convert_full(device, pixels, format, stride)) {
+    return false;
+  }
+
+  if (wooting_rgb_auto_update) {
+    return wooting_device_update(device);
+  } else {
+    return true;
+  }
+}
+
+bool wooting_device_update(wooting_device *device) {
+  if (!wooting_device_usable(device)) {
+    return false;
+  }
+
+  // A failure only drops this device, it is reopened by a later update
+  uint64_t trace = wooting_trace_begin();
+  bool result = wooting_rgb_send_device(device->index);
+  wooting_trace_end(trace, "device_update", device->index, result);
+  return result;
+}
+
+bool wooting_device_correction(wooting_device *device,
+                               const WOOTING_RGB_CORRECTION *correction) {
+  if (!wooting_device_usable(device) ||
+      (correction && !(correction->gamma >= 0))) {
+    return false;
+  }
+
+  wooting_rgb_change_correction(
+      device, correction ? correction : &rgb_default_correction, false);
+  if (wooting_rgb_auto_update) {
+    return wooting_device_update(device);
+  } else {
+    return true;
+  }
+}
+
+bool wooting_device_brightness(wooting_device *device, uint8_t brightness) {
+  if (!wooting_device_usable(device)) {
+    return false;
+  }
+
+  wooting_rgb_change_correction(
+      device, &(WOOTING_RGB_CORRECTION){.brightness = brightness}, true);
+  if (wooting_rgb_auto_update) {
+    return wooting_device_update(device);
+  } else {
+    return true;
+  }
+}
+
+wooting_replay *wooting_rgb_replay_open(const char *path) {
+  if (!path) {
+    return NULL;
+  }
+
+  wooting_replay *replay = (wooting_replay *)malloc(sizeof(wooting_replay));
+  if (!replay) {
+    return NULL;
+  }
+  if (!wooting_player_open(&replay->player, path)) {
+    free(replay);
+    return NULL;
+  }
+  return replay;
+}
+
+uint64_t wooting_rgb_replay_duration(const wooting_replay *replay) {
+  return replay ? replay->player.duration_us : 0;
+}
+
+bool wooting_rgb_replay_seek(wooting_replay *replay, uint64_t time_us) {
+  return replay && wooting_player_seek(&replay->player, time_us);
+}
+
+// Puts the changed keys of a recorded frame into the colour array of a device
+// and sends it
+static bool wooting_rgb_replay_frame(uint8_t device_index,
+                                     const WOOTING_RGB_MATRIX frame,
+                                     const uint32_t changed[WOOTING_RGB_ROWS]) {
+  wooting_device *device = &rgb_device_array[device_index];
+  for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+    uint32_t keys = changed[row];
+    for (uint8_t column = 0; keys; column++, keys >>= 1) {
+      if ((keys & 1) &&
+          (*device->matrix)[row][column] != frame[row][column]) {
+        (*device->matrix)[row][column] = frame[row][column];
+        device->changes->dirty[row] |= 1u << column;
+      }
+    }
+  }
+  return wooting_rgb_send_device(device_index);
+}
+
+static bool wooting_rgb_replay_event(const WOOTING_PLAYER *player,
+                                     const WOOTING_RECORD_EVENT *event) {
+  uint8_t device_index = event->device_index;
+  const WOOTING_USB_META *meta = wooting_usb_get_device_meta(device_index);
+  if (!meta || !meta->connected) {
+    return false;
+  }
+
+  wooting_device *device = &rgb_device_array[device_index];
+  switch (event->type) {
+  case WOOTING_RECORD_FRAME_KEYS:
+  case WOOTING_RECORD_FRAME_MASKED:
+    return wooting_rgb_replay_frame(
+        device_index,
+        (const uint16_t(*)[WOOTING_RGB_COLS])player->frames[device_index],
+        event->changed);
+  case WOOTING_RECORD_DIRECT_SET:
+    wooting_rgb_mark_key(device, event->row, event->column);
+    return event->row < WOOTING_RGB_ROWS && event->column < WOOTING_RGB_COLS &&
+           wooting_rgb_device_set_key(device_index, meta, event->row,
+                                      event->column, event->red, event->green,
+                                      event->blue);
+  case WOOTING_RECORD_DIRECT_RESET:
+    wooting_rgb_mark_key(device, event->row, event->column);
+    return event->row < WOOTING_RGB_ROWS && event->column < WOOTING_RGB_COLS &&
+           wooting_rgb_device_reset_key(device_index, meta, event->row,
+                                        event->column);
+  case WOOTING_RECORD_RESET_ALL:
+    wooting_rgb_mark_reset(device);
+    return wooting_usb_device_send_feature(
+        device_index, WOOTING_RESET_ALL_COMMAND, 0, 0, 0, 0);
+  default:
+    // Sync records and their frames only matter for seeking
+    return true;
+  }
+}
+
+bool wooting_rgb_replay_play(wooting_replay *replay, uint32_t speed_percent) {
+  if (!replay || !wooting_rgb_kbd_connected()) {
+    return false;
+  }
+  wooting_rgb_init_devices();
+
+  WOOTING_PLAYER *player = &replay->player;
+  bool result = true;
+  uint32_t all[WOOTING_RGB_ROWS];
+  for (uint8_t row = 0; row < WOOTING_RGB_ROWS; row++) {
+    all[row] = KEY_MASK_ROW;
+  }
+  // Devices start out showing what they did at the position played from
+  for (uint8_t i = 0; i < WOOTING_MAX_RGB_DEVICES; i++) {
+    if (player->seen[i]) {
+      WOOTING_RECORD_EVENT event = {.type = WOOTING_RECORD_FRAME_MASKED,
+                                    .device_index = i};
+      memcpy(event.changed, all, sizeof(all));
+      result &= wooting_rgb_replay_event(player, &event);
+    }
+  }
+
+  uint64_t start_us = wooting_platform_time_us();
+  uint64_t from_us = player->time_us;
+  WOOTING_RECORD_EVENT event;
+  while (wooting_player_next(player, &event)) {
+    if (speed_percent) {
+      uint64_t due_us =
+          start_us + (event.time_us - from_us) * 100 / speed_percent;
+      uint64_t now_us = wooting_platform_time_us();
+      if (due_us > now_us) {
+        wooting_platform_sleep_us(due_us - now_us);
+      }
+    }
+
+    uint64_t trace = wooting_trace_begin();
+    bool sent = wooting_rgb_replay_event(player, &event);
+    wooting_trace_end(trace, "replay", event.device_index, sent);
+    result &= sent;
+  }
+  return result;
+}
+
+void wooting_rgb_replay_close(wooting_replay *replay) {
+  if (replay) {
+    wooting_player_close(&replay->player);
+    free(replay);
+  }
+}
@@ -31,6 +31,153 @@ extern "C" {
 */
 typedef uint16_t WOOTING_RGB_MATRIX[WOOTING_RGB_ROWS][WOOTING_RGB_COLS];
 
+/**
+ * Pixel layouts accepted by wooting_rgb_array_set_full_ex
+*/
+typedef enum WOOTING_RGB_PIXEL_FORMAT {
+  // One byte per channel
+  WOOTING_RGB_PIXEL_RGB,
+  WOOTING_RGB_PIXEL_BGR,
+  // One byte per channel, the alpha byte is ignored
+  WOOTING_RGB_PIXEL_RGBA,
+  WOOTING_RGB_PIXEL_BGRA,
+  // 32 bit floats from 0.0 to 1.0, values outside of that are clamped and the
+  // alpha channel is ignored
+  WOOTING_RGB_PIXEL_RGB_FLOAT,
+  WOOTING_RGB_PIXEL_RGBA_FLOAT
+} WOOTING_RGB_PIXEL_FORMAT;
+
+/**
+ * Counters of the colour data sent to a device
+*/
+typedef struct WOOTING_RGB_WRITE_STATS {
+  // Updates sent as a full frame
+  uint32_t frames_sent;
+  // Updates that weren't sent because nothing changed since the last frame
+  uint32_t frames_elided;
+  // Colour reports written, a v1 frame consists of up to five reports
+  uint32_t reports_sent;
+  // v1 reports skipped because their part of the frame didn't change
+  uint32_t reports_elided;
+  // Keys sent with single key commands by delta updates
+  uint32_t keys_sent;
+  // Update calls for this device, sent, elided, failed or replaced
+  uint32_t frames_submitted;
+  // Async frames replaced by a newer one before the writer got to them
+  uint32_t frames_replaced;
+} WOOTING_RGB_WRITE_STATS;
+
+/**
+ * How well frame pacing keeps up on a device
+*/
+typedef struct WOOTING_RGB_PACING_STATS {
+  // Rate asked for with wooting_rgb_array_frame_rate, 0 when pacing is off
+  uint32_t target_hz;
+  // Rate the device was measured to keep up with, 0 until a frame was sent
+  uint32_t capacity_hz;
+  // Rate frames are presented at, the target capped with some headroom to
+  // the capacity
+  uint32_t effective_hz;
+  // Frames handed to the device by the background writer
+  uint32_t frames_presented;
+  // Paced frames replaced by a newer one before their tick came
+  uint32_t frames_dropped;
+  // Ticks that passed while a frame was waiting and the device was still busy
+  uint32_t deadlines_missed;
+  // How late paced presents started compared to their tick
+  uint32_t jitter_avg_us;
+  uint32_t jitter_max_us;
+} WOOTING_RGB_PACING_STATS;
+
+/**
+ * Animations the SDK can run by itself, see wooting_rgb_effect_start
+*/
+typedef enum WOOTING_RGB_EFFECT {
+  // Bands of colour moving from left to right over a background
+  WOOTING_RGB_EFFECT_WAVE,
+  // All keys fading between the background and the colour
+  WOOTING_RGB_EFFECT_BREATHING,
+  // Cycling through the colour wheel, all keys at once or as a rainbow
+  WOOTING_RGB_EFFECT_SPECTRUM,
+  // Rings of colour growing from one key
+  WOOTING_RGB_EFFECT_RIPPLE
+} WOOTING_RGB_EFFECT;
+
+/**
+ * Settings of an effect. Fields an effect doesn't use are ignored
+*/
+typedef struct WOOTING_RGB_EFFECT_PARAMS {
+  // Colour the effect lights keys with, not used by the spectrum cycle
+  uint8_t red;
+  uint8_t green;
+  uint8_t blue;
+  // Colour of keys that aren't lit
+  uint8_t background_red;
+  uint8_t background_green;
+  uint8_t background_blue;
+  // Length of one cycle in milliseconds, 0 for 2000
+  uint32_t period_ms;
+  // Width of one wave in keys. 0 gives a wave as wide as the colour array and
+  // a spectrum cycle with all keys the same colour
+  uint8_t wavelength;
+  // Key the ripples start from
+  uint8_t origin_row;
+  uint8_t origin_column;
+  // Frames per second the effect is rendered at, 0 for 60
+  uint32_t frame_rate;
+} WOOTING_RGB_EFFECT_PARAMS;
+
+// Number of layers each device has, see wooting_rgb_layer_set_single
+#define WOOTING_RGB_LAYERS 8
+
+/**
+ * How a layer is combined with what is below it, weighted by the alpha of each
+ * key
+*/
+typedef enum WOOTING_RGB_BLEND_MODE {
+  // The layer covers what is below it
+  WOOTING_RGB_BLEND_NORMAL,
+  // The layer's colour is added to what is below it
+  WOOTING_RGB_BLEND_ADD,
+  // What is below is multiplied by the layer's colour, e.g. to dim keys
+  WOOTING_RGB_BLEND_MULTIPLY
+} WOOTING_RGB_BLEND_MODE;
+
+/**
+ * Colour correction of a device, applied to everything sent from its colour
+ * array. The default has every field but gamma at 255
+*/
+typedef struct WOOTING_RGB_CORRECTION {
+  // Exponent of the gamma curve, 0 for the device's own curve. Wooting One and
+  // Two keyboards have always had a curve applied, newer ones show colours as
+  // they are
+  float gamma;
+  // Scales all channels, 255 for full brightness
+  uint8_t brightness;
+  // Scale of each channel, to balance the white of a keyboard
+  uint8_t white_red;
+  uint8_t white_green;
+  uint8_t white_blue;
+} WOOTING_RGB_CORRECTION;
+
+/**
+ * Everything that is counted about a device
+*/
+typedef struct WOOTING_RGB_DEVICE_STATS {
+  WOOTING_RGB_WRITE_STATS write;
+  WOOTING_USB_STATS usb;
+} WOOTING_RGB_DEVICE_STATS;
+
+/**
+ * Handle of a single keyboard, see wooting_device_open
+*/
+typedef struct wooting_device wooting_device;
+
+/**
+ * A recording opened for playback, see wooting_rgb_replay_open
+*/
+typedef struct wooting_replay wooting_replay;
+
 /** @brief Select RGB buffer for device
 
 This function swaps the RGB buffer pointer for the one of the selected device.
@@ -41,6 +188,27 @@ This function returns true(1) after the swap
 */
 bool wooting_rgb_select_buffer(uint8_t buffer_index);
 
+/** @brief Stop the background writers of async update mode
+
+Any frame that is still queued is sent before the writer exits. This is called
+before device handles are closed. It should NEVER be called from non SDK code.
+*/
+void wooting_rgb_async_stop(void);
+
+/** @brief Forget what was sent to the devices
+
+Called when devices are disconnected, after which the next update of each
+device sends a full frame. It should NEVER be called from non SDK code.
+*/
+void wooting_rgb_reset_device_state(void);
+
+/** @brief Forget what was sent to a single device
+
+Called when a device is dropped or reopened, after which its next update sends
+a full frame. It should NEVER be called from non SDK code.
+*/
+void wooting_rgb_invalidate_device(uint8_t device_index);
+
 /** @brief Check if keyboard connected.
 
 This function offers a check if the keyboard is connected.
@@ -58,6 +226,11 @@ WOOTINGRGBSDK_API bool wooting_rgb_kbd_connected(void);
 The callback will be called when a Wooting keyboard disconnects. The callback
 will only trigger after a failed color change.
 
+With multiple devices connected, a device that stops responding is dropped on
+its own (its meta reports connected as false) and is reopened automatically
+once it's back, keeping its index. The callback only triggers once every
+device has been lost.
+
 @ingroup API
 @param cb The function pointer of the callback
 
@@ -66,6 +239,190 @@ None.
 */
 WOOTINGRGBSDK_API void wooting_rgb_set_disconnected_cb(void_cb cb);
 
+/** @brief Watch for keyboards being plugged in and removed.
+
+Without the monitor, checking for a keyboard while none is connected scans
+every HID device on the system each time. With it running, the SDK is told by
+the OS when a Wooting device arrives or goes away: wooting_rgb_kbd_connected
+returns immediately without scanning until a keyboard is plugged in, and
+removed keyboards are noticed right away instead of on the next failed write.
+
+The monitor listens to kernel uevents for hidraw devices and is only available
+on Linux. Standard is set to false.
+
+@ingroup API
+@param enable Whether the monitor should run
+
+@returns
+true (1) if the monitor is running, false (0) when it was stopped or isn't
+available on this platform.
+*/
+WOOTINGRGBSDK_API bool wooting_rgb_hotplug_monitor(bool enable);
+
+/** @brief Set callbacks for keyboards being plugged in and removed.
+
+Requires wooting_rgb_hotplug_monitor. The arrival callback fires when a
+Wooting keyboard is plugged in, the removal callback when one of the connected
+keyboards is unplugged. Both are called from the monitor thread, so they should
+return quickly and not call back into the SDK.
+
+@ingroup API
+@param arrival_cb Called when a keyboard is plugged in, may be NULL
+@param removal_cb Called when a connected keyboard is removed, may be NULL
+
+@returns
+None.
+*/
+WOOTINGRGBSDK_API void wooting_rgb_set_hotplug_cb(void_cb arrival_cb,
+                                                  void_cb removal_cb);
+
+/** @brief Keep what the SDK learns about each keyboard in a file.
+
+Every connect normally asks each keyboard for its packet size and layout. With
+a cache file set, a keyboard that was seen before is set up from the file
+straight away, keyed by its serial number and firmware version, and checked in
+the background afterwards. The file can be shared by several processes.
+Keyboards without a serial number are never cached. Should be called before
+connecting. Standard is no cache.
+
+@ingroup API
+@param path Cache file to use, NULL disables the cache
+
+@returns
+None.
+*/
+WOOTINGRGBSDK_API void wooting_rgb_set_profile_cache(const char *path);
+
+/** @brief Record where the time goes inside the SDK.
+
+With tracing on, updates, encoding, CRCs, every HID write, feature round-trips
+and response reads are recorded as timed events. Every thread records into its
+own ring buffer without locking, which keeps the most recent events. With
+tracing off this costs next to nothing. Standard is set to false.
+
+@ingroup API
+@param enable Whether events should be recorded. Turning it on drops the events
+recorded before
+
+@returns
+None.
+*/
+WOOTINGRGBSDK_API void wooting_rgb_trace(bool enable);
+
+/** @brief Write the recorded trace events to a file.
+
+The file uses the Chrome trace event JSON format, it can be opened in
+chrome://tracing or https://ui.perfetto.dev.
+
+@ingroup API
+@param path File to write
+
+@returns
+true (1) if the file was written, false (0) if it couldn't be or tracing was
+never turned on.
+*/
+WOOTINGRGBSDK_API bool wooting_rgb_trace_dump(const char *path);
+
+/** @brief Start recording everything sent to the keyboards to a file.
+
+Every update of a colour array is recorded with the time it was made, as the
+frame that was sent after layers were blended on. Direct key commands and
+resets are recorded as well, frames of the effects engine aren't. Frames only
+store the keys that changed, so a recording stays small and can run for a long
+time. Play it back with wooting_rgb_replay_open.
+
+@ingroup API
+@param path File to record to, it is replaced
+
+@returns
+true (1) if the recording was started, false (0) if the file couldn't be
+created or a recording is already running.
+*/
+WOOTINGRGBSDK_API bool wooting_rgb_record_start(const char *path);
+
+/** @brief Stop recording and finish the file.
+
+A recording that was never stopped, e.g. because the app crashed, can still be
+played back. Opening it takes longer as it has to be read through once.
+
+@ingroup API
+
+@returns
+true (1) if the whole recording was written, false (0) if writing failed at
+some point or nothing was being recorded.
+*/
+WOOTINGRGBSDK_API bool wooting_rgb_record_stop(void);
+
+/** @brief Open a recording for playback.
+
+The file is mapped into memory rather than read, so recordings larger than
+memory can be played back.
+
+@ingroup API
+@param path File made with wooting_rgb_record_start
+
+@returns
+A replay positioned at the start, NULL if the file can't be opened or isn't a
+recording. Close it with wooting_rgb_replay_close.
+*/
+WOOTINGRGBSDK_API wooting_replay *wooting_rgb_replay_open(const char *path);
+
+/** @brief Length of a recording.
+
+@ingroup API
+@param replay Replay from wooting_rgb_replay_open
+
+@returns
+Time from the start to the last record in microseconds.
+*/
+WOOTINGRGBSDK_API uint64_t
+wooting_rgb_replay_duration(const wooting_replay *replay);
+
+/** @brief Move playback to a point in the recording.
+
+This jumps to the closest point the recording keeps full frames at and reads
+on from there, so it takes about as long anywhere in the recording.
+
+@ingroup API
+@param replay Replay from wooting_rgb_replay_open
+@param time_us Time since the start of the recording
+
+@returns
+true (1) if the replay was moved.
+*/
+WOOTINGRGBSDK_API bool wooting_rgb_replay_seek(wooting_replay *replay,
+                                               uint64_t time_us);
+
+/** @brief Play a recording back on the connected keyboards.
+
+Plays from the current position to the end and returns when done. Keyboards
+first get the frame they showed at that position. Frames are played back into
+the colour arrays of the keyboards with the index they were recorded on and
+sent like wooting_rgb_array_update_keyboard sends them, so layers, colour
+correction and the async update flag of this app apply to them.
+
+@ingroup API
+@param replay Replay from wooting_rgb_replay_open
+@param speed_percent Playback speed, 100 for the recorded timing, 200 for twice
+as fast, 0 to send everything as fast as possible
+
+@returns
+true (1) if everything was played back, false (0) if a keyboard of the
+recording isn't connected or didn't take an update.
+*/
+WOOTINGRGBSDK_API bool wooting_rgb_replay_play(wooting_replay *replay,
+                                               uint32_t speed_percent);
+
+/** @brief Close a replay.
+
+@ingroup API
+@param replay Replay from wooting_rgb_replay_open, NULL is ignored
+
+@returns
+None.
+*/
+WOOTINGRGBSDK_API void wooting_rgb_replay_close(wooting_replay *replay);
+
 /** @brief Reset all colors on keyboard to the original colors.
 
 This function will restore all the colours to the colours that were originally
@@ -84,6 +441,9 @@ This function will restore all the colours to the colours that were originally
 on the keyboard and closes the keyboard handle. This function should always be
 called when you close the application.
 
+All connected devices are reset at the same time, so closing takes as long as
+the slowest device rather than the sum of all of them.
+
 @ingroup API
 
 @returns
@@ -144,6 +504,20 @@ This functions return true (1) if the colours are updated.
 */
 WOOTINGRGBSDK_API bool wooting_rgb_array_update_keyboard(void);
 
+/** @brief Send the colors from the color arrays to all connected keyboards.
+
+This function does the same as wooting_rgb_array_update_keyboard for every
+connected device, each with its own colour array, without having to select
+them one by one. The devices are updated at the same time, so the call takes as
+long as the slowest device rather than the sum of all of them.
+
+@ingroup API
+
+@returns
+This functions return true (1) if the colours of all devices are updated.
+*/
+WOOTINGRGBSDK_API bool wooting_rgb_array_update_all_keyboards(void);
+
 /** @brief Change the auto update flag for the wooting_rgb_array single and full
 functions functions.
 
@@ -160,6 +534,130 @@ None.
 */
 WOOTINGRGBSDK_API void wooting_rgb_array_auto_update(bool auto_update);
 
+/** @brief Change the async update flag for wooting_rgb_array_update_keyboard.
+
+With async update enabled, wooting_rgb_array_update_keyboard no longer waits
+for the USB writes. It hands a copy of the colour array to a background writer
+thread of the selected device and returns straight away. If the writer is still
+busy with an earlier frame, only the newest submitted frame is kept, older
+queued frames are dropped.
+
+The frames are triple buffered, handing one over never waits for the writer,
+so an update can't stall on a slow device. The writer always sends the newest
+complete frame, the keys of dropped frames are sent along with it.
+
+A failed write is reported by the next wooting_rgb_array_update_keyboard call,
+which returns false and disconnects like a synchronous update would.
+
+Standard is set to false.
+
+@ingroup API
+@param async_update Change the async update flag
+
+@returns
+None.
+*/
+WOOTINGRGBSDK_API void wooting_rgb_array_async_update(bool async_update);
+
+/** @brief Change the delta update flag for wooting_rgb_array_update_keyboard.
+
+The SDK tracks which keys of the colour array changed since the last update.
+With delta update enabled, an update where only a few keys changed sends those
+keys with single key commands instead of sending a full frame. The break-even
+point is estimated per device from its packet mode and refined with the
+measured time of every full frame and key update.
+
+Standard is set to false.
+
+@ingroup API
+@param delta_update Change the delta update flag
+
+@returns
+None.
+*/
+WOOTINGRGBSDK_API void wooting_rgb_array_delta_update(bool delta_update);
+
+/** @brief Present frames at a steady rate.
+
+With a frame rate set, the background writer of each device presents the
+newest submitted frame once per tick instead of as soon as it's submitted. Apps
+can call wooting_rgb_array_update_keyboard as often as they like, frames
+between two ticks replace each other. Each device's sustainable rate is
+measured while it runs and the rate is capped to it, so a device that can't
+keep up, e.g. one using small packets, isn't flooded.
+
+Pacing uses the background writers, so setting a rate turns on async update.
+Setting the rate back to 0 turns pacing off and leaves async update on.
+
+Standard is 0.
+
+@ingroup API
+@param frame_rate Target number of frames per second, 0 to turn pacing off
+
+@returns
+None.
+*/
+WOOTINGRGBSDK_API void wooting_rgb_array_frame_rate(uint32_t frame_rate);
+
+/** @brief Retrieve the pacing statistics of a device
+
+Shows the target, measured and effective frame rates, and how far presents
+drift from their ticks.
+
+@ingroup API
+@param device_index Index of the device, see wooting_usb_select_device
+@param stats Receives the statistics
+
+@returns
+This function returns true (1) if the statistics were copied, false if the
+index is out of range.
+*/
+WOOTINGRGBSDK_API bool
+wooting_rgb_device_pacing_stats(uint8_t device_index,
+                                WOOTING_RGB_PACING_STATS *stats);
+
+/** @brief Run an animation on all connected keyboards.
+
+The effect is rendered a whole frame at a time on a background thread at the
+frame rate in params, so it keeps running smoothly without the app doing
+anything. Calling this while an effect runs switches to the new effect or
+parameters from the next frame on. Changing only the parameters of the running
+effect keeps its timing, so e.g. a breathing colour can be changed without the
+animation jumping.
+
+Frames go through the background writers. The update mode of the app stays as
+it was, in sync mode an update still waits until its frame was written. While
+the effect runs it draws over the whole keyboard, frames sent from the colour
+array are only shown until the next effect frame.
+
+The effect stops when the keyboards are disconnected, async update is turned
+off or wooting_rgb_close is called.
+
+@ingroup API
+@param effect The animation to run
+@param params Its settings, NULL for a white effect on a black background with
+the standard settings
+
+@returns
+This function returns true (1) if the effect runs, false if no keyboard is
+connected, the effect is unknown or the thread couldn't be started.
+*/
+WOOTINGRGBSDK_API bool
+wooting_rgb_effect_start(WOOTING_RGB_EFFECT effect,
+                         const WOOTING_RGB_EFFECT_PARAMS *params);
+
+/** @brief Stop the running animation.
+
+The keyboards keep showing the last frame of the effect. The next update sends
+the whole colour array again, keys that didn't change included.
+
+@ingroup API
+
+@returns
+None.
+*/
+WOOTINGRGBSDK_API void wooting_rgb_effect_stop(void);
+
 /** @brief Set a single color in the colour array.
 
 This function will set a single color in the colour array. This will not
@@ -182,6 +680,103 @@ WOOTINGRGBSDK_API bool wooting_rgb_array_set_single(uint8_t row, uint8_t column,
                                                     uint8_t red, uint8_t green,
                                                     uint8_t blue);
 
+/** @brief Set every key in the colour array to one colour.
+
+Like wooting_rgb_array_set_single, but for all keys at once. This will not
+directly update the keyboard (unless the flag is set).
+
+@ingroup API
+@param red 0-255 value of the red color
+@param green 0-255 value of the green color
+@param blue 0-255 value of the blue color
+
+@returns
+This functions return true (1) if the colours are changed (if auto update flag:
+updated).
+*/
+WOOTINGRGBSDK_API bool wooting_rgb_array_fill(uint8_t red, uint8_t green,
+                                              uint8_t blue);
+
+/** @brief Set a whole row of the colour array to one colour.
+
+This will not directly update the keyboard (unless the flag is set).
+
+@ingroup API
+@param row The horizontal index of the keys
+@param red 0-255 value of the red color
+@param green 0-255 value of the green color
+@param blue 0-255 value of the blue color
+
+@returns
+This functions return true (1) if the colours are changed (if auto update flag:
+updated), false if the row is out of range.
+*/
+WOOTINGRGBSDK_API bool wooting_rgb_array_set_row(uint8_t row, uint8_t red,
+                                                 uint8_t green, uint8_t blue);
+
+/** @brief Set a whole column of the colour array to one colour.
+
+This will not directly update the keyboard (unless the flag is set).
+
+@ingroup API
+@param column The vertical index of the keys
+@param red 0-255 value of the red color
+@param green 0-255 value of the green color
+@param blue 0-255 value of the blue color
+
+@returns
+This functions return true (1) if the colours are changed (if auto update flag:
+updated), false if the column is out of range.
+*/
+WOOTINGRGBSDK_API bool wooting_rgb_array_set_column(uint8_t column,
+                                                    uint8_t red,
+                                                    uint8_t green,
+                                                    uint8_t blue);
+
+/** @brief Set a rectangle of the colour array to one colour.
+
+The rectangle starts at the given key and is clipped to the colour array, so
+e.g. a width of 255 covers the rest of the row. This will not directly update
+the keyboard (unless the flag is set).
+
+@ingroup API
+@param row The horizontal index of the top left key
+@param column The vertical index of the top left key
+@param rows Height of the rectangle in keys
+@param columns Width of the rectangle in keys
+@param red 0-255 value of the red color
+@param green 0-255 value of the green color
+@param blue 0-255 value of the blue color
+
+@returns
+This functions return true (1) if the colours are changed (if auto update flag:
+updated), false if the top left key is out of range.
+*/
+WOOTINGRGBSDK_API bool wooting_rgb_array_set_rect(uint8_t row, uint8_t column,
+                                                  uint8_t rows,
+                                                  uint8_t columns, uint8_t red,
+                                                  uint8_t green, uint8_t blue);
+
+/** @brief Set a selection of keys in the colour array to one colour.
+
+The keys are picked with a bit mask per row, where bit n stands for column n.
+E.g. key_mask[1] = 0x1E selects the 1 to 4 keys. Bits past the last column are
+ignored. This will not directly update the keyboard (unless the flag is set).
+
+@ingroup API
+@param key_mask Array of WOOTING_RGB_ROWS (6) masks, one per row
+@param red 0-255 value of the red color
+@param green 0-255 value of the green color
+@param blue 0-255 value of the blue color
+
+@returns
+This functions return true (1) if the colours are changed (if auto update flag:
+updated).
+*/
+WOOTINGRGBSDK_API bool
+wooting_rgb_array_set_masked(const uint32_t key_mask[WOOTING_RGB_ROWS],
+                             uint8_t red, uint8_t green, uint8_t blue);
+
 /** @brief Set a full colour array.
 
 This function will set a complete color array. This will not directly update the
@@ -205,11 +800,188 @@ updated).
 */
 WOOTINGRGBSDK_API bool wooting_rgb_array_set_full(const uint8_t *colors_buffer);
 
+/** @brief Set a full colour array from pixels in another format.
+
+Like wooting_rgb_array_set_full, but the buffer can be in any of the
+WOOTING_RGB_PIXEL_FORMAT layouts and rows don't have to be tightly packed, so
+e.g. a texture or frame buffer an engine already has can be passed as is. The
+conversion uses SIMD instructions where the CPU supports them.
+
+The buffer holds WOOTING_RGB_ROWS (6) rows of WOOTING_RGB_COLS (21) pixels, of
+which the columns the device has are read.
+
+@ingroup API
+@param pixels Pointer to the first pixel of the first row
+@param format Layout of each pixel
+@param stride Distance between the start of two rows in bytes, 0 for rows that
+follow each other directly
+
+@returns
+This functions return true (1) if the colours are changed (if auto update flag:
+updated), false if the format is unknown.
+*/
+WOOTINGRGBSDK_API bool
+wooting_rgb_array_set_full_ex(const void *pixels,
+                              WOOTING_RGB_PIXEL_FORMAT format, size_t stride);
+
+/** @brief Set the colour array from an image of any size.
+
+The image is scaled down to the keys of the selected device, each key getting
+the average colour of the part of the image it covers. Meant for ambient
+lighting from a screen capture, so the image can be e.g. a 4K frame buffer
+handed over every frame. For large images only a fixed number of evenly spread
+lines is averaged per row of keys, which keeps the cost per frame low. This
+will not directly update the keyboard (unless the flag is set).
+
+@ingroup API
+@param pixels Pointer to the first pixel of the top line
+@param format Layout of each pixel
+@param width Width of the image in pixels
+@param height Height of the image in pixels
+@param stride Distance between the start of two lines in bytes, 0 for lines
+that follow each other directly
+
+@returns
+This functions return true (1) if the colours are changed (if auto update flag:
+updated), false if the format is unknown or the image is empty.
+*/
+WOOTINGRGBSDK_API bool wooting_rgb_array_set_image(
+    const void *pixels, WOOTING_RGB_PIXEL_FORMAT format, uint32_t width,
+    uint32_t height, size_t stride);
+
+/** @brief Set a single key of a layer.
+
+Every device has WOOTING_RGB_LAYERS (8) layers on top of its colour array, so
+several parts of an app can draw on the same keyboard without overwriting each
+other. Layer 0 is the lowest. Each key of a layer has an alpha: 0 leaves the
+key below it as it is, 255 applies the layer's colour in full. Layers start out
+empty, with every key at alpha 0, and don't cost anything until they are drawn
+on.
+
+The layers are blended onto the colour array when the keyboard is updated. The
+result of each layer is kept, so an update only blends the keys that changed,
+and only from the lowest layer they changed in upwards. This will not directly
+update the keyboard (unless the flag is set).
+
+@ingroup API
+@param layer Layer to draw on, from 0 to WOOTING_RGB_LAYERS - 1
+@param row The horizontal index of the key
+@param column The vertical index of the key
+@param red A 0-255 value of the red color
+@param green A 0-255 value of the green color
+@param blue A 0-255 value of the blue color
+@param alpha How much of the layer is applied to the key, from 0 to 255
+
+@returns
+This functions return true (1) if the key is changed (if auto update flag:
+updated), false if the layer or key is out of range.
+*/
+WOOTINGRGBSDK_API bool wooting_rgb_layer_set_single(uint8_t layer, uint8_t row,
+                                                    uint8_t column, uint8_t red,
+                                                    uint8_t green, uint8_t blue,
+                                                    uint8_t alpha);
+
+/** @brief Set all keys of a layer.
+
+Like wooting_rgb_layer_set_single for every key. The buffer is laid out like
+the one of wooting_rgb_array_set_full with an alpha byte after each colour:
+6 rows * 21 columns * 4 bytes = 504 bytes.
+
+@ingroup API
+@param layer Layer to draw on, from 0 to WOOTING_RGB_LAYERS - 1
+@param rgba_buffer Pointer to the red, green, blue and alpha of every key
+
+@returns
+This functions return true (1) if the keys are changed (if auto update flag:
+updated), false if the layer is out of range.
+*/
+WOOTINGRGBSDK_API bool wooting_rgb_layer_set_full(uint8_t layer,
+                                                  const uint8_t *rgba_buffer);
+
+/** @brief Make every key of a layer transparent.
+
+@ingroup API
+@param layer Layer to clear, from 0 to WOOTING_RGB_LAYERS - 1
+
+@returns
+This functions return true (1) if the layer is cleared (if auto update flag:
+updated), false if the layer is out of range.
+*/
+WOOTINGRGBSDK_API bool wooting_rgb_layer_clear(uint8_t layer);
+
+/** @brief Change how a layer is combined with the layers below it.
+
+Standard is WOOTING_RGB_BLEND_NORMAL.
+
+@ingroup API
+@param layer Layer to change, from 0 to WOOTING_RGB_LAYERS - 1
+@param mode The blend mode
+
+@returns
+This functions return true (1) if the mode is changed (if auto update flag:
+updated), false if the layer is out of range or the mode is unknown.
+*/
+WOOTINGRGBSDK_API bool
+wooting_rgb_layer_blend_mode(uint8_t layer, WOOTING_RGB_BLEND_MODE mode);
+
+/** @brief Show or hide a layer.
+
+A hidden layer keeps its keys, so it can be shown again without drawing it
+again.
+
+Standard is true.
+
+@ingroup API
+@param layer Layer to change, from 0 to WOOTING_RGB_LAYERS - 1
+@param visible Whether the layer is blended onto the keyboard
+
+@returns
+This functions return true (1) if the layer is changed (if auto update flag:
+updated), false if the layer is out of range.
+*/
+WOOTINGRGBSDK_API bool wooting_rgb_layer_visible(uint8_t layer, bool visible);
+
+/** @brief Change the colour correction of the selected keyboard.
+
+The correction is applied when colours are sent, the colour array keeps the
+colours as they were set. Changing it resends every key on the next update.
+Keys set with wooting_rgb_direct_set_key are sent as given.
+
+Standard is gamma 0 with everything else at 255.
+
+@ingroup API
+@param correction The new correction, NULL for the standard one
+
+@returns
+This functions return true (1) if the correction is changed (if auto update
+flag: updated), false if the gamma is negative.
+*/
+WOOTINGRGBSDK_API bool
+wooting_rgb_array_correction(const WOOTING_RGB_CORRECTION *correction);
+
+/** @brief Change the brightness of the selected keyboard.
+
+Only changes the brightness of its colour correction, see
+wooting_rgb_array_correction. None of the keys have to be set again.
+
+Standard is 255.
+
+@ingroup API
+@param brightness Scale of all channels, 255 for full brightness
+
+@returns
+This functions return true (1) if the brightness is changed (if auto update
+flag: updated).
+*/
+WOOTINGRGBSDK_API bool wooting_rgb_array_brightness(uint8_t brightness);
+
 /** @brief Retrieve information about the connected Device
 
 This function returns a pointer to a struct which provides various relevant
 details about the currently connected device. E.g. max rgb rows, columns, etc
 
+Like wooting_rgb_device_layout, the first call detects the layout of the device.
+
 @ingroup API
 
 @returns
@@ -218,12 +990,54 @@ relevant Device Information
 */
 WOOTINGRGBSDK_API const WOOTING_USB_META *wooting_rgb_device_info(void);
 
+/** @brief Retrieve the write counters of a device
+
+Updates are compared against the last frame that was successfully sent to the
+device. Unchanged frames are not sent at all, and for v1 devices only the
+reports whose part of the frame changed are sent. These counters show how much
+was sent and how much was skipped. They keep counting across reconnects.
+
+@ingroup API
+@param device_index Index of the device, see wooting_usb_select_device
+@param stats Receives the counters
+
+@returns
+This function returns true (1) if the counters were copied, false if the index
+is out of range.
+*/
+WOOTINGRGBSDK_API bool
+wooting_rgb_device_write_stats(uint8_t device_index,
+                               WOOTING_RGB_WRITE_STATS *stats);
+
+/** @brief Retrieve all counters of a device
+
+Combines the write counters with the USB counters: bytes written, write and
+feature round-trip latency histograms, timeouts, disconnects, reconnects and
+how long enumeration took. Every counter is updated with atomics, so this can
+be called from a monitoring thread while frames are being sent. They keep
+counting across reconnects.
+
+@ingroup API
+@param device_index Index of the device, see wooting_usb_select_device
+@param stats Receives the counters
+
+@returns
+This function returns true (1) if the counters were copied, false if the index
+is out of range.
+*/
+WOOTINGRGBSDK_API bool
+wooting_rgb_device_stats(uint8_t device_index, WOOTING_RGB_DEVICE_STATS *stats);
+
 /** @brief Retrieve layout of the connected device
 
 This function returns an enum flag indicating the layout, e.g. ISO. See
 WOOTING_DEVICE_LAYOUT for options. It will return LAYOUT_UNKNOWN if no device is
 connected or it failed to get the layout info from the device
 
+The layout is asked from the device on the first call rather than while
+connecting, so this call can take a feature round-trip. A failed attempt is
+retried on the next call.
+
 @ingroup API
 
 @returns
@@ -231,6 +1045,161 @@ WOOTING_DEVICE_LAYOUT
 */
 WOOTINGRGBSDK_API WOOTING_DEVICE_LAYOUT wooting_rgb_device_layout(void);
 
+/** @brief Get a handle to drive one keyboard with.
+
+The rest of the API works on the keyboard picked with wooting_usb_select_device,
+which makes it impossible to drive two keyboards from two threads. A handle
+carries the colour array and connection of one keyboard instead, so different
+keyboards can be driven from different threads at the same time without any
+locking in the app. Calls on different handles never wait on each other, also
+not while a keyboard is slow or being reconnected.
+
+The keyboards are found like wooting_rgb_kbd_connected does. Open the handles
+from one thread before handing them to others; opening, closing and the global
+API calls must not run at the same time as calls on handles. A handle stays
+valid until it is closed or the keyboards are disconnected, e.g. by
+wooting_rgb_close. After that its calls return false until it is opened again.
+
+The flags set with wooting_rgb_array_auto_update, async_update, delta_update
+and frame_rate apply to handles too.
+
+@ingroup API
+@param device_index Index of the keyboard, see wooting_usb_select_device
+
+@returns
+A handle to the keyboard, NULL if there is no keyboard with that index. Opening
+the same index twice gives the same handle.
+*/
+WOOTINGRGBSDK_API wooting_device *wooting_device_open(uint8_t device_index);
+
+/** @brief Give a keyboard its own colours back and release its handle.
+
+Unlike wooting_rgb_close, the connection stays open for the other handles and
+the global API.
+
+@ingroup API
+@param device Handle from wooting_device_open
+
+@returns
+This function returns true (1) if the keyboard was reset, false if the handle
+isn't open or the reset failed.
+*/
+WOOTINGRGBSDK_API bool wooting_device_close(wooting_device *device);
+
+/** @brief Retrieve information about the keyboard of a handle
+
+Like wooting_rgb_device_info, for the keyboard of the handle.
+
+@ingroup API
+@param device Handle from wooting_device_open
+
+@returns
+A pointer to the keyboard's `WOOTING_USB_META`, NULL if the handle isn't open.
+*/
+WOOTINGRGBSDK_API const WOOTING_USB_META *
+wooting_device_info(wooting_device *device);
+
+/** @brief Set a single colour in the colour array of a handle.
+
+Like wooting_rgb_array_set_single, for the keyboard of the handle.
+
+@ingroup API
+@param device Handle from wooting_device_open
+@param row The horizontal index of the key
+@param column The vertical index of the key
+@param red A 0-255 value of the red color
+@param green A 0-255 value of the green color
+@param blue A 0-255 value of the blue color
+
+@returns
+This functions return true (1) if the colour is set (if auto update flag:
+updated), false if the handle isn't open or the key is out of range.
+*/
+WOOTINGRGBSDK_API bool wooting_device_set_single(wooting_device *device,
+                                                 uint8_t row, uint8_t column,
+                                                 uint8_t red, uint8_t green,
+                                                 uint8_t blue);
+
+/** @brief Set the full colour array of a handle.
+
+Like wooting_rgb_array_set_full, for the keyboard of the handle.
+
+@ingroup API
+@param device Handle from wooting_device_open
+@param colors_buffer Pointer to a buffer of a full color array
+
+@returns
+This functions return true (1) if the colours are changed (if auto update flag:
+updated), false if the handle isn't open.
+*/
+WOOTINGRGBSDK_API bool wooting_device_set_full(wooting_device *device,
+                                               const uint8_t *colors_buffer);
+
+/** @brief Set the full colour array of a handle from pixels in another format.
+
+Like wooting_rgb_array_set_full_ex, for the keyboard of the handle.
+
+@ingroup API
+@param device Handle from wooting_device_open
+@param pixels Pointer to the first pixel of the first row
+@param format Layout of each pixel
+@param stride Distance between the start of two rows in bytes, 0 for rows that
+follow each other directly
+
+@returns
+This functions return true (1) if the colours are changed (if auto update flag:
+updated), false if the handle isn't open or the format is unknown.
+*/
+WOOTINGRGBSDK_API bool
+wooting_device_set_full_ex(wooting_device *device, const void *pixels,
+                           WOOTING_RGB_PIXEL_FORMAT format, size_t stride);
+
+/** @brief Send the colour array of a handle to its keyboard.
+
+Like wooting_rgb_array_update_keyboard, for the keyboard of the handle. A
+failed update doesn't disconnect anything, the keyboard is looked for again by
+later updates.
+
+@ingroup API
+@param device Handle from wooting_device_open
+
+@returns
+This functions return true (1) if the colours are updated, false if the handle
+isn't open or the keyboard didn't take the update.
+*/
+WOOTINGRGBSDK_API bool wooting_device_update(wooting_device *device);
+
+/** @brief Change the colour correction of the keyboard of a handle.
+
+Like wooting_rgb_array_correction, for the keyboard of the handle.
+
+@ingroup API
+@param device Handle from wooting_device_open
+@param correction The new correction, NULL for the standard one
+
+@returns
+This functions return true (1) if the correction is changed (if auto update
+flag: updated), false if the handle isn't open or the gamma is negative.
+*/
+WOOTINGRGBSDK_API bool
+wooting_device_correction(wooting_device *device,
+                          const WOOTING_RGB_CORRECTION *correction);
+
+/** @brief Change the brightness of the keyboard of a handle.
+
+Like wooting_rgb_array_brightness, for the keyboard of the handle.
+
+@ingroup API
+@param device Handle from wooting_device_open
+@param brightness Scale of all channels, 255 for full brightness
+
+@returns
+This functions return true (1) if the brightness is changed (if auto update
+flag: updated), false if the handle isn't open.
+*/
+WOOTINGRGBSDK_API bool wooting_device_brightness(wooting_device *device,
+                                                 uint8_t brightness);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,205 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "wooting-trace.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "wooting-platform.h"
+
+// Events per thread, older ones are overwritten. Must be a power of two
+#define TRACE_RING_SIZE 8192
+#define TRACE_MAX_THREADS 64
+
+typedef struct WOOTING_TRACE_EVENT {
+  const char *name;
+  uint64_t start_us;
+  uint32_t duration_us;
+  int32_t value;
+  uint8_t device;
+  // 'X' for a span, 'i' for an instant
+  char phase;
+} WOOTING_TRACE_EVENT;
+
+// Only the owning thread writes to a ring. head counts every event ever
+// written, it's published after the event itself so a reader never sees a
+// half written entry, apart from ones overwritten while it reads
+typedef struct WOOTING_TRACE_RING {
+  WOOTING_TRACE_EVENT events[TRACE_RING_SIZE];
+  wooting_atomic head;
+  // Whether a thread owns the ring, guarded by trace_rings_lock
+  bool in_use;
+  uint32_t thread_id;
+} WOOTING_TRACE_RING;
+
+static wooting_atomic trace_active = 0;
+// Events from before tracing was last turned on are left out of dumps. This
+// saves having to reset rings that other threads may be writing to
+static uint64_t trace_since_us = 0;
+
+// Rings are kept after their thread exits, so its events can still be dumped,
+// and are reused by the next thread that needs one. Frames are sent by
+// long-lived threads, the threads that come and go are the ones started per
+// connect, for the reset on close and for restarted writers and effects
+static WOOTING_TRACE_RING *trace_rings[TRACE_MAX_THREADS];
+static uint32_t trace_ring_count = 0;
+static wooting_mutex trace_rings_lock;
+static bool trace_rings_lock_initialised = false;
+
+static WOOTING_THREAD_LOCAL WOOTING_TRACE_RING *thread_ring = NULL;
+static WOOTING_THREAD_LOCAL bool thread_ring_failed = false;
+
+// Sets up the ring of the calling thread the first time it records something
+static WOOTING_TRACE_RING *trace_thread_ring(void) {
+  if (thread_ring || thread_ring_failed)
+    return thread_ring;
+
+  wooting_mutex_lock(&trace_rings_lock);
+  for (uint32_t i = 0; i < trace_ring_count && !thread_ring; i++) {
+    if (!trace_rings[i]->in_use)
+      thread_ring = trace_rings[i];
+  }
+  if (!thread_ring && trace_ring_count < TRACE_MAX_THREADS) {
+    thread_ring = (WOOTING_TRACE_RING *)calloc(1, sizeof(WOOTING_TRACE_RING));
+    if (thread_ring) {
+      thread_ring->thread_id = trace_ring_count + 1;
+      trace_rings[trace_ring_count++] = thread_ring;
+    }
+  }
+  if (thread_ring)
+    thread_ring->in_use = true;
+  else
+    thread_ring_failed = true;
+  wooting_mutex_unlock(&trace_rings_lock);
+
+  return thread_ring;
+}
+
+static void trace_record(const char *name, uint64_t start_us,
+                         uint64_t duration_us, uint8_t device, int32_t value,
+                         char phase) {
+  WOOTING_TRACE_RING *ring = trace_thread_ring();
+  if (!ring)
+    return;
+
+  uint32_t head = (uint32_t)wooting_atomic_load(&ring->head);
+  WOOTING_TRACE_EVENT *event = &ring->events[head & (TRACE_RING_SIZE - 1)];
+  event->name = name;
+  event->start_us = start_us;
+  event->duration_us =
+      duration_us > UINT32_MAX ? UINT32_MAX : (uint32_t)duration_us;
+  event->value = value;
+  event->device = device;
+  event->phase = phase;
+  wooting_atomic_store(&ring->head, (int32_t)(head + 1));
+}
+
+void wooting_trace_thread_exit(void) {
+  if (!thread_ring)
+    return;
+
+  wooting_mutex_lock(&trace_rings_lock);
+  thread_ring->in_use = false;
+  wooting_mutex_unlock(&trace_rings_lock);
+  thread_ring = NULL;
+}
+
+uint64_t wooting_trace_begin(void) {
+  if (!wooting_atomic_load(&trace_active))
+    return 0;
+
+  return wooting_platform_time_us();
+}
+
+void wooting_trace_end(uint64_t start, const char *name, uint8_t device,
+                       int32_t value) {
+  if (!start)
+    return;
+
+  trace_record(name, start, wooting_platform_time_us() - start, device, value,
+               'X');
+}
+
+void wooting_trace_instant(const char *name, uint8_t device, int32_t value) {
+  if (!wooting_atomic_load(&trace_active))
+    return;
+
+  trace_record(name, wooting_platform_time_us(), 0, device, value, 'i');
+}
+
+void wooting_trace_enable(bool enable) {
+  if (!trace_rings_lock_initialised) {
+    wooting_mutex_init(&trace_rings_lock);
+    trace_rings_lock_initialised = true;
+  }
+
+  if (enable && !wooting_atomic_load(&trace_active))
+    trace_since_us = wooting_platform_time_us();
+  wooting_atomic_store(&trace_active, enable ? 1 : 0);
+}
+
+static void trace_write_event(FILE *file, const WOOTING_TRACE_EVENT *event,
+                              uint32_t thread_id, bool first) {
+  fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"sdk\",\"ph\":\"%c\",",
+          first ? "" : ",\n", event->name, event->phase);
+  if (event->phase == 'X')
+    fprintf(file, "\"dur\":%u,", event->duration_us);
+  else
+    fprintf(file, "\"s\":\"t\",");
+  fprintf(file, "\"ts\":%llu,\"pid\":1,\"tid\":%u,\"args\":{",
+          (unsigned long long)event->start_us, thread_id);
+  if (event->device != WOOTING_TRACE_NO_DEVICE)
+    fprintf(file, "\"device\":%u,", event->device);
+  fprintf(file, "\"value\":%d}}", event->value);
+}
+
+bool wooting_trace_dump(const char *path) {
+  if (!trace_rings_lock_initialised)
+    return false;
+
+  FILE *file = fopen(path, "w");
+  WOOTING_TRACE_EVENT *events = (WOOTING_TRACE_EVENT *)malloc(
+      sizeof(WOOTING_TRACE_EVENT) * TRACE_RING_SIZE);
+  if (!file || !events) {
+    if (file)
+      fclose(file);
+    free(events);
+    return false;
+  }
+
+  fprintf(file, "{\"traceEvents\":[\n");
+  bool first = true;
+
+  wooting_mutex_lock(&trace_rings_lock);
+  for (uint32_t i = 0; i < trace_ring_count; i++) {
+    WOOTING_TRACE_RING *ring = trace_rings[i];
+    uint32_t head = (uint32_t)wooting_atomic_load(&ring->head);
+    memcpy(events, ring->events, sizeof(ring->events));
+
+    // Anything the owner wrapped around to while we were copying is dropped,
+    // including the slot it may be writing right now
+    uint32_t after = (uint32_t)wooting_atomic_load(&ring->head);
+    uint32_t oldest = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+    if (after >= TRACE_RING_SIZE && after - TRACE_RING_SIZE + 1 > oldest)
+      oldest = after - TRACE_RING_SIZE + 1;
+
+    for (uint32_t seq = oldest; seq < head; seq++) {
+      const WOOTING_TRACE_EVENT *event =
+          &events[seq & (TRACE_RING_SIZE - 1)];
+      if (event->start_us < trace_since_us)
+        continue;
+
+      trace_write_event(file, event, ring->thread_id, first);
+      first = false;
+    }
+  }
+  wooting_mutex_unlock(&trace_rings_lock);
+
+  fprintf(file, "\n]}\n");
+  free(events);
+  return fclose(file) == 0;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdbool.h"
+#include "stdint.h"
+
+// Tracing of where the time goes inside the SDK. Each thread records fixed
+// size events into its own ring buffer, so recording never takes a lock.
+// While tracing is off, a trace point costs one atomic load.
+//
+// A span is recorded like this:
+//   uint64_t trace = wooting_trace_begin();
+//   ...
+//   wooting_trace_end(trace, "name", device_index, value);
+//
+// Names must be string literals, only the pointer is stored.
+
+// Device field for events that don't belong to a device
+#define WOOTING_TRACE_NO_DEVICE 0xFF
+
+/// @brief Starts a span
+/// @return Start time of the span, 0 while tracing is off
+uint64_t wooting_trace_begin(void);
+/// @brief Records a span started with wooting_trace_begin, does nothing if
+/// start is 0
+void wooting_trace_end(uint64_t start, const char *name, uint8_t device,
+                       int32_t value);
+/// @brief Records a single point in time, e.g. a failure
+void wooting_trace_instant(const char *name, uint8_t device, int32_t value);
+
+/// @brief Releases the ring of the calling thread for reuse by a later
+/// thread. Called when an SDK thread finishes
+void wooting_trace_thread_exit(void);
+
+/// @brief Turns tracing on or off. Turning it on clears earlier events
+void wooting_trace_enable(bool enable);
+/// @brief Writes the recorded events as Chrome trace event JSON, which
+/// chrome://tracing and Perfetto can open
+/// @return false if the file couldn't be written
+bool wooting_trace_dump(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,227 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "wooting-usb.h"
+#include "hidapi.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "wooting-platform.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Usage page of the Wooting config interface as it appears in a report
+// descriptor (Usage Page, 2 byte argument, 0x1337)
+static const uint8_t cfg_usage_page_item[] = {0x06, 0x37, 0x13};
+
+// How long we wait for udev to make a new device node accessible
+#define HOTPLUG_NODE_WAIT_US 2000000
+#define HOTPLUG_NODE_POLL_MS 20
+
+static bool monitor_running = false;
+static int monitor_socket = -1;
+// Written to by wooting_usb_hotplug_stop to wake the monitor thread up
+static int stop_pipe[2] = {-1, -1};
+static wooting_thread monitor_thread;
+
+// Waits for the stop pipe, returns true if the monitor should stop
+static bool hotplug_wait_stop(int timeout_ms) {
+  struct pollfd fd = {stop_pipe[0], POLLIN, 0};
+  return poll(&fd, 1, timeout_ms) > 0;
+}
+
+// Checks the report descriptor in sysfs for the config interface, the other
+// interfaces of a keyboard show up as hidraw devices too
+static bool hotplug_is_cfg_interface(const char *devpath) {
+  char path[512];
+  snprintf(path, sizeof(path), "/sys%s/device/report_descriptor", devpath);
+
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return false;
+
+  uint8_t descriptor[HID_API_MAX_REPORT_DESCRIPTOR_SIZE];
+  size_t len = fread(descriptor, 1, sizeof(descriptor), file);
+  fclose(file);
+
+  for (size_t i = 0; i + sizeof(cfg_usage_page_item) <= len; i++) {
+    if (memcmp(&descriptor[i], cfg_usage_page_item,
+               sizeof(cfg_usage_page_item)) == 0)
+      return true;
+  }
+  return false;
+}
+
+// Picks the VID and PID out of a devpath such as
+// /devices/.../0003:31E3:1220.0005/hidraw/hidraw3
+static bool hotplug_parse_ids(const char *devpath, uint16_t *vendor_id,
+                              uint16_t *product_id) {
+  const char *hidraw = strstr(devpath, "/hidraw/");
+  if (!hidraw)
+    return false;
+
+  const char *id = hidraw;
+  while (id > devpath && *(id - 1) != '/')
+    id--;
+
+  unsigned int bus, vid, pid, instance;
+  if (sscanf(id, "%4x:%4x:%4x.%x", &bus, &vid, &pid, &instance) != 4)
+    return false;
+
+  *vendor_id = (uint16_t)vid;
+  *product_id = (uint16_t)pid;
+  return true;
+}
+
+static void hotplug_handle_uevent(char *message, size_t len) {
+  const char *action = NULL, *subsystem = NULL, *devpath = NULL,
+             *devname = NULL;
+
+  // The message is "action@devpath" followed by KEY=value pairs, all NUL
+  // separated
+  for (size_t i = strlen(message) + 1; i < len; i += strlen(&message[i]) + 1) {
+    const char *field = &message[i];
+    if (strncmp(field, "ACTION=", 7) == 0)
+      action = field + 7;
+    else if (strncmp(field, "SUBSYSTEM=", 10) == 0)
+      subsystem = field + 10;
+    else if (strncmp(field, "DEVPATH=", 8) == 0)
+      devpath = field + 8;
+    else if (strncmp(field, "DEVNAME=", 8) == 0)
+      devname = field + 8;
+  }
+
+  if (!action || !subsystem || !devpath || !devname ||
+      strcmp(subsystem, "hidraw") != 0)
+    return;
+
+  uint16_t vendor_id, product_id;
+  if (!hotplug_parse_ids(devpath, &vendor_id, &product_id))
+    return;
+
+  // hidapi's hidraw backend opens devices through their node
+  char node[64];
+  snprintf(node, sizeof(node), "/dev/%s", devname);
+
+  if (strcmp(action, "remove") == 0) {
+    wooting_usb_hotplug_event(HOTPLUG_REMOVED, vendor_id, product_id, node);
+  } else if (strcmp(action, "add") == 0) {
+    if (!hotplug_is_cfg_interface(devpath))
+      return;
+
+    // The kernel announces the node before udev has set its permissions, so
+    // hold off until it can actually be opened
+    for (uint64_t waited = 0; access(node, R_OK | W_OK) != 0;
+         waited += HOTPLUG_NODE_POLL_MS * 1000) {
+      if (waited >= HOTPLUG_NODE_WAIT_US ||
+          hotplug_wait_stop(HOTPLUG_NODE_POLL_MS))
+        return;
+    }
+    wooting_usb_hotplug_event(HOTPLUG_ARRIVED, vendor_id, product_id, node);
+  }
+}
+
+static void hotplug_thread(void *arg) {
+  char buffer[8192];
+  struct pollfd fds[2] = {{monitor_socket, POLLIN, 0},
+                          {stop_pipe[0], POLLIN, 0}};
+
+  while (true) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (fds[1].revents)
+      break;
+    if (!(fds[0].revents & POLLIN))
+      continue;
+
+    ssize_t len = recv(monitor_socket, buffer, sizeof(buffer) - 1, 0);
+    if (len < 0) {
+      // The socket buffer overflowed and events were dropped
+      if (errno == ENOBUFS)
+        wooting_usb_hotplug_event(HOTPLUG_EVENTS_LOST, 0, 0, NULL);
+      continue;
+    }
+    buffer[len] = '\0';
+    hotplug_handle_uevent(buffer, (size_t)len);
+  }
+}
+
+bool wooting_usb_hotplug_start(void) {
+  if (monitor_running)
+    return true;
+
+  monitor_socket =
+      socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+  if (monitor_socket < 0) {
+#ifdef DEBUG_LOG
+    printf("Failed to open uevent socket: %d\n", errno);
+#endif
+    return false;
+  }
+
+  struct sockaddr_nl address;
+  memset(&address, 0, sizeof(address));
+  address.nl_family = AF_NETLINK;
+  // Group 1 carries the kernel's own uevents
+  address.nl_groups = 1;
+  if (bind(monitor_socket, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+      pipe(stop_pipe) < 0) {
+#ifdef DEBUG_LOG
+    printf("Failed to set up the hotplug monitor: %d\n", errno);
+#endif
+    close(monitor_socket);
+    monitor_socket = -1;
+    return false;
+  }
+
+  monitor_running = wooting_thread_create(&monitor_thread, hotplug_thread, NULL);
+  if (!monitor_running) {
+    close(monitor_socket);
+    close(stop_pipe[0]);
+    close(stop_pipe[1]);
+    monitor_socket = stop_pipe[0] = stop_pipe[1] = -1;
+  }
+  return monitor_running;
+}
+
+void wooting_usb_hotplug_stop(void) {
+  if (!monitor_running)
+    return;
+
+  char stop = 1;
+  while (write(stop_pipe[1], &stop, 1) < 0 && errno == EINTR) {
+  }
+  wooting_thread_join(monitor_thread);
+
+  close(monitor_socket);
+  close(stop_pipe[0]);
+  close(stop_pipe[1]);
+  monitor_socket = stop_pipe[0] = stop_pipe[1] = -1;
+  monitor_running = false;
+}
+
+bool wooting_usb_hotplug_running(void) { return monitor_running; }
+
+#else
+
+// Without a monitor the SDK keeps enumerating on demand
+
+bool wooting_usb_hotplug_start(void) { return false; }
+
+void wooting_usb_hotplug_stop(void) {}
+
+bool wooting_usb_hotplug_running(void) { return false; }
+
+#endif
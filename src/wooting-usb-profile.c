@@ -0,0 +1,193 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "wooting-usb.h"
+#include "hidapi.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "wooting-platform.h"
+
+// First line of the cache file, bumped whenever the format changes so an old
+// file is ignored rather than misread
+#define PROFILE_CACHE_HEADER "wooting-rgb-sdk profiles 1"
+// Oldest entries are dropped past this, which is plenty for one machine
+#define PROFILE_CACHE_MAX 64
+
+static char *cache_path = NULL;
+// Serialises the read-modify-write of the file within this process. Other
+// processes may still write in between, the last writer wins
+static wooting_mutex cache_lock;
+static bool cache_lock_initialised = false;
+
+static void profile_lock_init(void) {
+  if (cache_lock_initialised)
+    return;
+
+  wooting_mutex_init(&cache_lock);
+  cache_lock_initialised = true;
+}
+
+void wooting_usb_set_profile_cache(const char *path) {
+  profile_lock_init();
+
+  char *new_path = NULL;
+  if (path) {
+    size_t path_len = strlen(path) + 1;
+    new_path = (char *)malloc(path_len);
+    if (new_path)
+      memcpy(new_path, path, path_len);
+  }
+
+  wooting_mutex_lock(&cache_lock);
+  free(cache_path);
+  cache_path = new_path;
+  wooting_mutex_unlock(&cache_lock);
+}
+
+bool wooting_usb_profile_key(WOOTING_USB_PROFILE *profile,
+                             const struct hid_device_info *info) {
+  // Without a serial two boards of the same model can't be told apart
+  if (!cache_path || !info->serial_number || !info->serial_number[0])
+    return false;
+
+  memset(profile, 0, sizeof(*profile));
+  profile->vendor_id = info->vendor_id;
+  profile->product_id = info->product_id;
+  profile->release_number = info->release_number;
+  profile->layout = LAYOUT_UNKNOWN;
+
+  // Serials are plain ASCII in practice, anything that would break up the
+  // line in the file is replaced
+  size_t i = 0;
+  for (; info->serial_number[i]; i++) {
+    if (i == WOOTING_USB_PROFILE_SERIAL_LEN - 1)
+      return false;
+    wchar_t c = info->serial_number[i];
+    profile->serial[i] = (c > 0x20 && c < 0x7F) ? (char)c : '_';
+  }
+  profile->serial[i] = '\0';
+  return true;
+}
+
+static bool profile_same_key(const WOOTING_USB_PROFILE *a,
+                             const WOOTING_USB_PROFILE *b) {
+  return a->vendor_id == b->vendor_id && a->product_id == b->product_id &&
+         a->release_number == b->release_number &&
+         strcmp(a->serial, b->serial) == 0;
+}
+
+// Reads every entry in the file, must be called with the cache lock held.
+// A missing or unreadable file just means an empty cache
+static size_t profile_read_all(WOOTING_USB_PROFILE profiles[]) {
+  FILE *file = fopen(cache_path, "r");
+  if (!file)
+    return 0;
+
+  size_t count = 0;
+  char line[256];
+  if (!fgets(line, sizeof(line), file) ||
+      strncmp(line, PROFILE_CACHE_HEADER, strlen(PROFILE_CACHE_HEADER)) != 0) {
+    fclose(file);
+    return 0;
+  }
+
+  while (count < PROFILE_CACHE_MAX && fgets(line, sizeof(line), file)) {
+    WOOTING_USB_PROFILE *profile = &profiles[count];
+    unsigned int vendor_id, product_id, release_number;
+    int small_packets, layout;
+    if (sscanf(line, "%x %x %x %63s %d %d", &vendor_id, &product_id,
+               &release_number, profile->serial, &small_packets,
+               &layout) != 6 ||
+        layout < LAYOUT_UNKNOWN || layout > LAYOUT_ISO)
+      continue;
+
+    profile->vendor_id = (uint16_t)vendor_id;
+    profile->product_id = (uint16_t)product_id;
+    profile->release_number = (uint16_t)release_number;
+    profile->uses_small_packets = small_packets != 0;
+    profile->layout = (WOOTING_DEVICE_LAYOUT)layout;
+    count++;
+  }
+
+  fclose(file);
+  return count;
+}
+
+bool wooting_usb_profile_load(WOOTING_USB_PROFILE *profile) {
+  profile_lock_init();
+
+  WOOTING_USB_PROFILE profiles[PROFILE_CACHE_MAX];
+  bool found = false;
+
+  wooting_mutex_lock(&cache_lock);
+  size_t count = cache_path ? profile_read_all(profiles) : 0;
+  for (size_t i = 0; i < count && !found; i++) {
+    if (profile_same_key(&profiles[i], profile)) {
+      *profile = profiles[i];
+      found = true;
+    }
+  }
+  wooting_mutex_unlock(&cache_lock);
+
+#ifdef DEBUG_LOG
+  printf("Profile cache %s for %04x:%04x %s\n", found ? "hit" : "miss",
+         profile->vendor_id, profile->product_id, profile->serial);
+#endif
+  return found;
+}
+
+void wooting_usb_profile_store(const WOOTING_USB_PROFILE *profile) {
+  profile_lock_init();
+
+  WOOTING_USB_PROFILE profiles[PROFILE_CACHE_MAX];
+
+  wooting_mutex_lock(&cache_lock);
+  if (!cache_path) {
+    wooting_mutex_unlock(&cache_lock);
+    return;
+  }
+
+  // The file is read again first, as another process may have added its own
+  // devices since we last looked
+  size_t count = profile_read_all(profiles);
+  size_t index = 0;
+  while (index < count && !profile_same_key(&profiles[index], profile))
+    index++;
+  if (index == count) {
+    if (count == PROFILE_CACHE_MAX) {
+      memmove(&profiles[0], &profiles[1],
+              (PROFILE_CACHE_MAX - 1) * sizeof(profiles[0]));
+      index = PROFILE_CACHE_MAX - 1;
+    } else {
+      count++;
+    }
+  }
+  profiles[index] = *profile;
+
+  // Each line is at most ~100 characters
+  char *contents = (char *)malloc(sizeof(PROFILE_CACHE_HEADER) + 1 +
+                                  PROFILE_CACHE_MAX * 128);
+  if (contents) {
+    int len = sprintf(contents, "%s\n", PROFILE_CACHE_HEADER);
+    for (size_t i = 0; i < count; i++) {
+      len += sprintf(&contents[len], "%04x %04x %04x %s %d %d\n",
+                     profiles[i].vendor_id, profiles[i].product_id,
+                     profiles[i].release_number, profiles[i].serial,
+                     profiles[i].uses_small_packets ? 1 : 0,
+                     (int)profiles[i].layout);
+    }
+
+    if (!wooting_platform_replace_file(cache_path, contents, (size_t)len)) {
+#ifdef DEBUG_LOG
+      printf("Failed to write the profile cache to %s\n", cache_path);
+#endif
+    }
+    free(contents);
+  }
+  wooting_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,541 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "wooting-usb-sim.h"
+#include "hidapi.h"
+#include "stdlib.h"
+#include "string.h"
+#include "wchar.h"
+#include "wooting-platform.h"
+
+#define SIM_V1_VID 0x03EB
+#define SIM_CFG_USAGE_PAGE 0x1337
+
+#define SIM_FOREIGN_VID 0x046D
+#define SIM_FOREIGN_PID 0xC000
+#define SIM_FOREIGN_USAGE_PAGE 0x0001
+
+#define SIM_COMMAND_SIZE 8
+#define SIM_V1_REPORT_SIZE 128 + 1
+#define SIM_V2_REPORT_SIZE 256 + 1
+#define SIM_SMALL_PACKET_SIZE 64
+#define SIM_SMALL_PACKET_COUNT 4
+#define SIM_V1_RESPONSE_SIZE 128
+#define SIM_V2_RESPONSE_SIZE 256
+
+// Offset of the layout byte in the WOOTING_DEVICE_CONFIG_COMMAND response
+#define SIM_V1_LAYOUT_INDEX 9
+#define SIM_V2_LAYOUT_INDEX 10
+
+typedef struct WOOTING_USB_SIM_DEVICE {
+  bool present;
+  // Still known to the sim but not on the bus, every handle to it fails
+  bool unplugged;
+  // Bumped on every replug so the device comes back under a new path
+  uint32_t generation;
+  // Number of upcoming writes that fail as if the cable glitched
+  uint32_t failing_writes;
+  uint16_t vendor_id;
+  uint16_t product_id;
+  bool small_packets;
+  WOOTING_DEVICE_LAYOUT layout;
+  uint32_t write_latency_us;
+  uint32_t feature_latency_us;
+  char path[32];
+  // An empty serial is reported as none at all
+  wchar_t serial[32];
+  uint16_t release_number;
+
+  // v2 report being reassembled from small packets
+  uint8_t report[SIM_V2_REPORT_SIZE];
+  uint8_t small_packet_index;
+
+  uint8_t response[SIM_V2_RESPONSE_SIZE];
+  size_t response_len;
+  size_t response_pos;
+
+  WOOTING_USB_SIM_STATE state;
+} WOOTING_USB_SIM_DEVICE;
+
+static WOOTING_USB_SIM_DEVICE sim_devices[WOOTING_USB_SIM_MAX_DEVICES];
+
+// Other HID devices sharing the bus, they show up in enumeration but can't be
+// opened
+static uint16_t sim_foreign_devices = 0;
+static uint32_t sim_scan_latency_us = 0;
+static uint32_t sim_enumerations = 0;
+
+// Same mapping as the LED driver memory map used by the v1 SDK path
+static const uint8_t sim_pwm_mem_map[24] = {
+    0x0,  0x1,  0x2,  0x3,  0x4,  0x5,  0x8,  0x9,  0xa,  0xb,  0xc,  0xd,
+    0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d};
+
+static bool sim_is_v2(const WOOTING_USB_SIM_DEVICE *device) {
+  return device->vendor_id != SIM_V1_VID;
+}
+
+static uint16_t sim_crc16ccitt(const uint8_t *buffer, uint16_t size) {
+  uint16_t crc = 0;
+
+  while (size--) {
+    crc ^= (*buffer++ << 8);
+
+    for (uint8_t i = 0; i < 8; ++i) {
+      if (crc & 0x8000) {
+        crc = (crc << 1) ^ 0x1021;
+      } else {
+        crc = crc << 1;
+      }
+    }
+  }
+
+  return crc;
+}
+
+static uint16_t sim_encode_color(uint8_t red, uint8_t green, uint8_t blue) {
+  return ((red & 0xf8) << 8) | ((green & 0xfc) << 3) | ((blue & 0xf8) >> 3);
+}
+
+static bool sim_has_magic(const uint8_t *data) {
+  return data[0] == 0xD0 && data[1] == 0xDA;
+}
+
+static bool sim_append_info(struct hid_device_info ***tail, const char *path,
+                            uint16_t vendor_id, uint16_t product_id,
+                            const wchar_t *serial, uint16_t release_number,
+                            uint16_t usage_page, int interface_number) {
+  struct hid_device_info *info =
+      (struct hid_device_info *)calloc(1, sizeof(struct hid_device_info));
+  if (!info)
+    return false;
+
+  size_t path_len = strlen(path) + 1;
+  info->path = (char *)malloc(path_len);
+  if (info->path)
+    memcpy(info->path, path, path_len);
+  if (serial && serial[0]) {
+    size_t serial_len = wcslen(serial) + 1;
+    info->serial_number = (wchar_t *)malloc(serial_len * sizeof(wchar_t));
+    if (info->serial_number)
+      memcpy(info->serial_number, serial, serial_len * sizeof(wchar_t));
+  }
+  info->vendor_id = vendor_id;
+  info->product_id = product_id;
+  info->release_number = release_number;
+  info->usage_page = usage_page;
+  info->interface_number = interface_number;
+
+  **tail = info;
+  *tail = &info->next;
+  return true;
+}
+
+static struct hid_device_info *sim_enumerate(unsigned short vendor_id,
+                                             unsigned short product_id) {
+  struct hid_device_info *head = NULL;
+  struct hid_device_info **tail = &head;
+  uint32_t bus_size = sim_foreign_devices;
+
+  sim_enumerations++;
+
+  for (int i = 0; i < WOOTING_USB_SIM_MAX_DEVICES; i++) {
+    WOOTING_USB_SIM_DEVICE *device = &sim_devices[i];
+    if (!device->present || device->unplugged)
+      continue;
+    bus_size++;
+    if (vendor_id && vendor_id != device->vendor_id)
+      continue;
+    if (product_id && product_id != device->product_id)
+      continue;
+
+    if (!sim_append_info(&tail, device->path, device->vendor_id,
+                         device->product_id, device->serial,
+                         device->release_number, SIM_CFG_USAGE_PAGE, 2))
+      break;
+  }
+
+  for (uint16_t i = 0; i < sim_foreign_devices; i++) {
+    uint16_t foreign_pid = SIM_FOREIGN_PID + i;
+    if (vendor_id && vendor_id != SIM_FOREIGN_VID)
+      break;
+    if (product_id && product_id != foreign_pid)
+      continue;
+
+    if (!sim_append_info(&tail, "sim:foreign", SIM_FOREIGN_VID, foreign_pid,
+                         NULL, 0, SIM_FOREIGN_USAGE_PAGE, 0))
+      break;
+  }
+
+  // Like a real bus scan, every device present is visited regardless of the
+  // filter
+  if (sim_scan_latency_us)
+    wooting_platform_sleep_us((uint64_t)sim_scan_latency_us * bus_size);
+
+  return head;
+}
+
+static void sim_free_enumeration(struct hid_device_info *devs) {
+  while (devs) {
+    struct hid_device_info *next = devs->next;
+    free(devs->path);
+    free(devs->serial_number);
+    free(devs);
+    devs = next;
+  }
+}
+
+static struct hid_device_ *sim_open_path(const char *path) {
+  for (int i = 0; i < WOOTING_USB_SIM_MAX_DEVICES; i++) {
+    WOOTING_USB_SIM_DEVICE *device = &sim_devices[i];
+    if (device->present && !device->unplugged &&
+        strcmp(device->path, path) == 0) {
+      device->state.open = true;
+      device->small_packet_index = 0;
+      device->response_len = device->response_pos = 0;
+      return (struct hid_device_ *)device;
+    }
+  }
+
+  return NULL;
+}
+
+static void sim_close(struct hid_device_ *dev) {
+  WOOTING_USB_SIM_DEVICE *device = (WOOTING_USB_SIM_DEVICE *)dev;
+  if (device)
+    device->state.open = false;
+}
+
+static bool sim_decode_v1_report(WOOTING_USB_SIM_DEVICE *device,
+                                 const uint8_t *data) {
+  if (!sim_has_magic(&data[1]) || data[3] != WOOTING_RAW_COLORS_REPORT)
+    return false;
+
+  uint16_t crc = sim_crc16ccitt(data, SIM_V1_REPORT_SIZE - 2);
+  if (data[127] != (uint8_t)crc || data[128] != (uint8_t)(crc >> 8))
+    return false;
+
+  // Slave nr and register start address together select the part
+  uint8_t part = data[4] * 2 + (data[5] == RGB_RAW_BUFFER_SIZE ? 1 : 0);
+  if (part > PART4)
+    return false;
+
+  memcpy(device->state.v1_parts[part], &data[6], RGB_RAW_BUFFER_SIZE);
+  if (part == PART0)
+    device->state.frames++;
+
+  return true;
+}
+
+static bool sim_decode_v2_report(WOOTING_USB_SIM_DEVICE *device,
+                                 const uint8_t *data) {
+  if (!sim_has_magic(&data[1]) || data[3] != WOOTING_RAW_COLORS_REPORT)
+    return false;
+
+  memcpy(device->state.matrix, &data[4], sizeof(device->state.matrix));
+  device->state.frames++;
+  return true;
+}
+
+static bool sim_decode_small_packet(WOOTING_USB_SIM_DEVICE *device,
+                                    const uint8_t *data) {
+  // The first packet of a frame carries the magic word, use it to resync
+  if (sim_has_magic(&data[1]) && data[3] == WOOTING_RAW_COLORS_REPORT)
+    device->small_packet_index = 0;
+
+  memcpy(&device->report[device->small_packet_index * SIM_SMALL_PACKET_SIZE +
+                         1],
+         &data[1], SIM_SMALL_PACKET_SIZE);
+
+  if (++device->small_packet_index < SIM_SMALL_PACKET_COUNT)
+    return true;
+
+  device->small_packet_index = 0;
+  return sim_decode_v2_report(device, device->report);
+}
+
+static int sim_write(struct hid_device_ *dev, const unsigned char *data,
+                     size_t length) {
+  WOOTING_USB_SIM_DEVICE *device = (WOOTING_USB_SIM_DEVICE *)dev;
+  if (!device || !device->present || device->unplugged || !device->state.open)
+    return -1;
+
+  wooting_platform_sleep_us(device->write_latency_us);
+
+  if (device->failing_writes > 0) {
+    device->failing_writes--;
+    return -1;
+  }
+
+  bool valid;
+  if (!sim_is_v2(device) && length == SIM_V1_REPORT_SIZE) {
+    valid = sim_decode_v1_report(device, data);
+  } else if (sim_is_v2(device) && !device->small_packets &&
+             length == SIM_V2_REPORT_SIZE) {
+    valid = sim_decode_v2_report(device, data);
+  } else if (sim_is_v2(device) && device->small_packets &&
+             length == SIM_SMALL_PACKET_SIZE + 1) {
+    valid = sim_decode_small_packet(device, data);
+  } else {
+    // The report size doesn't match the descriptor, so the OS would refuse
+    // the write
+    device->state.bad_reports++;
+    return -1;
+  }
+
+  if (!valid)
+    device->state.bad_reports++;
+  device->state.writes++;
+  return (int)length;
+}
+
+static void sim_set_v1_led(WOOTING_USB_SIM_DEVICE *device, uint8_t led_index,
+                           uint8_t red, uint8_t green, uint8_t blue) {
+  uint8_t part = led_index / 24;
+  if (part > PART4)
+    return;
+
+  uint8_t offset = sim_pwm_mem_map[led_index % 24];
+  device->state.v1_parts[part][offset] = red;
+  device->state.v1_parts[part][offset + 0x10] = green;
+  device->state.v1_parts[part][offset + 0x20] = blue;
+}
+
+static void sim_set_v2_key(WOOTING_USB_SIM_DEVICE *device, uint8_t id,
+                           uint16_t color) {
+  KeyboardMatrixID key;
+  memcpy(&key, &id, sizeof(key));
+  if (key.row < WOOTING_RGB_ROWS && key.column < WOOTING_RGB_COLS)
+    device->state.matrix[key.row][key.column] = color;
+}
+
+static int sim_send_feature_report(struct hid_device_ *dev,
+                                   const unsigned char *data, size_t length) {
+  WOOTING_USB_SIM_DEVICE *device = (WOOTING_USB_SIM_DEVICE *)dev;
+  if (!device || !device->present || device->unplugged || !device->state.open)
+    return -1;
+
+  wooting_platform_sleep_us(device->feature_latency_us);
+
+  if (length != SIM_COMMAND_SIZE || !sim_has_magic(&data[1])) {
+    device->state.bad_reports++;
+    return -1;
+  }
+
+  uint8_t command = data[3];
+  uint8_t parameter3 = data[4];
+  uint8_t parameter2 = data[5];
+  uint8_t parameter1 = data[6];
+  uint8_t parameter0 = data[7];
+  bool v2 = sim_is_v2(device);
+
+  device->state.features++;
+  device->state.last_command = command;
+
+  device->response_len = v2 ? SIM_V2_RESPONSE_SIZE : SIM_V1_RESPONSE_SIZE;
+  device->response_pos = 0;
+  memset(device->response, 0, sizeof(device->response));
+  device->response[0] = 0xD0;
+  device->response[1] = 0xDA;
+  device->response[2] = command;
+
+  switch (command) {
+  case WOOTING_DEVICE_CONFIG_COMMAND: {
+    device->response[v2 ? SIM_V2_LAYOUT_INDEX : SIM_V1_LAYOUT_INDEX] =
+        (uint8_t)device->layout;
+    break;
+  }
+  case WOOTING_SINGLE_COLOR_COMMAND: {
+    if (v2) {
+      sim_set_v2_key(device, parameter0,
+                     sim_encode_color(parameter1, parameter2, parameter3));
+    } else {
+      sim_set_v1_led(device, parameter0, parameter1, parameter2, parameter3);
+    }
+    break;
+  }
+  case WOOTING_SINGLE_RESET_COMMAND: {
+    if (v2) {
+      sim_set_v2_key(device, parameter3, 0);
+    } else {
+      sim_set_v1_led(device, parameter3, 0, 0, 0);
+    }
+    break;
+  }
+  case WOOTING_RESET_ALL_COMMAND: {
+    memset(device->state.matrix, 0, sizeof(device->state.matrix));
+    memset(device->state.v1_parts, 0, sizeof(device->state.v1_parts));
+    break;
+  }
+  default:
+    break;
+  }
+
+  return (int)length;
+}
+
+static int sim_read_timeout(struct hid_device_ *dev, unsigned char *data,
+                            size_t length, int milliseconds) {
+  WOOTING_USB_SIM_DEVICE *device = (WOOTING_USB_SIM_DEVICE *)dev;
+  if (!device || !device->present || device->unplugged || !device->state.open)
+    return -1;
+
+  // Nothing queued means a real device would time out, there's no point in
+  // actually waiting for that here
+  size_t pending = device->response_len - device->response_pos;
+  if (pending == 0)
+    return 0;
+
+  size_t count = length < pending ? length : pending;
+  memcpy(data, &device->response[device->response_pos], count);
+  device->response_pos += count;
+  return (int)count;
+}
+
+static int sim_get_report_descriptor(struct hid_device_ *dev,
+                                     unsigned char *buf, size_t buf_size) {
+  WOOTING_USB_SIM_DEVICE *device = (WOOTING_USB_SIM_DEVICE *)dev;
+  if (!device || !device->present)
+    return -1;
+
+  // Vendor defined output report, with either a one byte (64) or two byte
+  // (256) report count, which is what the SDK looks for
+  const uint8_t small_descriptor[] = {0x06, 0x37, 0x13, 0x09, 0x01, 0xA1,
+                                      0x01, 0x75, 0x08, 0x95, 0x40, 0x09,
+                                      0x02, 0x91, 0x02, 0xC0};
+  const uint8_t big_descriptor[] = {0x06, 0x37, 0x13, 0x09, 0x01, 0xA1,
+                                    0x01, 0x75, 0x08, 0x96, 0x00, 0x01,
+                                    0x09, 0x02, 0x91, 0x02, 0xC0};
+
+  const uint8_t *descriptor =
+      device->small_packets ? small_descriptor : big_descriptor;
+  size_t len = device->small_packets ? sizeof(small_descriptor)
+                                     : sizeof(big_descriptor);
+  if (buf_size < len)
+    return -1;
+
+  memcpy(buf, descriptor, len);
+  return (int)len;
+}
+
+static const WOOTING_USB_TRANSPORT sim_transport = {
+    .enumerate = sim_enumerate,
+    .free_enumeration = sim_free_enumeration,
+    .open_path = sim_open_path,
+    .close = sim_close,
+    .write = sim_write,
+    .send_feature_report = sim_send_feature_report,
+    .read_timeout = sim_read_timeout,
+    .get_report_descriptor = sim_get_report_descriptor,
+};
+
+const WOOTING_USB_TRANSPORT *wooting_usb_sim_transport(void) {
+  return &sim_transport;
+}
+
+int wooting_usb_sim_add_device(uint16_t vendor_id, uint16_t product_id,
+                               bool small_packets,
+                               WOOTING_DEVICE_LAYOUT layout) {
+  for (int i = 0; i < WOOTING_USB_SIM_MAX_DEVICES; i++) {
+    WOOTING_USB_SIM_DEVICE *device = &sim_devices[i];
+    if (device->present)
+      continue;
+
+    memset(device, 0, sizeof(*device));
+    device->present = true;
+    device->vendor_id = vendor_id;
+    device->product_id = product_id;
+    device->small_packets = small_packets;
+    device->layout = layout;
+    snprintf(device->path, sizeof(device->path), "sim:%d", i);
+    swprintf(device->serial, sizeof(device->serial) / sizeof(wchar_t),
+             L"SIM%04d", i);
+    device->release_number = 0x0100;
+    return i;
+  }
+
+  return -1;
+}
+
+void wooting_usb_sim_remove_all(void) {
+  memset(sim_devices, 0, sizeof(sim_devices));
+  sim_foreign_devices = 0;
+}
+
+void wooting_usb_sim_set_bus(uint16_t foreign_devices,
+                             uint32_t scan_latency_us) {
+  sim_foreign_devices = foreign_devices;
+  sim_scan_latency_us = scan_latency_us;
+}
+
+uint32_t wooting_usb_sim_enumerate_count(void) { return sim_enumerations; }
+
+static WOOTING_USB_SIM_DEVICE *sim_get_device(int sim_index) {
+  if (sim_index < 0 || sim_index >= WOOTING_USB_SIM_MAX_DEVICES ||
+      !sim_devices[sim_index].present)
+    return NULL;
+
+  return &sim_devices[sim_index];
+}
+
+bool wooting_usb_sim_set_latency(int sim_index, uint32_t write_latency_us,
+                                 uint32_t feature_latency_us) {
+  WOOTING_USB_SIM_DEVICE *device = sim_get_device(sim_index);
+  if (!device)
+    return false;
+
+  device->write_latency_us = write_latency_us;
+  device->feature_latency_us = feature_latency_us;
+  return true;
+}
+
+bool wooting_usb_sim_get_state(int sim_index, WOOTING_USB_SIM_STATE *state) {
+  WOOTING_USB_SIM_DEVICE *device = sim_get_device(sim_index);
+  if (!device || !state)
+    return false;
+
+  *state = device->state;
+  return true;
+}
+
+bool wooting_usb_sim_set_plugged(int sim_index, bool plugged) {
+  WOOTING_USB_SIM_DEVICE *device = sim_get_device(sim_index);
+  if (!device)
+    return false;
+
+  if (plugged && device->unplugged) {
+    device->generation++;
+    snprintf(device->path, sizeof(device->path), "sim:%d.%u", sim_index,
+             device->generation);
+  }
+  device->unplugged = !plugged;
+  if (!plugged)
+    device->state.open = false;
+  return true;
+}
+
+bool wooting_usb_sim_fail_writes(int sim_index, uint32_t count) {
+  WOOTING_USB_SIM_DEVICE *device = sim_get_device(sim_index);
+  if (!device)
+    return false;
+
+  device->failing_writes = count;
+  return true;
+}
+
+bool wooting_usb_sim_set_identity(int sim_index, const wchar_t *serial,
+                                  uint16_t release_number) {
+  WOOTING_USB_SIM_DEVICE *device = sim_get_device(sim_index);
+  if (!device)
+    return false;
+
+  device->serial[0] = L'\0';
+  if (serial)
+    wcsncat(device->serial, serial,
+            sizeof(device->serial) / sizeof(wchar_t) - 1);
+  device->release_number = release_number;
+  return true;
+}
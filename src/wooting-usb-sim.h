@@ -0,0 +1,110 @@
+/*
+ * Copyright 2018 Wooting Technologies B.V.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "wooting-usb.h"
+
+// Simulated Wooting keyboards that live entirely in-process. Hand the
+// transport from wooting_usb_sim_transport() to wooting_usb_set_transport()
+// and the SDK will enumerate, initialise and send frames to these devices
+// exactly as it would to real hardware, which lets throughput and latency be
+// measured on machines without a board attached.
+
+#define WOOTING_USB_SIM_MAX_DEVICES 16
+
+typedef struct WOOTING_USB_SIM_STATE {
+  bool open;
+  // Total number of successful hid_write calls
+  uint32_t writes;
+  // Number of complete colour frames decoded. For v1 devices every PART0
+  // report starts a new frame
+  uint32_t frames;
+  // Reports that failed the CRC check or were otherwise malformed
+  uint32_t bad_reports;
+  // Number of feature reports received
+  uint32_t features;
+  uint8_t last_command;
+  // Colours currently shown by a v2 device
+  uint16_t matrix[WOOTING_RGB_ROWS][WOOTING_RGB_COLS];
+  // Raw LED driver memory of a v1 device, one buffer per RGB_PARTS entry
+  uint8_t v1_parts[PART4 + 1][RGB_RAW_BUFFER_SIZE];
+} WOOTING_USB_SIM_STATE;
+
+/// @brief Returns a transport that talks to the simulated devices
+WOOTINGRGBSDK_API const WOOTING_USB_TRANSPORT *wooting_usb_sim_transport(void);
+
+/// @brief Plugs in a simulated keyboard
+/// @param vendor_id USB VID, v1 devices use 0x03EB, v2 devices 0x31E3
+/// @param product_id USB PID of the model that should be simulated
+/// @param small_packets Whether the device reports 64 byte output reports
+/// @param layout The layout reported for WOOTING_DEVICE_CONFIG_COMMAND
+/// @return Index of the simulated device, -1 if there's no room left
+WOOTINGRGBSDK_API int wooting_usb_sim_add_device(uint16_t vendor_id,
+                                                 uint16_t product_id,
+                                                 bool small_packets,
+                                                 WOOTING_DEVICE_LAYOUT layout);
+
+/// @brief Unplugs all simulated devices, including foreign ones
+///
+/// Should only be called when the SDK is disconnected from them
+WOOTINGRGBSDK_API void wooting_usb_sim_remove_all(void);
+
+/// @brief Describes the rest of the simulated bus
+/// @param foreign_devices Number of non-Wooting HID devices that show up in
+/// enumeration next to the simulated keyboards
+/// @param scan_latency_us Time every enumerate call spends per device on the
+/// bus, whether or not it matches the VID/PID filter
+WOOTINGRGBSDK_API void wooting_usb_sim_set_bus(uint16_t foreign_devices,
+                                               uint32_t scan_latency_us);
+
+/// @brief Returns how many times the bus has been enumerated
+WOOTINGRGBSDK_API uint32_t wooting_usb_sim_enumerate_count(void);
+
+/// @brief Sets how long each write and feature report takes to complete
+/// @param sim_index Index returned by wooting_usb_sim_add_device
+/// @param write_latency_us Time spent in every write call
+/// @param feature_latency_us Time spent in every feature report round-trip
+/// @return false if the index is out of range
+WOOTINGRGBSDK_API bool wooting_usb_sim_set_latency(int sim_index,
+                                                   uint32_t write_latency_us,
+                                                   uint32_t feature_latency_us);
+
+/// @brief Unplugs or replugs a simulated device
+///
+/// Handles to an unplugged device fail until it's opened again. A replugged
+/// device comes back under a new path, like a board moved to another port.
+/// @return false if the index is out of range
+WOOTINGRGBSDK_API bool wooting_usb_sim_set_plugged(int sim_index,
+                                                   bool plugged);
+
+/// @brief Makes the next count writes to a device fail
+/// @return false if the index is out of range
+WOOTINGRGBSDK_API bool wooting_usb_sim_fail_writes(int sim_index,
+                                                   uint32_t count);
+
+/// @brief Sets the serial number and firmware version a device enumerates with
+///
+/// Devices start out with serial "SIMnnnn" and version 0x0100.
+/// @param serial The serial number, NULL for a device without one
+/// @return false if the index is out of range
+WOOTINGRGBSDK_API bool wooting_usb_sim_set_identity(int sim_index,
+                                                    const wchar_t *serial,
+                                                    uint16_t release_number);
+
+/// @brief Copies the current state of a simulated device
+/// @return false if the index is out of range
+WOOTINGRGBSDK_API bool wooting_usb_sim_get_state(int sim_index,
+                                                 WOOTING_USB_SIM_STATE *state);
+
+#ifdef __cplusplus
+}
+#endif
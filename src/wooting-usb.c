@@ -9,6 +9,8 @@
 #include "hidapi.h"
 #include "stdlib.h"
 #include "string.h"
+#include "wooting-platform.h"
+#include "wooting-trace.h"
 #include "wooting-rgb-sdk.h"
 
 #define WOOTING_COMMAND_SIZE 8
@@ -21,6 +23,13 @@
 
 #define WOOTING_READ_RESPONSE_TIMEOUT 1000
 
+// A failed transfer is retried with a doubling backoff, and the device is
+// reopened through its cached path before the last attempt
+#define WOOTING_IO_ATTEMPTS 3
+#define WOOTING_IO_BACKOFF_US 1000
+// How often we try to bring back a device that was dropped
+#define WOOTING_RECOVER_INTERVAL_US 1000000
+
 #define WOOTING_VID 0x03EB
 #define WOOTING_VID2 0x31e3
 
@@ -51,38 +60,184 @@
 static WOOTING_USB_META *wooting_usb_meta;
 
 static void_cb disconnected_callback = NULL;
-static hid_device *keyboard_handle = NULL;
 
 static WOOTING_USB_META wooting_usb_meta_array[WOOTING_MAX_RGB_DEVICES];
 static hid_device *keyboard_handle_array[WOOTING_MAX_RGB_DEVICES];
 
 static uint8_t connected_keyboards = 0;
+static uint8_t selected_device = 0;
 static bool enumerating = false;
 
-static void debug_print_buffer(uint8_t *buff, size_t len);
+// The layout takes a feature round-trip to find out, so it's only asked for
+// the first time somebody wants to know it
+static bool layout_detected_array[WOOTING_MAX_RGB_DEVICES];
+
+// Profile cache entry of each device, see wooting-usb-profile.c. A keyed
+// device has a serial the cache can use, a cached one was set up from it
+static WOOTING_USB_PROFILE device_profile_array[WOOTING_MAX_RGB_DEVICES];
+static bool profile_keyed_array[WOOTING_MAX_RGB_DEVICES];
+static bool profile_cached_array[WOOTING_MAX_RGB_DEVICES];
+// A cached device whose report descriptor hasn't been read yet. Whichever
+// gets to it first, the background check or a transfer, reads it under the
+// device lock, so no frame goes out in a stale packet size
+static bool packet_size_pending_array[WOOTING_MAX_RGB_DEVICES];
+// Checks the devices that were set up from the cache against the real thing
+static wooting_thread profile_thread;
+static bool profile_thread_running = false;
+
+// Serialises the I/O on each handle, as hidapi isn't safe to use from multiple
+// threads on the same device
+static wooting_mutex device_lock_array[WOOTING_MAX_RGB_DEVICES];
+static bool device_locks_initialised = false;
+
+// What we need to find a device again after its handle failed. A failed
+// device is dropped (its handle is closed and set to NULL) while keeping its
+// index, and is brought back through its path or a fresh enumeration, so one
+// flaky device doesn't take the others down with it
+typedef struct WOOTING_USB_RECOVERY {
+  char *path;
+  uint16_t vendor_id;
+  uint16_t product_id;
+  uint64_t last_attempt_us;
+} WOOTING_USB_RECOVERY;
+
+static WOOTING_USB_RECOVERY device_recovery_array[WOOTING_MAX_RGB_DEVICES];
+static wooting_atomic dropped_devices = 0;
+// Held while a dropped device is looked for on the bus, so two of them can't
+// claim the same interface. It also guards the cached paths and
+// connected_keyboards against the hotplug monitor thread. When both are
+// needed, the device lock is always taken first
+static wooting_mutex recover_lock;
+
+// Set by the hotplug monitor when a Wooting device shows up. While the
+// monitor runs, the bus is only enumerated again after that happened
+static wooting_atomic hotplug_rescan = 1;
+static void_cb hotplug_arrival_callback = NULL;
+static void_cb hotplug_removal_callback = NULL;
+
+typedef struct WOOTING_USB_LATENCY_COUNTERS {
+  wooting_atomic buckets[WOOTING_USB_LATENCY_BUCKETS];
+  wooting_atomic count;
+  wooting_atomic64 total_us;
+  wooting_atomic max_us;
+} WOOTING_USB_LATENCY_COUNTERS;
+
+// Atomic counterpart of WOOTING_USB_STATS. The I/O paths update it from
+// whichever thread they run on without taking a lock
+typedef struct WOOTING_USB_COUNTERS {
+  wooting_atomic64 bytes_written;
+  wooting_atomic writes;
+  wooting_atomic write_errors;
+  wooting_atomic features;
+  wooting_atomic timeouts;
+  wooting_atomic retries;
+  wooting_atomic disconnects;
+  wooting_atomic reconnects;
+  WOOTING_USB_LATENCY_COUNTERS write_latency;
+  WOOTING_USB_LATENCY_COUNTERS feature_latency;
+} WOOTING_USB_COUNTERS;
+
+// Kept apart from the per device state as they survive reconnects
+static WOOTING_USB_COUNTERS device_counters_array[WOOTING_MAX_RGB_DEVICES];
+static WOOTING_USB_LATENCY_COUNTERS enumeration_counters;
+
+static const WOOTING_USB_TRANSPORT hidapi_transport = {
+    .enumerate = hid_enumerate,
+    .free_enumeration = hid_free_enumeration,
+    .open_path = hid_open_path,
+    .close = hid_close,
+    .write = hid_write,
+    .send_feature_report = hid_send_feature_report,
+    .read_timeout = hid_read_timeout,
+    .get_report_descriptor = hid_get_report_descriptor,
+};
+
+static const WOOTING_USB_TRANSPORT *transport = &hidapi_transport;
+
+static int wooting_usb_send_feature_buff(hid_device *handle, uint8_t commandId,
+                                         uint8_t parameter0,
+                                         uint8_t parameter1,
+                                         uint8_t parameter2,
+                                         uint8_t parameter3);
+static int wooting_usb_handle_read_response_timeout(hid_device *handle,
+                                                    uint8_t *buff, size_t len,
+                                                    int milliseconds);
+
+static void wooting_usb_record_latency(WOOTING_USB_LATENCY_COUNTERS *counters,
+                                       uint64_t elapsed_us) {
+  uint8_t bucket = 0;
+  for (uint64_t rest = elapsed_us >> 1;
+       rest && bucket < WOOTING_USB_LATENCY_BUCKETS - 1; rest >>= 1) {
+    bucket++;
+  }
+  if (elapsed_us > INT32_MAX)
+    elapsed_us = INT32_MAX;
+
+  wooting_atomic_add(&counters->buckets[bucket], 1);
+  wooting_atomic_add(&counters->count, 1);
+  wooting_atomic64_add(&counters->total_us, (int64_t)elapsed_us);
+  wooting_atomic_max(&counters->max_us, (int32_t)elapsed_us);
+}
+
+static void
+wooting_usb_copy_latency(WOOTING_USB_LATENCY_HISTOGRAM *histogram,
+                         WOOTING_USB_LATENCY_COUNTERS *counters) {
+  for (uint8_t i = 0; i < WOOTING_USB_LATENCY_BUCKETS; i++) {
+    histogram->buckets[i] =
+        (uint32_t)wooting_atomic_load(&counters->buckets[i]);
+  }
+  histogram->count = (uint32_t)wooting_atomic_load(&counters->count);
+  histogram->total_us = (uint64_t)wooting_atomic64_load(&counters->total_us);
+  histogram->max_us = (uint32_t)wooting_atomic_load(&counters->max_us);
+}
 
-static uint16_t getCrc16ccitt(const uint8_t *buffer, uint16_t size) {
+// CRC-16/CCITT (polynomial 0x1021) of every possible top byte, so the CRC
+// can be worked out a byte at a time instead of a bit at a time
+static const uint16_t crc16ccitt_table[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+    0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+    0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+    0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+    0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+    0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+    0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+    0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+    0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+    0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+    0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+    0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+    0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+    0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+    0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+    0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+    0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+    0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+    0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+    0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+    0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+    0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+};
+
+uint16_t wooting_usb_crc16ccitt(const uint8_t *buffer, uint16_t size) {
   uint16_t crc = 0;
 
   while (size--) {
-    crc ^= (*buffer++ << 8);
-
-    for (uint8_t i = 0; i < 8; ++i) {
-      if (crc & 0x8000) {
-        crc = (crc << 1) ^ 0x1021;
-      } else {
-        crc = crc << 1;
-      }
-    }
+    crc = (uint16_t)(crc << 8) ^ crc16ccitt_table[(crc >> 8) ^ *buffer++];
   }
 
   return crc;
 }
 
-typedef void (*set_meta_func)(WOOTING_USB_META *device_meta);
-void walk_hid_devices(struct hid_device_info *hid_info_walker,
-                      set_meta_func meta_func);
-
 static void reset_meta(WOOTING_USB_META *device_meta) {
   device_meta->connected = false;
 
@@ -96,121 +251,119 @@ static void reset_meta(WOOTING_USB_META *device_meta) {
   device_meta->uses_small_packets = false;
 }
 
-static void set_meta_wooting_one(WOOTING_USB_META *device_meta) {
-  device_meta->model = "Wooting One";
-  device_meta->device_type = DEVICE_KEYBOARD_TKL;
-  device_meta->max_rows = WOOTING_RGB_ROWS;
-  device_meta->max_columns = WOOTING_ONE_RGB_COLS;
-  device_meta->led_index_max = WOOTING_ONE_KEY_CODE_LIMIT;
-  device_meta->v2_interface = false;
-  device_meta->uses_small_packets = false;
-}
-
-static void set_meta_wooting_one_v2(WOOTING_USB_META *device_meta) {
-  set_meta_wooting_one(device_meta);
-  device_meta->v2_interface = true;
-}
-
-static void set_meta_wooting_two(WOOTING_USB_META *device_meta) {
-  device_meta->model = "Wooting Two";
-  device_meta->device_type = DEVICE_KEYBOARD;
-  device_meta->max_rows = WOOTING_RGB_ROWS;
-  device_meta->max_columns = WOOTING_TWO_RGB_COLS;
-  device_meta->led_index_max = WOOTING_TWO_KEY_CODE_LIMIT;
-  device_meta->v2_interface = false;
-  device_meta->uses_small_packets = false;
-}
-
-static void set_meta_wooting_two_v2(WOOTING_USB_META *device_meta) {
-  set_meta_wooting_two(device_meta);
-  device_meta->v2_interface = true;
-}
-
-static void set_meta_wooting_two_le(WOOTING_USB_META *device_meta) {
-  device_meta->model = "Wooting Two Lekker Edition";
-  device_meta->device_type = DEVICE_KEYBOARD;
-  device_meta->max_rows = WOOTING_RGB_ROWS;
-  device_meta->max_columns = WOOTING_TWO_RGB_COLS;
-  device_meta->led_index_max = WOOTING_TWO_KEY_CODE_LIMIT;
-  device_meta->v2_interface = true;
-  device_meta->uses_small_packets = false;
-}
-
-static void set_meta_wooting_two_he(WOOTING_USB_META *device_meta) {
-  device_meta->model = "Wooting Two HE";
-  device_meta->device_type = DEVICE_KEYBOARD;
-  device_meta->max_rows = WOOTING_RGB_ROWS;
-  device_meta->max_columns = WOOTING_TWO_RGB_COLS;
-  device_meta->led_index_max = WOOTING_TWO_KEY_CODE_LIMIT;
-  device_meta->v2_interface = true;
-  device_meta->uses_small_packets = false;
-}
-
-static void set_meta_wooting_two_he_arm(WOOTING_USB_META *device_meta) {
-  device_meta->model = "Wooting Two HE (ARM)";
-  device_meta->device_type = DEVICE_KEYBOARD;
-  device_meta->max_rows = WOOTING_RGB_ROWS;
-  device_meta->max_columns = WOOTING_TWO_RGB_COLS;
-  device_meta->led_index_max = WOOTING_TWO_KEY_CODE_LIMIT;
-  device_meta->v2_interface = true;
-  device_meta->uses_small_packets = true;
-}
-
-static void set_meta_wooting_60he(WOOTING_USB_META *device_meta) {
-  device_meta->model = "Wooting 60HE";
-  device_meta->device_type = DEVICE_KEYBOARD_60;
-  device_meta->max_rows = WOOTING_RGB_ROWS;
-  device_meta->max_columns = 14;
-  device_meta->led_index_max = WOOTING_TWO_KEY_CODE_LIMIT;
-  device_meta->v2_interface = true;
-  device_meta->uses_small_packets = false;
-}
+// Every model the SDK knows about. Adding a model only needs a new row here,
+// as long as the rows stay sorted by VID and PID so lookups can do a binary
+// search. `order` is the position the model had in the old per-PID
+// enumeration, devices still get their index in that order.
+typedef struct WOOTING_DEVICE_DESCRIPTOR {
+  uint16_t vendor_id;
+  uint16_t product_id;
+  // Bit n set means product_id | n is also accepted (see V2_ALT_PID_X)
+  uint8_t alt_pid_mask;
+  uint8_t order;
+  const char *model;
+  WOOTING_DEVICE_TYPE device_type;
+  uint8_t max_columns;
+  uint8_t max_rows;
+  uint8_t led_index_max;
+  bool v2_interface;
+  bool uses_small_packets;
+} WOOTING_DEVICE_DESCRIPTOR;
+
+#define V1_PIDS (1 << V2_ALT_PID_0)
+#define V2_ALT_PIDS                                                            \
+  ((1 << V2_ALT_PID_0) | (1 << V2_ALT_PID_1) | (1 << V2_ALT_PID_2))
+
+static const WOOTING_DEVICE_DESCRIPTOR device_descriptors[] = {
+    {WOOTING_VID, WOOTING_ONE_PID, V1_PIDS, 0, "Wooting One",
+     DEVICE_KEYBOARD_TKL, WOOTING_ONE_RGB_COLS, WOOTING_RGB_ROWS,
+     WOOTING_ONE_KEY_CODE_LIMIT, false, false},
+    {WOOTING_VID, WOOTING_TWO_PID, V1_PIDS, 2, "Wooting Two", DEVICE_KEYBOARD,
+     WOOTING_TWO_RGB_COLS, WOOTING_RGB_ROWS, WOOTING_TWO_KEY_CODE_LIMIT, false,
+     false},
+    {WOOTING_VID2, WOOTING_ONE_V2_PID, V2_ALT_PIDS, 1, "Wooting One",
+     DEVICE_KEYBOARD_TKL, WOOTING_ONE_RGB_COLS, WOOTING_RGB_ROWS,
+     WOOTING_ONE_KEY_CODE_LIMIT, true, false},
+    {WOOTING_VID2, WOOTING_TWO_V2_PID, V2_ALT_PIDS, 3, "Wooting Two",
+     DEVICE_KEYBOARD, WOOTING_TWO_RGB_COLS, WOOTING_RGB_ROWS,
+     WOOTING_TWO_KEY_CODE_LIMIT, true, false},
+    {WOOTING_VID2, WOOTING_TWO_LE_PID, V2_ALT_PIDS, 4,
+     "Wooting Two Lekker Edition", DEVICE_KEYBOARD, WOOTING_TWO_RGB_COLS,
+     WOOTING_RGB_ROWS, WOOTING_TWO_KEY_CODE_LIMIT, true, false},
+    {WOOTING_VID2, WOOTING_TWO_HE_PID, V2_ALT_PIDS, 5, "Wooting Two HE",
+     DEVICE_KEYBOARD, WOOTING_TWO_RGB_COLS, WOOTING_RGB_ROWS,
+     WOOTING_TWO_KEY_CODE_LIMIT, true, false},
+    {WOOTING_VID2, WOOTING_TWO_HE_ARM_PID, V2_ALT_PIDS, 6,
+     "Wooting Two HE (ARM)", DEVICE_KEYBOARD, WOOTING_TWO_RGB_COLS,
+     WOOTING_RGB_ROWS, WOOTING_TWO_KEY_CODE_LIMIT, true, true},
+    {WOOTING_VID2, WOOTING_60HE_PID, V2_ALT_PIDS, 7, "Wooting 60HE",
+     DEVICE_KEYBOARD_60, 14, WOOTING_RGB_ROWS, WOOTING_TWO_KEY_CODE_LIMIT,
+     true, false},
+    {WOOTING_VID2, WOOTING_60HE_ARM_PID, V2_ALT_PIDS, 8, "Wooting 60HE (ARM)",
+     DEVICE_KEYBOARD_60, 14, WOOTING_RGB_ROWS, WOOTING_TWO_KEY_CODE_LIMIT,
+     true, true},
+    {WOOTING_VID2, WOOTING_60HE_PLUS_PID, V2_ALT_PIDS, 9, "Wooting 60HE+",
+     DEVICE_KEYBOARD_60, 14, WOOTING_RGB_ROWS, WOOTING_TWO_KEY_CODE_LIMIT,
+     true, true},
+    {WOOTING_VID2, WOOTING_80HE_PID, V2_ALT_PIDS, 12, "Wooting 80HE",
+     DEVICE_KEYBOARD_80, 17, WOOTING_RGB_ROWS, WOOTING_TWO_KEY_CODE_LIMIT,
+     true, false},
+    {WOOTING_VID2, WOOTING_UWU_PID, V2_ALT_PIDS, 10, "Wooting UwU",
+     DEVICE_KEYPAD_3KEY, 7, 5, 0, true, true},
+    {WOOTING_VID2, WOOTING_UWU_RGB_PID, V2_ALT_PIDS, 11, "Wooting UwU RGB",
+     DEVICE_KEYPAD_3KEY, 7, 5, 18, true, true},
+};
+
+#define DEVICE_DESCRIPTOR_COUNT                                                \
+  (sizeof(device_descriptors) / sizeof(device_descriptors[0]))
+
+// Returns the descriptor for the given VID/PID, NULL for foreign devices
+static const WOOTING_DEVICE_DESCRIPTOR *find_descriptor(uint16_t vendor_id,
+                                                        uint16_t product_id) {
+  if (vendor_id != WOOTING_VID && vendor_id != WOOTING_VID2)
+    return NULL;
 
-static void set_meta_wooting_60he_arm(WOOTING_USB_META *device_meta) {
-  device_meta->model = "Wooting 60HE (ARM)";
-  device_meta->device_type = DEVICE_KEYBOARD_60;
-  device_meta->max_rows = WOOTING_RGB_ROWS;
-  device_meta->max_columns = 14;
-  device_meta->led_index_max = WOOTING_TWO_KEY_CODE_LIMIT;
-  device_meta->v2_interface = true;
-  device_meta->uses_small_packets = true;
-}
+  // Find the last row that sorts at or before the VID/PID, an alternative PID
+  // sits just above its base PID
+  size_t low = 0, high = DEVICE_DESCRIPTOR_COUNT;
+  while (low < high) {
+    size_t mid = (low + high) / 2;
+    const WOOTING_DEVICE_DESCRIPTOR *row = &device_descriptors[mid];
+    if (row->vendor_id < vendor_id ||
+        (row->vendor_id == vendor_id && row->product_id <= product_id))
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  if (low == 0)
+    return NULL;
 
-static void set_meta_wooting_60he_plus(WOOTING_USB_META *device_meta) {
-  device_meta->model = "Wooting 60HE+";
-  device_meta->device_type = DEVICE_KEYBOARD_60;
-  device_meta->max_rows = WOOTING_RGB_ROWS;
-  device_meta->max_columns = 14;
-  device_meta->led_index_max = WOOTING_TWO_KEY_CODE_LIMIT;
-  device_meta->v2_interface = true;
-  device_meta->uses_small_packets = true;
-}
+  const WOOTING_DEVICE_DESCRIPTOR *row = &device_descriptors[low - 1];
+  uint16_t alt = product_id - row->product_id;
+  if (row->vendor_id != vendor_id || alt >= 8 ||
+      !(row->alt_pid_mask & (1 << alt)))
+    return NULL;
 
-static void set_meta_wooting_uwu_rgb(WOOTING_USB_META *device_meta) {
-  device_meta->model = "Wooting UwU RGB";
-  device_meta->device_type = DEVICE_KEYPAD_3KEY;
-  device_meta->max_rows = 5;
-  device_meta->max_columns = 7;
-  device_meta->led_index_max = 18;
-  device_meta->v2_interface = true;
-  device_meta->uses_small_packets = true;
+  return row;
 }
 
-static void set_meta_wooting_uwu(WOOTING_USB_META *device_meta) {
-  set_meta_wooting_uwu_rgb(device_meta);
-  device_meta->model = "Wooting UwU";
-  device_meta->led_index_max = 0;
+static void set_meta_from_descriptor(WOOTING_USB_META *device_meta,
+                                     const WOOTING_DEVICE_DESCRIPTOR *desc) {
+  device_meta->model = desc->model;
+  device_meta->device_type = desc->device_type;
+  device_meta->max_rows = desc->max_rows;
+  device_meta->max_columns = desc->max_columns;
+  device_meta->led_index_max = desc->led_index_max;
+  device_meta->v2_interface = desc->v2_interface;
+  device_meta->uses_small_packets = desc->uses_small_packets;
 }
 
-static void set_meta_wooting_80he(WOOTING_USB_META *device_meta) {
-  device_meta->model = "Wooting 80HE";
-  device_meta->device_type = DEVICE_KEYBOARD_80;
-  device_meta->max_rows = WOOTING_RGB_ROWS;
-  device_meta->max_columns = 17;
-  device_meta->led_index_max = WOOTING_TWO_KEY_CODE_LIMIT;
-  device_meta->v2_interface = true;
-  device_meta->uses_small_packets = false;
-}
+static void open_device(const struct hid_device_info *info,
+                        const WOOTING_DEVICE_DESCRIPTOR *desc);
+static void init_devices(uint8_t first_index);
+static void confirm_packet_size(uint8_t device_index);
+static void profile_revalidate_start(void);
+static void profile_revalidate_stop(void);
 
 WOOTING_USB_META *wooting_usb_get_meta() {
   // We want to initialise the struct to the default values if it hasn't been
@@ -230,50 +383,259 @@ void wooting_usb_disconnect(bool trigger_cb) {
 #ifdef DEBUG_LOG
   printf("Keyboard disconnected\n");
 #endif
+  // Background writers have to be gone before their handles are closed
+  wooting_rgb_async_stop();
+  profile_revalidate_stop();
+  wooting_rgb_reset_device_state();
+
+  // The hotplug monitor may be looking at the devices, so handles are only
+  // touched under their lock
   for (uint8_t i = 0; i < connected_keyboards; i++) {
+    wooting_mutex_lock(&device_lock_array[i]);
+    wooting_mutex_lock(&recover_lock);
     reset_meta(&wooting_usb_meta_array[i]);
+    layout_detected_array[i] = false;
+    packet_size_pending_array[i] = false;
     if (keyboard_handle_array[i]) {
-      hid_close(keyboard_handle_array[i]);
-      keyboard_handle_array[i] = keyboard_handle = NULL;
+      transport->close(keyboard_handle_array[i]);
+      keyboard_handle_array[i] = NULL;
     }
+    free(device_recovery_array[i].path);
+    memset(&device_recovery_array[i], 0, sizeof(device_recovery_array[i]));
+    wooting_mutex_unlock(&recover_lock);
+    wooting_mutex_unlock(&device_lock_array[i]);
   }
+  wooting_atomic_store(&dropped_devices, 0);
 
   if (trigger_cb && disconnected_callback) {
     disconnected_callback();
   }
 
+  wooting_mutex_lock(&recover_lock);
   connected_keyboards = 0;
+  wooting_mutex_unlock(&recover_lock);
+}
+
+void wooting_usb_handle_device_failure(void) {
+  // The failed device has already been dropped, we only give up on the rest
+  // when it was the last one
+  if (connected_keyboards > 0 &&
+      wooting_atomic_load(&dropped_devices) == connected_keyboards) {
+    wooting_usb_disconnect(true);
+  }
 }
 
 void wooting_usb_set_disconnected_cb(void_cb cb) { disconnected_callback = cb; }
 
-WOOTING_DEVICE_LAYOUT wooting_usb_get_layout() {
+void wooting_usb_set_transport(const WOOTING_USB_TRANSPORT *new_transport) {
+  // Handles opened through the old transport can't be used with the new one
+  if (connected_keyboards > 0) {
+    wooting_usb_disconnect(false);
+  }
+
+  transport = new_transport ? new_transport : &hidapi_transport;
+}
+
+const WOOTING_USB_TRANSPORT *wooting_usb_get_transport(void) {
+  return transport;
+}
+
+// Writes the profile of a device to the cache after one of its facts
+// changed. The copy is taken under the device lock, as the background check
+// may be updating it at the same time
+static void profile_update(uint8_t device_index, const bool *small_packets,
+                           const WOOTING_DEVICE_LAYOUT *layout) {
+  if (!profile_keyed_array[device_index])
+    return;
+
+  wooting_mutex_lock(&device_lock_array[device_index]);
+  WOOTING_USB_PROFILE *profile = &device_profile_array[device_index];
+  bool changed = false;
+  if (small_packets && profile->uses_small_packets != *small_packets) {
+    profile->uses_small_packets = *small_packets;
+    changed = true;
+  }
+  if (layout && profile->layout != *layout) {
+    profile->layout = *layout;
+    changed = true;
+  }
+  WOOTING_USB_PROFILE copy = *profile;
+  wooting_mutex_unlock(&device_lock_array[device_index]);
+
+  if (changed)
+    wooting_usb_profile_store(&copy);
+}
+
+// Returns false when the device didn't answer, so the layout gets asked for
+// again next time
+static bool wooting_usb_get_layout(uint8_t device_index,
+                                   WOOTING_DEVICE_LAYOUT *device_layout) {
   uint8_t buff[20];
-  int result = wooting_usb_send_feature_with_response(
-      buff, sizeof(buff), WOOTING_DEVICE_CONFIG_COMMAND, 0, 0, 0, 0);
+  int result = wooting_usb_device_send_feature_with_response(
+      device_index, buff, sizeof(buff), WOOTING_DEVICE_CONFIG_COMMAND, 0, 0, 0,
+      0);
   if (result != -1) {
-    uint8_t index = wooting_usb_use_v2_interface() ? 10 : 9;
+    uint8_t index = wooting_usb_meta_array[device_index].v2_interface ? 10 : 9;
     uint8_t layout = buff[index];
 #ifdef DEBUG_LOG
     printf("Layout result: %d, %d\n", layout, index);
 #endif
     if (layout <= LAYOUT_ISO)
-      return (WOOTING_DEVICE_LAYOUT)layout;
+      *device_layout = (WOOTING_DEVICE_LAYOUT)layout;
     else {
       printf("Unknown device layout found %d\n", layout);
-      return LAYOUT_UNKNOWN;
+      *device_layout = LAYOUT_UNKNOWN;
     }
+    return true;
   } else {
     printf(
         "Failed to get device config info for layout detection, result: %d\n",
         result);
   }
 
-  return LAYOUT_UNKNOWN;
+  return false;
+}
+
+WOOTING_DEVICE_LAYOUT wooting_usb_device_layout(uint8_t device_index) {
+  if (device_index >= WOOTING_MAX_RGB_DEVICES ||
+      device_index >= connected_keyboards)
+    return LAYOUT_UNKNOWN;
+
+  // Two threads asking at once both send the query, which is harmless
+  if (!layout_detected_array[device_index]) {
+    WOOTING_DEVICE_LAYOUT layout;
+    if (wooting_usb_get_layout(device_index, &layout)) {
+      wooting_mutex_lock(&device_lock_array[device_index]);
+      wooting_usb_meta_array[device_index].layout = layout;
+      wooting_mutex_unlock(&device_lock_array[device_index]);
+      layout_detected_array[device_index] = true;
+      profile_update(device_index, NULL, &layout);
+    }
+  }
+
+  wooting_mutex_lock(&device_lock_array[device_index]);
+  WOOTING_DEVICE_LAYOUT layout = wooting_usb_meta_array[device_index].layout;
+  wooting_mutex_unlock(&device_lock_array[device_index]);
+  return layout;
+}
+
+bool wooting_usb_device_small_packets(uint8_t device_index) {
+  if (device_index >= WOOTING_MAX_RGB_DEVICES ||
+      device_index >= connected_keyboards)
+    return false;
+
+  wooting_mutex_lock(&device_lock_array[device_index]);
+  confirm_packet_size(device_index);
+  bool small_packets = wooting_usb_meta_array[device_index].uses_small_packets;
+  wooting_mutex_unlock(&device_lock_array[device_index]);
+  return small_packets;
+}
+
+static void wooting_usb_init_locks(void) {
+  if (device_locks_initialised)
+    return;
+
+  for (uint8_t i = 0; i < WOOTING_MAX_RGB_DEVICES; i++) {
+    wooting_mutex_init(&device_lock_array[i]);
+  }
+  wooting_mutex_init(&recover_lock);
+  device_locks_initialised = true;
+}
+
+// Whether a device on the bus is one we already have, either opened through
+// the same path or the same model as a dropped device. The latter is left for
+// the dropped device to find again, so it keeps its index. claimed marks the
+// dropped devices that have been matched already
+static bool is_known_device(const struct hid_device_info *info, bool *claimed) {
+  bool known = false;
+  wooting_mutex_lock(&recover_lock);
+  for (uint8_t i = 0; i < connected_keyboards && !known; i++) {
+    known = device_recovery_array[i].path &&
+            strcmp(device_recovery_array[i].path, info->path) == 0;
+  }
+  wooting_mutex_unlock(&recover_lock);
+
+  for (uint8_t i = 0; i < connected_keyboards && !known; i++) {
+    if (claimed[i] || device_recovery_array[i].vendor_id != info->vendor_id ||
+        device_recovery_array[i].product_id != info->product_id)
+      continue;
+
+    wooting_mutex_lock(&device_lock_array[i]);
+    known = claimed[i] = !keyboard_handle_array[i];
+    wooting_mutex_unlock(&device_lock_array[i]);
+  }
+  return known;
+}
+
+// Opens the Wooting devices that aren't connected yet and adds them after the
+// ones that are, so the indexes of those stay the same
+static void enumerate_devices(void) {
+  // A single pass over the bus, every enumerate call is a full scan no matter
+  // which VID/PID it filters on
+  uint64_t enumerate_start = wooting_platform_time_us();
+  struct hid_device_info *hid_info = transport->enumerate(0, 0);
+
+  // Keep the matching config interfaces in model order so device indexes
+  // don't depend on the order the OS lists them in
+  struct {
+    const struct hid_device_info *info;
+    const WOOTING_DEVICE_DESCRIPTOR *desc;
+  } found[WOOTING_MAX_RGB_DEVICES];
+  uint8_t found_count = 0;
+  uint8_t space = WOOTING_MAX_RGB_DEVICES - connected_keyboards;
+  bool claimed[WOOTING_MAX_RGB_DEVICES] = {false};
+
+  for (const struct hid_device_info *walker = hid_info; walker;
+       walker = walker->next) {
+    // We can just search for the interface with matching custom Wooting Cfg
+    // usage page
+    if (walker->usage_page != CFG_USAGE_PAGE)
+      continue;
+
+    const WOOTING_DEVICE_DESCRIPTOR *desc =
+        find_descriptor(walker->vendor_id, walker->product_id);
+    if (!desc || is_known_device(walker, claimed))
+      continue;
+
+#ifdef DEBUG_LOG
+    printf("Enumerate found %s (%04x:%04x)\n", desc->model, walker->vendor_id,
+           walker->product_id);
+#endif
+
+    uint8_t pos = found_count;
+    while (pos > 0 && found[pos - 1].desc->order > desc->order)
+      pos--;
+    // When the list is full, only a model that sorts earlier gets in
+    if (pos == space)
+      continue;
+    if (found_count < space)
+      found_count++;
+    memmove(&found[pos + 1], &found[pos],
+            (found_count - 1 - pos) * sizeof(found[0]));
+    found[pos].info = walker;
+    found[pos].desc = desc;
+  }
+
+  // Opening is quick, so it's done in order to keep the indexes stable. The
+  // init round-trips are what take time, those run on all devices at once
+  uint8_t first_index = connected_keyboards;
+  for (uint8_t i = 0; i < found_count; i++) {
+    open_device(found[i].info, found[i].desc);
+  }
+
+  transport->free_enumeration(hid_info);
+
+  init_devices(first_index);
+  profile_revalidate_start();
+  wooting_usb_record_latency(&enumeration_counters,
+                             wooting_platform_time_us() - enumerate_start);
 }
 
 bool wooting_usb_find_keyboard() {
-  if (keyboard_handle || connected_keyboards > 0) {
+  // Start over with a fresh enumeration once every device has been dropped
+  wooting_usb_handle_device_failure();
+
+  if (connected_keyboards > 0) {
     // #ifdef DEBUG_LOG
     // printf("Got keyboard handle already\n");
     // #endif
@@ -292,9 +654,10 @@ bool wooting_usb_find_keyboard() {
     // 	wooting_usb_disconnect(true);
     // }
 
-    // catch handle being empty despite having found keyboards
-    if (!keyboard_handle)
-      wooting_usb_select_device(0);
+    // A board plugged in next to the connected ones gets added after them
+    if (wooting_atomic_exchange(&hotplug_rescan, 0))
+      enumerate_devices();
+
     return true;
   } else {
 #ifdef DEBUG_LOG
@@ -302,109 +665,28 @@ bool wooting_usb_find_keyboard() {
 #endif
   }
 
+  // With the hotplug monitor running the bus is only scanned again after a
+  // Wooting device showed up, so polling without a board attached is cheap
+  if (wooting_usb_hotplug_running() &&
+      wooting_atomic_load(&hotplug_rescan) == 0) {
+    return false;
+  }
+  wooting_atomic_store(&hotplug_rescan, 0);
+
   // Initilize arrays to default values and allocate memory
+  wooting_usb_init_locks();
   for (uint8_t i = 0; i < WOOTING_MAX_RGB_DEVICES; i++) {
     keyboard_handle_array[i] = NULL;
   }
 
   // Make sure pointers are the first element in the array
-  keyboard_handle = keyboard_handle_array[0];
   wooting_usb_meta = &wooting_usb_meta_array[0];
   reset_meta(wooting_usb_meta);
 
-  struct hid_device_info *hid_info;
-
   // Set enumerating flag
   enumerating = true;
 
-#define PID_ALT_CHECK(base_pid)                                                \
-  (hid_info = hid_enumerate(WOOTING_VID2, base_pid | V2_ALT_PID_0)) != NULL || \
-      (hid_info = hid_enumerate(WOOTING_VID2, base_pid | V2_ALT_PID_1)) !=     \
-          NULL ||                                                              \
-      (hid_info = hid_enumerate(WOOTING_VID2, base_pid | V2_ALT_PID_2)) !=     \
-          NULL
-
-  if ((hid_info = hid_enumerate(WOOTING_VID, WOOTING_ONE_PID)) != NULL) {
-#ifdef DEBUG_LOG
-    printf("Enumerate on Wooting One Successful\n");
-#endif
-    walk_hid_devices(hid_info, set_meta_wooting_one);
-  }
-  if (PID_ALT_CHECK(WOOTING_ONE_V2_PID)) {
-#ifdef DEBUG_LOG
-    printf("Enumerate on Wooting One (V2) Successful\n");
-#endif
-    walk_hid_devices(hid_info, set_meta_wooting_one_v2);
-  }
-  if ((hid_info = hid_enumerate(WOOTING_VID, WOOTING_TWO_PID)) != NULL) {
-#ifdef DEBUG_LOG
-    printf("Enumerate on Wooting Two Successful\n");
-#endif
-    walk_hid_devices(hid_info, set_meta_wooting_two);
-  }
-  if (PID_ALT_CHECK(WOOTING_TWO_V2_PID)) {
-#ifdef DEBUG_LOG
-    printf("Enumerate on Wooting Two (V2) Successful\n");
-#endif
-    walk_hid_devices(hid_info, set_meta_wooting_two_v2);
-  }
-  if (PID_ALT_CHECK(WOOTING_TWO_LE_PID)) {
-#ifdef DEBUG_LOG
-    printf("Enumerate on Wooting Two Lekker Edition Successful\n");
-#endif
-    walk_hid_devices(hid_info, set_meta_wooting_two_le);
-  }
-  if (PID_ALT_CHECK(WOOTING_TWO_HE_PID)) {
-#ifdef DEBUG_LOG
-    printf("Enumerate on Wooting Two HE Successful\n");
-#endif
-    walk_hid_devices(hid_info, set_meta_wooting_two_he);
-  }
-  if (PID_ALT_CHECK(WOOTING_TWO_HE_ARM_PID)) {
-#ifdef DEBUG_LOG
-    printf("Enumerate on Wooting Two HE Successful\n");
-#endif
-    walk_hid_devices(hid_info, set_meta_wooting_two_he_arm);
-  }
-  if (PID_ALT_CHECK(WOOTING_60HE_PID)) {
-#ifdef DEBUG_LOG
-    printf("Enumerate on Wooting 60HE Successful\n");
-#endif
-    walk_hid_devices(hid_info, set_meta_wooting_60he);
-  }
-  if (PID_ALT_CHECK(WOOTING_60HE_ARM_PID)) {
-#ifdef DEBUG_LOG
-    printf("Enumerate on Wooting 60HE (ARM) Successful\n");
-#endif
-    walk_hid_devices(hid_info, set_meta_wooting_60he_arm);
-  }
-  if (PID_ALT_CHECK(WOOTING_60HE_PLUS_PID)) {
-#ifdef DEBUG_LOG
-    printf("Enumerate on Wooting 60HE+ Successful\n");
-#endif
-    walk_hid_devices(hid_info, set_meta_wooting_60he_plus);
-  }
-
-  if (PID_ALT_CHECK(WOOTING_UWU_PID)) {
-#ifdef DEBUG_LOG
-    printf("Enumerate on Wooting UwU Successful\n");
-#endif
-    walk_hid_devices(hid_info, set_meta_wooting_uwu);
-  }
-
-  if (PID_ALT_CHECK(WOOTING_UWU_RGB_PID)) {
-#ifdef DEBUG_LOG
-    printf("Enumerate on Wooting UwU RGB Successful\n");
-#endif
-    walk_hid_devices(hid_info, set_meta_wooting_uwu_rgb);
-  }
-
-  if (PID_ALT_CHECK(WOOTING_80HE_PID)) {
-#ifdef DEBUG_LOG
-    printf("Enumerate on Wooting 80HE Successful\n");
-#endif
-    walk_hid_devices(hid_info, set_meta_wooting_80he);
-  }
+  enumerate_devices();
 
   enumerating = false;
 
@@ -424,109 +706,240 @@ bool wooting_usb_find_keyboard() {
   return connected_keyboards > 0;
 }
 
-void walk_hid_devices(struct hid_device_info *hid_info_walker,
-                      set_meta_func meta_func) {
-  // We can just search for the interface with matching custom Wooting Cfg usage
-  // page
-  while (hid_info_walker) {
-    if (connected_keyboards == WOOTING_MAX_RGB_DEVICES)
-      break;
+static void open_device(const struct hid_device_info *info,
+                        const WOOTING_DEVICE_DESCRIPTOR *desc) {
 #ifdef DEBUG_LOG
-    printf("Found interface No: %d\n", hid_info_walker->interface_number);
-    printf("Found usage page: %d\n", hid_info_walker->usage_page);
+  printf("Found interface No: %d\n", info->interface_number);
+  printf("Attempting to open\n");
 #endif
-    if (hid_info_walker->usage_page == CFG_USAGE_PAGE) {
+  hid_device *keyboard_handle = transport->open_path(info->path);
+  if (!keyboard_handle) {
 #ifdef DEBUG_LOG
-      printf("Attempting to open\n");
+    printf("No Keyboard handle: %S\n", hid_error(NULL));
 #endif
-      keyboard_handle = hid_open_path(hid_info_walker->path);
-      if (keyboard_handle) {
+    return;
+  }
+
 #ifdef DEBUG_LOG
-        printf("Found keyboard_handle: %s\n", hid_info_walker->path);
-        printf("Opened handle: %p\n", keyboard_handle);
+  printf("Found keyboard_handle: %s\n", info->path);
+  printf("Opened handle: %p\n", keyboard_handle);
 #endif
 
-        // Update pointer array and meta
-        keyboard_handle_array[connected_keyboards] = keyboard_handle;
-        meta_func(&wooting_usb_meta_array[connected_keyboards]);
-        (&wooting_usb_meta_array[connected_keyboards])->connected = true;
+  WOOTING_USB_META *device_meta = &wooting_usb_meta_array[connected_keyboards];
+  WOOTING_USB_RECOVERY *recovery = &device_recovery_array[connected_keyboards];
+
+  // Update pointer array and meta
+  keyboard_handle_array[connected_keyboards] = keyboard_handle;
+  size_t path_len = strlen(info->path) + 1;
+  recovery->path = (char *)malloc(path_len);
+  if (recovery->path)
+    memcpy(recovery->path, info->path, path_len);
+  recovery->vendor_id = info->vendor_id;
+  recovery->product_id = info->product_id;
+  recovery->last_attempt_us = wooting_platform_time_us();
+  reset_meta(device_meta);
+  set_meta_from_descriptor(device_meta, desc);
+  device_meta->connected = true;
+  layout_detected_array[connected_keyboards] = false;
+
+  // A device the cache knows skips the descriptor check and layout query
+  WOOTING_USB_PROFILE *profile = &device_profile_array[connected_keyboards];
+  profile_keyed_array[connected_keyboards] =
+      wooting_usb_profile_key(profile, info);
+  profile_cached_array[connected_keyboards] =
+      profile_keyed_array[connected_keyboards] &&
+      wooting_usb_profile_load(profile);
+  packet_size_pending_array[connected_keyboards] =
+      profile_cached_array[connected_keyboards];
+  if (profile_cached_array[connected_keyboards]) {
+    device_meta->uses_small_packets = profile->uses_small_packets;
+    if (profile->layout != LAYOUT_UNKNOWN) {
+      device_meta->layout = profile->layout;
+      layout_detected_array[connected_keyboards] = true;
+    }
+  }
+
+  // Increment found keyboard count and switch to the next element in the
+  // array
+  wooting_mutex_lock(&recover_lock);
+  connected_keyboards++;
+  wooting_mutex_unlock(&recover_lock);
+}
+
+// Reads from the report descriptor whether the device uses small packets.
+// Must be called with the device lock held
+// @return false if the descriptor couldn't be read or didn't say
+static bool read_packet_size(uint8_t device_index, bool *small_packets) {
+  unsigned char buff[HID_API_MAX_REPORT_DESCRIPTOR_SIZE];
 
-        unsigned char buff[HID_API_MAX_REPORT_DESCRIPTOR_SIZE];
+  int len = -1;
+  if (keyboard_handle_array[device_index])
+    len = transport->get_report_descriptor(keyboard_handle_array[device_index],
+                                           buff,
+                                           HID_API_MAX_REPORT_DESCRIPTOR_SIZE);
 
-        int len = hid_get_report_descriptor(keyboard_handle, buff,
-                                            HID_API_MAX_REPORT_DESCRIPTOR_SIZE);
-        if (len > 0) {
+  if (len > 0) {
 #ifdef DEBUG_LOG
-          printf("Got descriptor with len %d\n", len);
+    printf("Got descriptor with len %d\n", len);
 #endif
-          for (int i = 0; i < len; i++) {
-            // For this check, we can be a bit basic knowing the descriptors of
-            // the Wooting devices. In the cases where it's using small packets,
-            // we'll see the 0x95 byte, indicating the Report size, but with
-            // only one byte parameter (i.e. 64). For big packet, it's 256, and
-            // that has to be represented in two bytes, which means we use 0x96
-            // as the byte to indicate the report size declaration. So a more
-            // general purpose implementation would read what the value is after
-            // the Report Size (0x95/6) byte, but it's a bit unnecessary for us
-            // to do that when we know the descriptors.
-            if (buff[i] == 0x95) {
-
-              (&wooting_usb_meta_array[connected_keyboards])
-                  ->uses_small_packets = true;
+    for (int i = 0; i < len; i++) {
+      // For this check, we can be a bit basic knowing the descriptors of
+      // the Wooting devices. In the cases where it's using small packets,
+      // we'll see the 0x95 byte, indicating the Report size, but with
+      // only one byte parameter (i.e. 64). For big packet, it's 256, and
+      // that has to be represented in two bytes, which means we use 0x96
+      // as the byte to indicate the report size declaration. So a more
+      // general purpose implementation would read what the value is after
+      // the Report Size (0x95/6) byte, but it's a bit unnecessary for us
+      // to do that when we know the descriptors.
+      if (buff[i] == 0x95) {
+        *small_packets = true;
 #ifdef DEBUG_LOG
-              printf("Determined that device needs small packets from the HID "
-                     "report descriptor\n");
+        printf("Determined that device needs small packets from the HID "
+               "report descriptor\n");
 #endif
-              break;
-            } else if (buff[i] == 0x96) {
-
-              (&wooting_usb_meta_array[connected_keyboards])
-                  ->uses_small_packets = false;
+        return true;
+      } else if (buff[i] == 0x96) {
+        *small_packets = false;
 #ifdef DEBUG_LOG
-              printf("Determined that device needs big packets from the HID "
-                     "report descriptor\n");
+        printf("Determined that device needs big packets from the HID "
+               "report descriptor\n");
 #endif
-              break;
-            }
-          }
-        } else {
+        return true;
+      }
+    }
+  } else {
 #ifdef DEBUG_LOG
-          printf("Failed to get report descriptor (%d) Using default packet "
-                 "size (small = %d)\n",
-                 len,
-                 (&wooting_usb_meta_array[connected_keyboards])
-                     ->uses_small_packets);
+    printf("Failed to get report descriptor (%d) Using default packet "
+           "size (small = %d)\n",
+           len, wooting_usb_meta_array[device_index].uses_small_packets);
 #endif
-        }
+  }
+  return false;
+}
 
-        // Any feature sends need to be done after the meta is set so the
-        // correct value for v2_interface is set
+// Reads the packet size of a cached device the first time it's needed. Must
+// be called with the device lock held
+static void confirm_packet_size(uint8_t device_index) {
+  if (!packet_size_pending_array[device_index] ||
+      !keyboard_handle_array[device_index])
+    return;
+
+  packet_size_pending_array[device_index] = false;
+  bool small_packets;
+  if (read_packet_size(device_index, &small_packets))
+    wooting_usb_meta_array[device_index].uses_small_packets = small_packets;
+}
 
-        // Once the keyboard is found send an init command
+// Works out the packet size and sends the init command. Everything here only
+// touches the one device
+static void init_device(uint8_t device_index) {
+  WOOTING_USB_META *device_meta = &wooting_usb_meta_array[device_index];
+  if (!profile_cached_array[device_index]) {
+    bool small_packets;
+    wooting_mutex_lock(&device_lock_array[device_index]);
+    if (read_packet_size(device_index, &small_packets))
+      device_meta->uses_small_packets = small_packets;
+    wooting_mutex_unlock(&device_lock_array[device_index]);
+
+    // A new device goes into the cache straight away, its layout follows once
+    // somebody asks for it
+    if (profile_keyed_array[device_index]) {
+      device_profile_array[device_index].uses_small_packets =
+          device_meta->uses_small_packets;
+      wooting_usb_profile_store(&device_profile_array[device_index]);
+    }
+  }
+
+  // Any feature sends need to be done after the meta is set so the
+  // correct value for v2_interface is set
+
+  // Once the keyboard is found send an init command
 #ifdef DEBUG_LOG
-        bool result =
+  bool result =
 #endif
-            wooting_usb_send_feature(WOOTING_COLOR_INIT_COMMAND, 0, 0, 0, 0);
+      wooting_usb_device_send_feature(device_index, WOOTING_COLOR_INIT_COMMAND,
+                                      0, 0, 0, 0);
 #ifdef DEBUG_LOG
-        printf("Color init result: %d\n", result);
+  printf("Color init result: %d\n", result);
 #endif
+}
 
-        (&wooting_usb_meta_array[connected_keyboards])->layout =
-            wooting_usb_get_layout();
+typedef struct WOOTING_USB_INIT_JOB {
+  uint8_t device_index;
+  bool threaded;
+  wooting_thread thread;
+} WOOTING_USB_INIT_JOB;
 
-        // Increment found keyboard count and switch to the next element in the
-        // array
-        connected_keyboards++;
-      } else {
-#ifdef DEBUG_LOG
-        printf("No Keyboard handle: %S\n", hid_error(NULL));
-#endif
-      }
+static void init_device_thread(void *arg) {
+  init_device(((WOOTING_USB_INIT_JOB *)arg)->device_index);
+}
+
+// Initialises the devices opened from first_index on, so a slow device only
+// holds up startup by its own round-trip instead of adding to everyone else's
+static void init_devices(uint8_t first_index) {
+  uint8_t count = connected_keyboards - first_index;
+  WOOTING_USB_INIT_JOB jobs[WOOTING_MAX_RGB_DEVICES];
+
+  for (uint8_t i = 0; i < count; i++) {
+    jobs[i].device_index = first_index + i;
+    // No point in paying for a thread when there's only one device
+    jobs[i].threaded =
+        count > 1 &&
+        wooting_thread_create(&jobs[i].thread, init_device_thread, &jobs[i]);
+  }
+
+  for (uint8_t i = 0; i < count; i++) {
+    if (jobs[i].threaded) {
+      wooting_thread_join(jobs[i].thread);
+    } else {
+      init_device_thread(&jobs[i]);
     }
-    hid_info_walker = hid_info_walker->next;
   }
+}
 
-  hid_free_enumeration(hid_info_walker);
+// Asks the devices that were set up from the cache for the real values, so
+// a stale entry only lasts until shortly after connecting
+static void profile_revalidate_thread(void *arg) {
+  for (uint8_t i = 0; i < connected_keyboards; i++) {
+    if (!profile_cached_array[i])
+      continue;
+
+    wooting_mutex_lock(&device_lock_array[i]);
+    confirm_packet_size(i);
+    bool small_packets = wooting_usb_meta_array[i].uses_small_packets;
+    wooting_mutex_unlock(&device_lock_array[i]);
+    profile_update(i, &small_packets, NULL);
+
+    // An entry without a layout is filled in once somebody asks for it
+    WOOTING_DEVICE_LAYOUT layout;
+    if (layout_detected_array[i] && wooting_usb_get_layout(i, &layout)) {
+      wooting_mutex_lock(&device_lock_array[i]);
+      wooting_usb_meta_array[i].layout = layout;
+      wooting_mutex_unlock(&device_lock_array[i]);
+      profile_update(i, NULL, &layout);
+    }
+  }
+}
+
+static void profile_revalidate_start(void) {
+  profile_revalidate_stop();
+
+  bool any_cached = false;
+  for (uint8_t i = 0; i < connected_keyboards; i++) {
+    any_cached |= profile_cached_array[i];
+  }
+  if (any_cached) {
+    profile_thread_running = wooting_thread_create(
+        &profile_thread, profile_revalidate_thread, NULL);
+  }
+}
+
+static void profile_revalidate_stop(void) {
+  if (profile_thread_running) {
+    wooting_thread_join(profile_thread);
+    profile_thread_running = false;
+  }
 }
 
 bool wooting_usb_select_device(uint8_t device_index) {
@@ -536,7 +949,7 @@ bool wooting_usb_select_device(uint8_t device_index) {
     return false;
 
   // Fetch pointer and meta data from arrays
-  keyboard_handle = keyboard_handle_array[device_index];
+  selected_device = device_index;
   wooting_usb_meta = &wooting_usb_meta_array[device_index];
   // Initilize meta data should it somehow be empty
   if (wooting_usb_meta->model == NULL)
@@ -545,8 +958,8 @@ bool wooting_usb_select_device(uint8_t device_index) {
   wooting_rgb_select_buffer(device_index);
 
 #ifdef DEBUG_LOG
-  printf("Keyboard handle: %p | Model: %s\n", keyboard_handle,
-         wooting_usb_meta->model);
+  printf("Keyboard handle: %p | Model: %s\n",
+         keyboard_handle_array[device_index], wooting_usb_meta->model);
 #endif
 
   return true;
@@ -562,10 +975,293 @@ WOOTING_USB_META *wooting_usb_get_device_meta(uint8_t device_index) {
   return &wooting_usb_meta_array[device_index];
 }
 
+bool wooting_usb_device_stats(uint8_t device_index, WOOTING_USB_STATS *stats) {
+  if (device_index >= WOOTING_MAX_RGB_DEVICES || !stats)
+    return false;
+
+  WOOTING_USB_COUNTERS *counters = &device_counters_array[device_index];
+  stats->bytes_written =
+      (uint64_t)wooting_atomic64_load(&counters->bytes_written);
+  stats->writes = (uint32_t)wooting_atomic_load(&counters->writes);
+  stats->write_errors = (uint32_t)wooting_atomic_load(&counters->write_errors);
+  stats->features = (uint32_t)wooting_atomic_load(&counters->features);
+  stats->timeouts = (uint32_t)wooting_atomic_load(&counters->timeouts);
+  stats->retries = (uint32_t)wooting_atomic_load(&counters->retries);
+  stats->disconnects = (uint32_t)wooting_atomic_load(&counters->disconnects);
+  stats->reconnects = (uint32_t)wooting_atomic_load(&counters->reconnects);
+  wooting_usb_copy_latency(&stats->write_latency, &counters->write_latency);
+  wooting_usb_copy_latency(&stats->feature_latency, &counters->feature_latency);
+  wooting_usb_copy_latency(&stats->enumeration, &enumeration_counters);
+  return true;
+}
+
 uint8_t wooting_usb_device_count() { return connected_keyboards; }
 
-bool wooting_usb_send_buffer_v1(RGB_PARTS part_number, uint8_t rgb_buffer[]) {
-  if (!wooting_usb_find_keyboard()) {
+uint8_t wooting_usb_selected_device(void) { return selected_device; }
+
+static bool wooting_usb_device_index_valid(uint8_t device_index) {
+  // While enumerating, the device being initialised isn't counted yet
+  return device_index < WOOTING_MAX_RGB_DEVICES &&
+         (device_index < connected_keyboards || enumerating);
+}
+
+static size_t wooting_usb_device_response_size(uint8_t device_index) {
+  if (wooting_usb_meta_array[device_index].v2_interface) {
+    return WOOTING_V2_RESPONSE_SIZE;
+  } else {
+    return WOOTING_V1_RESPONSE_SIZE;
+  }
+}
+
+// Closes the handle of a failed device while keeping its index. Must be called
+// with the device lock held
+static void wooting_usb_device_drop(uint8_t device_index) {
+  if (!keyboard_handle_array[device_index])
+    return;
+
+  wooting_trace_instant("drop", device_index, 0);
+  transport->close(keyboard_handle_array[device_index]);
+  keyboard_handle_array[device_index] = NULL;
+  wooting_usb_meta_array[device_index].connected = false;
+  wooting_atomic_add(&dropped_devices, 1);
+  wooting_atomic_add(&device_counters_array[device_index].disconnects, 1);
+  wooting_rgb_invalidate_device(device_index);
+}
+
+// Opens a device through the given path and sends it the same init a newly
+// found device gets. Must be called with the device lock held
+static hid_device *wooting_usb_device_open_path(uint8_t device_index,
+                                                const char *path) {
+  hid_device *handle = transport->open_path(path);
+  if (!handle)
+    return NULL;
+
+  uint8_t response[WOOTING_V2_RESPONSE_SIZE];
+  int response_size = (int)wooting_usb_device_response_size(device_index);
+  if (wooting_usb_send_feature_buff(handle, WOOTING_COLOR_INIT_COMMAND, 0, 0,
+                                    0, 0) != WOOTING_COMMAND_SIZE ||
+      wooting_usb_handle_read_response_timeout(
+          handle, response, response_size, WOOTING_READ_RESPONSE_TIMEOUT) !=
+          response_size) {
+    transport->close(handle);
+    return NULL;
+  }
+
+  return handle;
+}
+
+// Swaps a failing handle for a fresh one opened through the cached path. The
+// device is dropped if that doesn't work. Must be called with the device lock
+// held
+static bool wooting_usb_device_reopen(uint8_t device_index) {
+  const char *path = device_recovery_array[device_index].path;
+  hid_device *handle = keyboard_handle_array[device_index];
+  if (!handle || !path)
+    return false;
+
+  // The old handle goes first, as not every platform lets a device be opened
+  // twice
+  transport->close(handle);
+  handle = wooting_usb_device_open_path(device_index, path);
+  keyboard_handle_array[device_index] = handle;
+  if (!handle) {
+    wooting_usb_meta_array[device_index].connected = false;
+    wooting_atomic_add(&dropped_devices, 1);
+  }
+  wooting_atomic_add(handle ? &device_counters_array[device_index].reconnects
+                            : &device_counters_array[device_index].disconnects,
+                     1);
+  wooting_trace_instant("reopen", device_index, handle != NULL);
+  wooting_rgb_invalidate_device(device_index);
+  return handle != NULL;
+}
+
+static bool wooting_usb_path_in_use(uint8_t device_index, const char *path) {
+  for (uint8_t i = 0; i < connected_keyboards; i++) {
+    if (i != device_index && device_recovery_array[i].path &&
+        strcmp(device_recovery_array[i].path, path) == 0)
+      return true;
+  }
+  return false;
+}
+
+// Looks for a dropped device on the bus, for when it came back under a
+// different path. Must be called with the device lock held
+static hid_device *wooting_usb_device_rediscover(uint8_t device_index) {
+  WOOTING_USB_RECOVERY *recovery = &device_recovery_array[device_index];
+  hid_device *handle = NULL;
+
+  wooting_mutex_lock(&recover_lock);
+  struct hid_device_info *hid_info =
+      transport->enumerate(recovery->vendor_id, recovery->product_id);
+  for (const struct hid_device_info *walker = hid_info; walker && !handle;
+       walker = walker->next) {
+    if (walker->usage_page != CFG_USAGE_PAGE ||
+        wooting_usb_path_in_use(device_index, walker->path))
+      continue;
+
+    handle = wooting_usb_device_open_path(device_index, walker->path);
+    if (handle) {
+      size_t path_len = strlen(walker->path) + 1;
+      char *path = (char *)malloc(path_len);
+      if (path) {
+        memcpy(path, walker->path, path_len);
+        free(recovery->path);
+        recovery->path = path;
+      }
+    }
+  }
+  transport->free_enumeration(hid_info);
+  wooting_mutex_unlock(&recover_lock);
+
+  return handle;
+}
+
+// Returns the handle of a device. A dropped device gets looked for again
+// through its cached path, then on the bus, at most once per
+// WOOTING_RECOVER_INTERVAL_US. Must be called with the device lock held
+static hid_device *wooting_usb_device_handle(uint8_t device_index) {
+  WOOTING_USB_RECOVERY *recovery = &device_recovery_array[device_index];
+  if (keyboard_handle_array[device_index] || !recovery->path)
+    return keyboard_handle_array[device_index];
+
+  uint64_t now = wooting_platform_time_us();
+  if (now - recovery->last_attempt_us < WOOTING_RECOVER_INTERVAL_US)
+    return NULL;
+  recovery->last_attempt_us = now;
+
+  hid_device *handle =
+      wooting_usb_device_open_path(device_index, recovery->path);
+  if (!handle)
+    handle = wooting_usb_device_rediscover(device_index);
+  if (handle) {
+    keyboard_handle_array[device_index] = handle;
+    wooting_usb_meta_array[device_index].connected = true;
+    wooting_atomic_add(&dropped_devices, -1);
+    wooting_atomic_add(&device_counters_array[device_index].reconnects, 1);
+    wooting_rgb_invalidate_device(device_index);
+  }
+  return handle;
+}
+
+typedef enum WOOTING_USB_IO_RESULT {
+  WOOTING_USB_IO_OK,
+  // The device didn't answer in time. It's still there, so there's no point in
+  // retrying or dropping it
+  WOOTING_USB_IO_TIMEOUT,
+  WOOTING_USB_IO_ERROR
+} WOOTING_USB_IO_RESULT;
+
+typedef WOOTING_USB_IO_RESULT (*wooting_usb_io_func)(uint8_t device_index,
+                                                     hid_device *handle,
+                                                     void *arg);
+
+// Runs a transfer on a device. Errors are retried with a doubling backoff, the
+// last attempt going through a freshly reopened handle, and a device that
+// keeps failing is dropped without affecting any other device
+static WOOTING_USB_IO_RESULT
+wooting_usb_device_io(uint8_t device_index, wooting_usb_io_func io, void *arg) {
+  if (!wooting_usb_device_index_valid(device_index)) {
+    return WOOTING_USB_IO_ERROR;
+  }
+
+  WOOTING_USB_IO_RESULT result = WOOTING_USB_IO_ERROR;
+  wooting_mutex_lock(&device_lock_array[device_index]);
+  hid_device *handle = wooting_usb_device_handle(device_index);
+  confirm_packet_size(device_index);
+  for (uint8_t attempt = 0; handle && attempt < WOOTING_IO_ATTEMPTS;
+       attempt++) {
+    if (attempt > 0) {
+      wooting_atomic_add(&device_counters_array[device_index].retries, 1);
+      wooting_platform_sleep_us((uint64_t)WOOTING_IO_BACKOFF_US
+                                << (attempt - 1));
+      if (attempt == WOOTING_IO_ATTEMPTS - 1 &&
+          !wooting_usb_device_reopen(device_index))
+        break;
+      handle = keyboard_handle_array[device_index];
+    }
+
+    result = io(device_index, handle, arg);
+    if (result != WOOTING_USB_IO_ERROR)
+      break;
+    wooting_trace_instant("transfer_failed", device_index, attempt + 1);
+  }
+
+  if (result == WOOTING_USB_IO_ERROR)
+    wooting_usb_device_drop(device_index);
+  wooting_mutex_unlock(&device_lock_array[device_index]);
+
+  return result;
+}
+
+typedef struct WOOTING_USB_REPORT {
+  uint8_t *buffer;
+  size_t size;
+  // A v2 report is split into small packets on devices that need them. That
+  // is looked up by the write, under the device lock, which also fills in
+  // small_packets with what it used
+  bool v2;
+  bool small_packets;
+} WOOTING_USB_REPORT;
+
+// hid_write with its latency and outcome counted
+static int wooting_usb_write(uint8_t device_index, hid_device *handle,
+                             const uint8_t *data, size_t length) {
+  WOOTING_USB_COUNTERS *counters = &device_counters_array[device_index];
+  uint64_t trace = wooting_trace_begin();
+  uint64_t start = wooting_platform_time_us();
+  int result = transport->write(handle, data, length);
+  wooting_usb_record_latency(&counters->write_latency,
+                             wooting_platform_time_us() - start);
+  wooting_trace_end(trace, "hid_write", device_index, result);
+
+  wooting_atomic_add(&counters->writes, 1);
+  if (result == (int)length) {
+    wooting_atomic64_add(&counters->bytes_written, result);
+  } else {
+    wooting_atomic_add(&counters->write_errors, 1);
+  }
+  return result;
+}
+
+static WOOTING_USB_IO_RESULT wooting_usb_write_report(uint8_t device_index,
+                                                      hid_device *handle,
+                                                      void *arg) {
+  WOOTING_USB_REPORT *report = (WOOTING_USB_REPORT *)arg;
+  report->small_packets =
+      report->v2 && wooting_usb_meta_array[device_index].uses_small_packets;
+
+  if (!report->small_packets) {
+    int report_size =
+        wooting_usb_write(device_index, handle, report->buffer, report->size);
+    if (report_size != (int)report->size) {
+      return WOOTING_USB_IO_ERROR;
+    }
+    return WOOTING_USB_IO_OK;
+  }
+
+  for (uint8_t i = 0; i < WOOTING_SMALL_PACKET_COUNT; i++) {
+    // Every packet needs the report index at the start. Rather than copying
+    // the packet out, the byte in front of it stands in for the index while
+    // it's written
+    uint8_t *child_buff = &report->buffer[i * WOOTING_SMALL_PACKET_SIZE];
+    uint8_t borrowed = child_buff[0];
+    child_buff[0] = 0;
+    int child_report = wooting_usb_write(device_index, handle, child_buff,
+                                         WOOTING_SMALL_PACKET_SIZE + 1);
+    child_buff[0] = borrowed;
+
+    if (child_report != WOOTING_SMALL_PACKET_SIZE + 1) {
+      return WOOTING_USB_IO_ERROR;
+    }
+  }
+  return WOOTING_USB_IO_OK;
+}
+
+bool wooting_usb_device_send_buffer_v1(uint8_t device_index,
+                                       RGB_PARTS part_number,
+                                       const uint8_t rgb_buffer[]) {
+  if (!wooting_usb_device_index_valid(device_index)) {
     return false;
   }
 
@@ -599,7 +1295,7 @@ bool wooting_usb_send_buffer_v1(RGB_PARTS part_number, uint8_t rgb_buffer[]) {
   // wooting_rgb_array_update_keyboard will not run into this
   case PART4: {
     // Wooting One will not have this part of the report
-    if (wooting_usb_meta->device_type != DEVICE_KEYBOARD) {
+    if (wooting_usb_meta_array[device_index].device_type != DEVICE_KEYBOARD) {
       return false;
     }
     report_buffer[4] = 2; // Slave nr
@@ -613,22 +1309,68 @@ bool wooting_usb_send_buffer_v1(RGB_PARTS part_number, uint8_t rgb_buffer[]) {
 
   memcpy(&report_buffer[6], rgb_buffer, RGB_RAW_BUFFER_SIZE);
 
+  uint64_t trace = wooting_trace_begin();
   uint16_t crc =
-      getCrc16ccitt((uint8_t *)&report_buffer, WOOTING_REPORT_SIZE - 2);
+      wooting_usb_crc16ccitt(report_buffer, WOOTING_REPORT_SIZE - 2);
   report_buffer[127] = (uint8_t)crc;
   report_buffer[128] = crc >> 8;
-  int report_size =
-      hid_write(keyboard_handle, report_buffer, WOOTING_REPORT_SIZE);
-  if (report_size == WOOTING_REPORT_SIZE) {
+  wooting_trace_end(trace, "crc", device_index, WOOTING_REPORT_SIZE - 2);
+
+  WOOTING_USB_REPORT report = {report_buffer, WOOTING_REPORT_SIZE, false,
+                               false};
+  trace = wooting_trace_begin();
+  bool result = wooting_usb_device_io(device_index, wooting_usb_write_report,
+                                      &report) == WOOTING_USB_IO_OK;
+  wooting_trace_end(trace, "send_buffer_v1", device_index, part_number);
+  return result;
+}
+
+bool wooting_usb_send_buffer_v1(RGB_PARTS part_number, uint8_t rgb_buffer[]) {
+  if (!wooting_usb_find_keyboard()) {
+    return false;
+  }
+
+  if (wooting_usb_device_send_buffer_v1(selected_device, part_number,
+                                        rgb_buffer)) {
     return true;
   } else {
-#ifdef DEBUG_LOG
-    printf("Got report size: %d, expected: %d, disconnecting..\n", report_size,
-           WOOTING_REPORT_SIZE);
-#endif
-    wooting_usb_disconnect(true);
+    wooting_usb_handle_device_failure();
+    return false;
+  }
+}
+
+void wooting_usb_v2_report_init(WOOTING_USB_V2_REPORT *report) {
+  report->header[0] = 0;                         // HID report index (unused)
+  report->header[1] = 0xD0;                      // Magicword
+  report->header[2] = 0xDA;                      // Magicword
+  report->header[3] = WOOTING_RAW_COLORS_REPORT; // Report ID
+  report->trailer[0] = 0;
+}
+
+bool wooting_usb_device_send_buffer_v2(
+    uint8_t device_index,
+    const uint16_t rgb_buffer[WOOTING_RGB_ROWS][WOOTING_RGB_COLS]) {
+  WOOTING_USB_V2_REPORT report;
+  wooting_usb_v2_report_init(&report);
+  memcpy(report.matrix, rgb_buffer, sizeof(report.matrix));
+
+  return wooting_usb_device_send_report_v2(device_index, &report);
+}
+
+bool wooting_usb_device_send_report_v2(uint8_t device_index,
+                                       WOOTING_USB_V2_REPORT *v2_report) {
+  if (!wooting_usb_device_index_valid(device_index)) {
     return false;
   }
+
+  WOOTING_USB_REPORT report = {(uint8_t *)v2_report, WOOTING_V2_REPORT_SIZE,
+                               true, false};
+  uint64_t trace = wooting_trace_begin();
+  bool result = wooting_usb_device_io(device_index, wooting_usb_write_report,
+                                      &report) == WOOTING_USB_IO_OK;
+  wooting_trace_end(trace, "send_buffer_v2", device_index,
+                    report.small_packets);
+  return result;
 }
 
 bool wooting_usb_send_buffer_v2(
@@ -637,61 +1379,21 @@ bool wooting_usb_send_buffer_v2(
     return false;
   }
 
-  uint8_t report_buffer[WOOTING_V2_REPORT_SIZE] = {0};
-  report_buffer[0] = 0;                         // HID report index (unused)
-  report_buffer[1] = 0xD0;                      // Magicword
-  report_buffer[2] = 0xDA;                      // Magicword
-  report_buffer[3] = WOOTING_RAW_COLORS_REPORT; // Report ID
-  memcpy(&report_buffer[4], rgb_buffer,
-         WOOTING_RGB_ROWS * WOOTING_RGB_COLS * sizeof(uint16_t));
-
-  if (wooting_usb_get_meta()->uses_small_packets) {
-#ifdef DEBUG_LOG
-    printf("Sending v2 buffer using small packets\n");
-#endif
-    for (uint8_t i = 0; i < WOOTING_SMALL_PACKET_COUNT; i++) {
-      // We have +1 on the packet size for both the buff and what we send as we
-      // need to have the report index at the start
-      uint8_t child_buff[WOOTING_SMALL_PACKET_SIZE + 1] = {0};
-      memcpy(&child_buff[1],
-             &report_buffer[(i * WOOTING_SMALL_PACKET_SIZE) + 1],
-             WOOTING_SMALL_PACKET_SIZE);
-      int child_report =
-          hid_write(keyboard_handle, child_buff, WOOTING_SMALL_PACKET_SIZE + 1);
-
-      if (child_report != WOOTING_SMALL_PACKET_SIZE + 1) {
-#ifdef DEBUG_LOG
-        printf("Got report size from small buffer no %d: %d, expected: %d, "
-               "disconnecting..\n",
-               i, child_report, WOOTING_SMALL_PACKET_SIZE + 1);
-#endif
-        wooting_usb_disconnect(true);
-        return false;
-      }
-    }
+  if (wooting_usb_device_send_buffer_v2(
+          selected_device,
+          (const uint16_t(*)[WOOTING_RGB_COLS])rgb_buffer)) {
     return true;
   } else {
-    int report_size =
-        hid_write(keyboard_handle, report_buffer, WOOTING_V2_REPORT_SIZE);
-    if (report_size == WOOTING_V2_REPORT_SIZE) {
-#ifdef DEBUG_LOG
-      printf("Successfully sent V2 buffer...\n");
-#endif
-      return true;
-    } else {
-#ifdef DEBUG_LOG
-      printf("Got report size: %d, expected: %d, disconnecting..\n",
-             report_size, WOOTING_V2_REPORT_SIZE);
-#endif
-      wooting_usb_disconnect(true);
-      return false;
-    }
+    wooting_usb_handle_device_failure();
+    return false;
   }
 }
 
-int wooting_usb_send_feature_buff(uint8_t commandId, uint8_t parameter0,
-                                  uint8_t parameter1, uint8_t parameter2,
-                                  uint8_t parameter3) {
+static int wooting_usb_send_feature_buff(hid_device *handle, uint8_t commandId,
+                                         uint8_t parameter0,
+                                         uint8_t parameter1,
+                                         uint8_t parameter2,
+                                         uint8_t parameter3) {
   uint8_t report_buffer[WOOTING_COMMAND_SIZE];
 
   report_buffer[0] = 0;    // HID report index (unused)
@@ -703,16 +1405,92 @@ int wooting_usb_send_feature_buff(uint8_t commandId, uint8_t parameter0,
   report_buffer[6] = parameter1;
   report_buffer[7] = parameter0;
 
-  return hid_send_feature_report(keyboard_handle, report_buffer,
-                                 WOOTING_COMMAND_SIZE);
+  return transport->send_feature_report(handle, report_buffer,
+                                        WOOTING_COMMAND_SIZE);
 }
 
 size_t wooting_usb_get_response_size(void) {
-  if (wooting_usb_use_v2_interface()) {
-    return WOOTING_V2_RESPONSE_SIZE;
-  } else {
-    return WOOTING_V1_RESPONSE_SIZE;
+  return wooting_usb_device_response_size(selected_device);
+}
+
+typedef struct WOOTING_USB_FEATURE {
+  uint8_t command_id;
+  uint8_t parameters[4];
+  uint8_t *response;
+  int response_size;
+} WOOTING_USB_FEATURE;
+
+static WOOTING_USB_IO_RESULT wooting_usb_feature_io(uint8_t device_index,
+                                                    hid_device *handle,
+                                                    void *arg) {
+  const WOOTING_USB_FEATURE *feature = (const WOOTING_USB_FEATURE *)arg;
+  WOOTING_USB_COUNTERS *counters = &device_counters_array[device_index];
+
+  uint64_t start = wooting_platform_time_us();
+  wooting_atomic_add(&counters->features, 1);
+  int command_size = wooting_usb_send_feature_buff(
+      handle, feature->command_id, feature->parameters[0],
+      feature->parameters[1], feature->parameters[2], feature->parameters[3]);
+  if (command_size != WOOTING_COMMAND_SIZE) {
+    wooting_atomic_add(&counters->write_errors, 1);
+    wooting_trace_instant("send_feature_failed", device_index, command_size);
+    return WOOTING_USB_IO_ERROR;
+  }
+  wooting_atomic64_add(&counters->bytes_written, command_size);
+
+  uint64_t trace = wooting_trace_begin();
+  int result = wooting_usb_handle_read_response_timeout(
+      handle, feature->response, feature->response_size,
+      WOOTING_READ_RESPONSE_TIMEOUT);
+  wooting_trace_end(trace, "read_response", device_index, result);
+  if (result != feature->response_size) {
+    if (result >= 0)
+      wooting_atomic_add(&counters->timeouts, 1);
+    return result < 0 ? WOOTING_USB_IO_ERROR : WOOTING_USB_IO_TIMEOUT;
   }
+
+  wooting_usb_record_latency(&counters->feature_latency,
+                             wooting_platform_time_us() - start);
+  return WOOTING_USB_IO_OK;
+}
+
+int wooting_usb_device_send_feature_with_response(
+    uint8_t device_index, uint8_t *buff, size_t len, uint8_t commandId,
+    uint8_t parameter0, uint8_t parameter1, uint8_t parameter2,
+    uint8_t parameter3) {
+  if (!wooting_usb_device_index_valid(device_index)) {
+    return -1;
+  }
+
+  uint8_t response_buff[WOOTING_V2_RESPONSE_SIZE];
+  WOOTING_USB_FEATURE feature = {
+      commandId,
+      {parameter0, parameter1, parameter2, parameter3},
+      response_buff,
+      (int)wooting_usb_device_response_size(device_index)};
+
+  uint64_t trace = wooting_trace_begin();
+  WOOTING_USB_IO_RESULT result =
+      wooting_usb_device_io(device_index, wooting_usb_feature_io, &feature);
+  wooting_trace_end(trace, "send_feature", device_index, commandId);
+  if (result != WOOTING_USB_IO_OK) {
+    return -1;
+  }
+
+  if (buff) {
+    memcpy(buff, response_buff,
+           len < (size_t)feature.response_size ? len : feature.response_size);
+  }
+  return feature.response_size;
+}
+
+bool wooting_usb_device_send_feature(uint8_t device_index, uint8_t commandId,
+                                     uint8_t parameter0, uint8_t parameter1,
+                                     uint8_t parameter2, uint8_t parameter3) {
+  // The response is just read and discarded
+  return wooting_usb_device_send_feature_with_response(
+             device_index, NULL, 0, commandId, parameter0, parameter1,
+             parameter2, parameter3) != -1;
 }
 
 bool wooting_usb_send_feature(uint8_t commandId, uint8_t parameter0,
@@ -722,38 +1500,11 @@ bool wooting_usb_send_feature(uint8_t commandId, uint8_t parameter0,
     return false;
   }
 
-#ifdef DEBUG_LOG
-  printf("Sending feature: %d\n", commandId);
-#endif
-
-  int command_size = wooting_usb_send_feature_buff(
-      commandId, parameter0, parameter1, parameter2, parameter3);
-  size_t response_size = wooting_usb_get_response_size();
-
-#ifdef DEBUG_LOG
-  printf("Feature sent, Reading response\n");
-#endif
-
-  // Just read the response and discard it
-  uint8_t *buff = (uint8_t *)calloc(response_size, sizeof(uint8_t));
-  int result = wooting_usb_read_response_timeout(buff, response_size,
-                                                 WOOTING_READ_RESPONSE_TIMEOUT);
-  free(buff);
-#ifdef DEBUG_LOG
-  printf("Read result %d \n", result);
-#endif
-
-  if (command_size == WOOTING_COMMAND_SIZE && result == response_size) {
+  if (wooting_usb_device_send_feature(selected_device, commandId, parameter0,
+                                      parameter1, parameter2, parameter3)) {
     return true;
   } else {
-#ifdef DEBUG_LOG
-    printf(
-        "Got command size: %d, expected: %d, Got reponse size: %d, expected: "
-        "%d, disconnecting..\n",
-        command_size, WOOTING_COMMAND_SIZE, result, (int)response_size);
-#endif
-
-    wooting_usb_disconnect(true);
+    wooting_usb_handle_device_failure();
     return false;
   }
 }
@@ -765,83 +1516,132 @@ int wooting_usb_send_feature_with_response(
     return -1;
   }
 
-#ifdef DEBUG_LOG
-  printf("Sending feature with response: %d\n", commandId);
-#endif
-
-  int command_size = wooting_usb_send_feature_buff(
-      commandId, parameter0, parameter1, parameter2, parameter3);
-  if (command_size == WOOTING_COMMAND_SIZE) {
-    size_t response_size = wooting_usb_get_response_size();
-    uint8_t *responseBuff = (uint8_t *)calloc(response_size, sizeof(uint8_t));
-
-    int result = wooting_usb_read_response_timeout(
-        responseBuff, response_size, WOOTING_READ_RESPONSE_TIMEOUT);
-
-    if (result == response_size) {
-      memcpy(buff, responseBuff, len);
-      free(responseBuff);
-      return result;
-    } else {
-#ifdef DEBUG_LOG
-      printf("Got response size: %d, expected: %d, disconnecting..\n", result,
-             (int)response_size);
-#endif
-
-      free(responseBuff);
-      wooting_usb_disconnect(true);
-      return -1;
-    }
-  } else {
-#ifdef DEBUG_LOG
-    printf("Got command size: %d, expected: %d, disconnecting..\n",
-           command_size, WOOTING_COMMAND_SIZE);
-#endif
-
-    wooting_usb_disconnect(true);
-    return false;
-  }
-}
-
-static void debug_print_buffer(uint8_t *buff, size_t len) {
-#ifdef DEBUG_LOG
-  printf("Buffer content \n");
-  for (int i = 0; i < len; i++) {
-    printf("%d%s", buff[i], i < len - 1 ? ", " : "");
+  int result = wooting_usb_device_send_feature_with_response(
+      selected_device, buff, len, commandId, parameter0, parameter1,
+      parameter2, parameter3);
+  if (result == -1) {
+    wooting_usb_handle_device_failure();
   }
-  printf("\n");
-#endif
+  return result;
 }
 
-int wooting_usb_read_response_timeout(uint8_t *buff, size_t len,
-                                      int milliseconds) {
-  int result = hid_read_timeout(keyboard_handle, buff, len, milliseconds);
+static int wooting_usb_handle_read_response_timeout(hid_device *handle,
+                                                    uint8_t *buff, size_t len,
+                                                    int milliseconds) {
+  int result = transport->read_timeout(handle, buff, len, milliseconds);
   if (result <= 0) {
-#ifdef DEBUG_LOG
-    printf("hid_read_timeout %d error on first read\n", result);
-#endif
     return result;
   }
 
   while (result < len) {
-    int r = hid_read_timeout(keyboard_handle, buff + result, len - result,
-                             milliseconds);
+    int r = transport->read_timeout(handle, buff + result, len - result,
+                                    milliseconds);
     if (r <= 0) {
-#ifdef DEBUG_LOG
-      printf("hid_read_timeout %d error while reading slice %d\n", r, result);
-#endif
       return r;
     } else {
       result += r;
     }
   }
-#ifdef DEBUG_LOG
-  printf("hid_read_timeout result code: %d\n", result);
-#endif
-  debug_print_buffer(buff, len);
+  return result;
+}
+
+int wooting_usb_read_response_timeout(uint8_t *buff, size_t len,
+                                      int milliseconds) {
+  if (!wooting_usb_device_index_valid(selected_device)) {
+    return -1;
+  }
+
+  int result = -1;
+  wooting_mutex_lock(&device_lock_array[selected_device]);
+  hid_device *handle = keyboard_handle_array[selected_device];
+  if (handle) {
+    result = wooting_usb_handle_read_response_timeout(handle, buff, len,
+                                                      milliseconds);
+  }
+  wooting_mutex_unlock(&device_lock_array[selected_device]);
   return result;
 }
 
 int wooting_usb_read_response(uint8_t *buff, size_t len) {
   return wooting_usb_read_response_timeout(buff, len, -1);
 }
+
+bool wooting_usb_hotplug_monitor(bool enable) {
+  if (!enable) {
+    wooting_usb_hotplug_stop();
+    return false;
+  }
+
+  // The monitor thread takes the device locks, so they have to exist first
+  wooting_usb_init_locks();
+  // Events from before the monitor started were missed
+  wooting_atomic_store(&hotplug_rescan, 1);
+  return wooting_usb_hotplug_running() || wooting_usb_hotplug_start();
+}
+
+void wooting_usb_set_hotplug_cb(void_cb arrival_cb, void_cb removal_cb) {
+  hotplug_arrival_callback = arrival_cb;
+  hotplug_removal_callback = removal_cb;
+}
+
+// Drops the device that was opened through the given path, if any
+static bool wooting_usb_hotplug_drop_path(const char *path) {
+  bool found = false;
+
+  for (uint8_t i = 0; i < WOOTING_MAX_RGB_DEVICES && !found; i++) {
+    wooting_mutex_lock(&device_lock_array[i]);
+    wooting_mutex_lock(&recover_lock);
+    found = i < connected_keyboards && device_recovery_array[i].path &&
+            strcmp(device_recovery_array[i].path, path) == 0;
+    wooting_mutex_unlock(&recover_lock);
+    if (found) {
+      wooting_usb_device_drop(i);
+    }
+    wooting_mutex_unlock(&device_lock_array[i]);
+  }
+
+  return found;
+}
+
+// Lets dropped devices look for themselves again on their next transfer
+// instead of waiting for WOOTING_RECOVER_INTERVAL_US
+static void wooting_usb_hotplug_retry_dropped(void) {
+  for (uint8_t i = 0; i < WOOTING_MAX_RGB_DEVICES; i++) {
+    wooting_mutex_lock(&device_lock_array[i]);
+    if (!keyboard_handle_array[i]) {
+      device_recovery_array[i].last_attempt_us = 0;
+    }
+    wooting_mutex_unlock(&device_lock_array[i]);
+  }
+}
+
+void wooting_usb_hotplug_event(WOOTING_USB_HOTPLUG_EVENT event,
+                               uint16_t vendor_id, uint16_t product_id,
+                               const char *path) {
+  if (event != HOTPLUG_EVENTS_LOST && !find_descriptor(vendor_id, product_id))
+    return;
+
+#ifdef DEBUG_LOG
+  printf("Hotplug event %d for %04x:%04x at %s\n", event, vendor_id,
+         product_id, path ? path : "-");
+#endif
+
+  switch (event) {
+  case HOTPLUG_ARRIVED:
+  case HOTPLUG_EVENTS_LOST: {
+    wooting_atomic_store(&hotplug_rescan, 1);
+    wooting_usb_hotplug_retry_dropped();
+    if (event == HOTPLUG_ARRIVED && hotplug_arrival_callback)
+      hotplug_arrival_callback();
+    break;
+  }
+  case HOTPLUG_REMOVED: {
+    // A device whose config interface went away has its handle closed right
+    // away, instead of waiting for the next transfer to fail
+    if (path && wooting_usb_hotplug_drop_path(path) &&
+        hotplug_removal_callback)
+      hotplug_removal_callback();
+    break;
+  }
+  }
+}
@@ -66,6 +66,42 @@ typedef struct WOOTING_USB_META {
   bool uses_small_packets;
 } WOOTING_USB_META;
 
+#define WOOTING_USB_LATENCY_BUCKETS 20
+
+/// @brief Distribution of how long an operation took
+typedef struct WOOTING_USB_LATENCY_HISTOGRAM {
+  // Bucket 0 counts times under 2us, bucket n times from 2^n up to
+  // 2^(n+1) us. The last bucket also counts everything longer
+  uint32_t buckets[WOOTING_USB_LATENCY_BUCKETS];
+  uint32_t count;
+  uint64_t total_us;
+  uint32_t max_us;
+} WOOTING_USB_LATENCY_HISTOGRAM;
+
+/// @brief Counters of the USB traffic to a device
+typedef struct WOOTING_USB_STATS {
+  // Bytes handed to hidapi in output and feature reports
+  uint64_t bytes_written;
+  // hid_write calls, a report sent as small packets takes several
+  uint32_t writes;
+  uint32_t write_errors;
+  // Feature report round-trips, including the response
+  uint32_t features;
+  // Feature responses that didn't arrive in time
+  uint32_t timeouts;
+  // Transfers tried again after an error
+  uint32_t retries;
+  // Times the device was dropped after failing, or unplugged
+  uint32_t disconnects;
+  // Times a dropped or failing device was opened again
+  uint32_t reconnects;
+  WOOTING_USB_LATENCY_HISTOGRAM write_latency;
+  WOOTING_USB_LATENCY_HISTOGRAM feature_latency;
+  // Time from scanning the bus until the devices found were ready. This one
+  // isn't per device, every device reports the same
+  WOOTING_USB_LATENCY_HISTOGRAM enumeration;
+} WOOTING_USB_STATS;
+
 typedef struct _KeyboardMatrixID {
   uint8_t column : 5;
   uint8_t row : 3;
@@ -91,19 +127,102 @@ typedef struct _KeyboardMatrixID {
 #define WOOTING_RESET_ALL_COMMAND 32
 #define WOOTING_COLOR_INIT_COMMAND 33
 
+/// A v2 colour report the way it goes over the wire, with the colour matrix in
+/// place. Colours kept in one of these are sent without being copied, the
+/// header is set up once with wooting_usb_v2_report_init.
+typedef struct WOOTING_USB_V2_REPORT {
+  // HID report index, magic word and report ID
+  uint8_t header[4];
+  uint16_t matrix[WOOTING_RGB_ROWS][WOOTING_RGB_COLS];
+  // Unused last byte of the report
+  uint8_t trailer[1];
+} WOOTING_USB_V2_REPORT;
+
+struct hid_device_;
+struct hid_device_info;
+
+/// @brief Table of the HID calls the SDK uses to talk to devices
+///
+/// By default every call goes straight to hidapi. Swapping the transport lets
+/// the SDK drive something other than a physical board, e.g. the simulated
+/// keyboard from wooting-usb-sim.h. The signatures match their hidapi
+/// counterparts.
+typedef struct WOOTING_USB_TRANSPORT {
+  struct hid_device_info *(*enumerate)(unsigned short vendor_id,
+                                       unsigned short product_id);
+  void (*free_enumeration)(struct hid_device_info *devs);
+  struct hid_device_ *(*open_path)(const char *path);
+  void (*close)(struct hid_device_ *dev);
+  int (*write)(struct hid_device_ *dev, const unsigned char *data,
+               size_t length);
+  int (*send_feature_report)(struct hid_device_ *dev,
+                             const unsigned char *data, size_t length);
+  int (*read_timeout)(struct hid_device_ *dev, unsigned char *data,
+                      size_t length, int milliseconds);
+  int (*get_report_descriptor)(struct hid_device_ *dev, unsigned char *buf,
+                               size_t buf_size);
+} WOOTING_USB_TRANSPORT;
+
+/// @brief Replaces the transport used for all device I/O
+///
+/// Any connected devices are disconnected first, as their handles belong to
+/// the previous transport.
+/// @param transport The transport to use, NULL restores the hidapi transport
+WOOTINGRGBSDK_API void
+wooting_usb_set_transport(const WOOTING_USB_TRANSPORT *transport);
+
+/// @brief Returns the transport currently used for device I/O
+WOOTINGRGBSDK_API const WOOTING_USB_TRANSPORT *wooting_usb_get_transport(void);
+
 void wooting_usb_set_disconnected_cb(void_cb cb);
 void wooting_usb_disconnect(bool trigger_cb);
+/// @brief Called after an operation on a device failed
+///
+/// A device that keeps failing is dropped on its own, with its index kept so
+/// it can be reopened later. Only once every device has been dropped is
+/// everything disconnected, so the next call enumerates again.
+void wooting_usb_handle_device_failure(void);
 
 bool wooting_usb_find_keyboard(void);
 
 WOOTING_USB_META *wooting_usb_get_meta(void);
 
 /// @brief Gets the meta struct of a particular device
+///
+/// The layout field stays LAYOUT_UNKNOWN until wooting_usb_device_layout has
+/// been called for the device.
 /// @param device_index Index of the device you want the meta of
 /// @return Pointer to the meta struct of the device, NULL if out of range
 WOOTINGRGBSDK_API WOOTING_USB_META *
 wooting_usb_get_device_meta(uint8_t device_index);
 
+/// @brief Returns the layout of a particular device
+///
+/// The device is asked for its layout on the first call, later calls return
+/// the stored result. Connecting doesn't wait for this round-trip.
+/// @param device_index Index of the device you want the layout of
+/// @return The layout, LAYOUT_UNKNOWN if out of range or the device didn't
+/// answer
+WOOTINGRGBSDK_API WOOTING_DEVICE_LAYOUT
+wooting_usb_device_layout(uint8_t device_index);
+
+/// @brief Returns whether a device gets its v2 reports in small packets
+///
+/// Unlike the field in the meta struct, this can be read while other threads
+/// use the device.
+/// @param device_index Index of the device
+/// @return false if out of range
+bool wooting_usb_device_small_packets(uint8_t device_index);
+
+/// @brief Copies the USB counters of a device
+///
+/// The counters are updated with atomics, so this can be called from any
+/// thread while devices are in use. They keep counting across reconnects.
+/// @param device_index Index of the device you want the counters of
+/// @return false if the index is out of range
+WOOTINGRGBSDK_API bool wooting_usb_device_stats(uint8_t device_index,
+                                                WOOTING_USB_STATS *stats);
+
 /// @brief Returns the number of devices connected
 /// @return The number of devices connected
 WOOTINGRGBSDK_API uint8_t wooting_usb_device_count(void);
@@ -130,6 +249,103 @@ WOOTINGRGBSDK_API int wooting_usb_send_feature_with_response(
     uint8_t *buff, size_t len, uint8_t commandId, uint8_t parameter0,
     uint8_t parameter1, uint8_t parameter2, uint8_t parameter3);
 
+// Device indexed variants of the calls above, for use inside the SDK. They
+// don't touch the selected device and don't disconnect on failure, so they can
+// be called from other threads while the device stays connected. I/O on each
+// device is serialised internally. Failed transfers are retried, and a device
+// that keeps failing is dropped (its meta has connected set to false) and
+// brought back by a later call once it can be opened again.
+uint8_t wooting_usb_selected_device(void);
+bool wooting_usb_device_send_buffer_v1(uint8_t device_index,
+                                       RGB_PARTS part_number,
+                                       const uint8_t rgb_buffer[]);
+bool wooting_usb_device_send_buffer_v2(
+    uint8_t device_index,
+    const uint16_t rgb_buffer[WOOTING_RGB_ROWS][WOOTING_RGB_COLS]);
+/// @brief Writes the header of a v2 colour report, the colours are left alone
+void wooting_usb_v2_report_init(WOOTING_USB_V2_REPORT *report);
+/// @brief Sends a v2 colour report straight from the given memory
+/// With small packets, the byte in front of each packet is briefly borrowed
+/// for its report index, so the report can't be read by another thread while
+/// it's being sent. It's left as it was once this returns.
+bool wooting_usb_device_send_report_v2(uint8_t device_index,
+                                       WOOTING_USB_V2_REPORT *report);
+bool wooting_usb_device_send_feature(uint8_t device_index, uint8_t commandId,
+                                     uint8_t parameter0, uint8_t parameter1,
+                                     uint8_t parameter2, uint8_t parameter3);
+/// @brief Sends a feature report and reads its response
+/// @param buff Receives the first len bytes of the response, may be NULL
+/// @return The size of the response, -1 on failure
+int wooting_usb_device_send_feature_with_response(
+    uint8_t device_index, uint8_t *buff, size_t len, uint8_t commandId,
+    uint8_t parameter0, uint8_t parameter1, uint8_t parameter2,
+    uint8_t parameter3);
+/// @brief CRC-16/CCITT as the v1 colour reports carry it
+uint16_t wooting_usb_crc16ccitt(const uint8_t *buffer, uint16_t size);
+
+typedef enum WOOTING_USB_HOTPLUG_EVENT {
+  HOTPLUG_ARRIVED,
+  HOTPLUG_REMOVED,
+  // The monitor fell behind and missed events, anything may have changed
+  HOTPLUG_EVENTS_LOST
+} WOOTING_USB_HOTPLUG_EVENT;
+
+/// @brief Starts or stops the hotplug monitor
+///
+/// The monitor watches the OS for HID devices coming and going, so
+/// wooting_usb_find_keyboard only enumerates after a Wooting device arrived
+/// and removed devices are dropped straight away. Only available on Linux,
+/// where it listens to kernel uevents for hidraw devices.
+/// @return true if the monitor is running
+bool wooting_usb_hotplug_monitor(bool enable);
+/// @brief Sets the callbacks fired from the monitor thread when a Wooting
+/// device is plugged in or one of the connected devices is removed
+void wooting_usb_set_hotplug_cb(void_cb arrival_cb, void_cb removal_cb);
+/// @brief Called from the monitor thread for every Wooting hidraw device that
+/// appears or disappears. path is the device node hidapi opens it through
+void wooting_usb_hotplug_event(WOOTING_USB_HOTPLUG_EVENT event,
+                               uint16_t vendor_id, uint16_t product_id,
+                               const char *path);
+// Platform specific part of the monitor, see wooting-usb-hotplug.c
+bool wooting_usb_hotplug_start(void);
+void wooting_usb_hotplug_stop(void);
+bool wooting_usb_hotplug_running(void);
+
+// Longest serial number kept in the profile cache, longer ones aren't cached
+#define WOOTING_USB_PROFILE_SERIAL_LEN 64
+
+/// @brief What the profile cache remembers about a device
+///
+/// The first four fields are the key, the rest is what would otherwise be
+/// asked from the device on every connect.
+typedef struct WOOTING_USB_PROFILE {
+  uint16_t vendor_id;
+  uint16_t product_id;
+  // Firmware version, a firmware update may change what the device reports
+  uint16_t release_number;
+  char serial[WOOTING_USB_PROFILE_SERIAL_LEN];
+  bool uses_small_packets;
+  // LAYOUT_UNKNOWN until the layout has been asked from the device
+  WOOTING_DEVICE_LAYOUT layout;
+} WOOTING_USB_PROFILE;
+
+/// @brief Enables the on-disk profile cache, or disables it when path is NULL
+///
+/// With the cache enabled a device it knows gets its meta filled in on connect
+/// without asking the device, which is then checked in the background. The
+/// file can be shared between processes. Should be set before connecting.
+/// Standard is no cache.
+WOOTINGRGBSDK_API void wooting_usb_set_profile_cache(const char *path);
+/// @brief Fills in the key of a profile from an enumerated device
+/// @return false if the cache is disabled or the device has no usable serial
+bool wooting_usb_profile_key(WOOTING_USB_PROFILE *profile,
+                             const struct hid_device_info *info);
+/// @brief Looks up the profile with the same key in the cache file
+/// @return true if it was found and the rest of profile was filled in
+bool wooting_usb_profile_load(WOOTING_USB_PROFILE *profile);
+/// @brief Adds or updates the profile in the cache file
+void wooting_usb_profile_store(const WOOTING_USB_PROFILE *profile);
+
 WOOTINGRGBSDK_API int
 wooting_usb_read_response_timeout(uint8_t *buff, size_t len, int milliseconds);
 WOOTINGRGBSDK_API int wooting_usb_read_response(uint8_t *buff, size_t len);